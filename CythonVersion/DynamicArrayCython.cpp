@@ -1,4 +1,5 @@
 #include "DynamicArrayCython.h"
+#include <cmath>
 
 DynamicArrayCython::DynamicArrayCython(size_t columns) : cols(columns) {}
 
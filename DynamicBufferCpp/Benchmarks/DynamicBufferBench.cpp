@@ -0,0 +1,838 @@
+#include "DynamicArrayCython.h"
+#include "DynamicBuffer.h"
+#include "DynamicBufferPool.h"
+#include "LastKnownValuesBuffer.h"
+#include "constants.h"
+#include "map.h" // Vendored btree
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Arguments shared by the benchmarks: {nVariables, windowSize}, plus the late
+// arrival ratio (in %) or the storage mode where relevant. Each ingest
+// iteration fills a fresh buffer up to its capacity (windowSize *
+// DEFAULT_BUFFER_LENGTH_FACTOR rows), so that no eviction is needed.
+
+namespace {
+const std::vector<std::vector<int64_t>> shapes = {{1, 100}, {8, 1000}, {32, 1000}, {8, 10000}};
+
+size_t capacity(size_t windowSize) { return windowSize * DEFAULT_BUFFER_LENGTH_FACTOR; }
+
+StorageMode storageMode(int64_t circular) {
+    return circular ? StorageMode::Circular : StorageMode::Contiguous;
+}
+
+DataLayout dataLayout(int64_t columnar) {
+    return columnar ? DataLayout::ColumnMajor : DataLayout::RowMajor;
+}
+
+// Row timestamps 0..nRows-1 where about latePercent % of the rows arrive
+// late, swapped with one of the 16 rows before them (fixed seed)
+std::vector<long> rowOrder(size_t nRows, int64_t latePercent) {
+    std::vector<long> order(nRows);
+    for (size_t row = 0; row < nRows; ++row) {
+        order[row] = static_cast<long>(row);
+    }
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<size_t> distance(1, 16);
+    for (size_t row = 1; row < nRows; ++row) {
+        if (percent(generator) < latePercent) {
+            std::swap(order[row], order[row - std::min(row, distance(generator))]);
+        }
+    }
+    return order;
+}
+
+void fill(DynamicBuffer &buffer, size_t nVariables, const std::vector<long> &order) {
+    for (long timestamp: order) {
+        for (size_t column = 0; column < nVariables; ++column) {
+            buffer.addOrUpdateRecord(timestamp, column, static_cast<double>(timestamp));
+        }
+    }
+}
+
+void fillRows(DynamicBuffer &buffer, size_t nVariables, long firstTimestamp, size_t nRows) {
+    for (size_t row = 0; row < nRows; ++row) {
+        long timestamp = firstTimestamp + static_cast<long>(row);
+        for (size_t column = 0; column < nVariables; ++column) {
+            buffer.addOrUpdateRecord(timestamp, column, static_cast<double>(timestamp));
+        }
+    }
+}
+
+void setIngestCounters(benchmark::State &state, size_t nRows, size_t nVariables) {
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * nRows * nVariables));
+}
+
+void ingestShapes(benchmark::internal::Benchmark *bench) {
+    for (const auto &shape: shapes) {
+        bench->Args(shape);
+    }
+}
+
+void lateIngestShapes(benchmark::internal::Benchmark *bench) {
+    for (const auto &shape: shapes) {
+        for (int64_t latePercent: {1, 5, 20}) {
+            bench->Args({shape[0], shape[1], latePercent});
+        }
+    }
+}
+
+void storageModeShapes(benchmark::internal::Benchmark *bench) {
+    for (const auto &shape: shapes) {
+        for (int64_t circular: {0, 1}) {
+            bench->Args({shape[0], shape[1], circular});
+        }
+    }
+}
+
+void dataLayoutShapes(benchmark::internal::Benchmark *bench) {
+    for (const auto &shape: shapes) {
+        for (int64_t columnar: {0, 1}) {
+            bench->Args({shape[0], shape[1], columnar});
+        }
+    }
+}
+
+// Baseline: the btree map of rows the DynamicBuffer replaced
+using BtreeRows = btree::map<long, std::vector<double>>;
+
+void btreeAddOrUpdate(BtreeRows &rows, size_t nVariables, long timestamp, size_t column,
+                      double value) {
+    auto &row = rows[timestamp];
+    if (row.size() < nVariables) {
+        row.resize(nVariables, std::nan(""));
+    }
+    row[column] = value;
+}
+
+void btreeFill(BtreeRows &rows, size_t nVariables, const std::vector<long> &order) {
+    for (long timestamp: order) {
+        for (size_t column = 0; column < nVariables; ++column) {
+            btreeAddOrUpdate(rows, nVariables, timestamp, column, static_cast<double>(timestamp));
+        }
+    }
+}
+
+void arrayFill(DynamicArrayCython &array, size_t nVariables, const std::vector<long> &order) {
+    for (long timestamp: order) {
+        for (size_t column = 0; column < nVariables; ++column) {
+            array.addOrUpdateRow(timestamp, column, static_cast<double>(timestamp));
+        }
+    }
+}
+} // namespace
+
+static void BM_DynamicBufferOrderedIngest(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    std::vector<long> order = rowOrder(capacity(windowSize), 0);
+    for (auto _: state) {
+        state.PauseTiming();
+        DynamicBuffer buffer(nVariables, windowSize);
+        state.ResumeTiming();
+        fill(buffer, nVariables, order);
+        benchmark::ClobberMemory();
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_DynamicBufferOrderedIngest)->Apply(ingestShapes);
+
+// Same ingest, maintaining the rolling statistics of each variable
+static void BM_DynamicBufferOrderedIngestRollingStatistics(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    std::vector<long> order = rowOrder(capacity(windowSize), 0);
+    for (auto _: state) {
+        state.PauseTiming();
+        DynamicBuffer buffer(nVariables, windowSize);
+        buffer.enableRollingStatistics();
+        state.ResumeTiming();
+        fill(buffer, nVariables, order);
+        benchmark::ClobberMemory();
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_DynamicBufferOrderedIngestRollingStatistics)->Apply(ingestShapes);
+
+static void BM_DynamicBufferLateIngest(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    std::vector<long> order = rowOrder(capacity(windowSize), state.range(2));
+    for (auto _: state) {
+        state.PauseTiming();
+        DynamicBuffer buffer(nVariables, windowSize);
+        state.ResumeTiming();
+        fill(buffer, nVariables, order);
+        benchmark::ClobberMemory();
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_DynamicBufferLateIngest)->Apply(lateIngestShapes);
+
+static void BM_DynamicBufferLateIngestStaged(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    std::vector<long> order = rowOrder(capacity(windowSize), state.range(2));
+    for (auto _: state) {
+        state.PauseTiming();
+        DynamicBuffer buffer(nVariables, windowSize);
+        buffer.setLateArrivalStaging(64);
+        state.ResumeTiming();
+        fill(buffer, nVariables, order);
+        buffer.mergeStagedRows();
+        benchmark::ClobberMemory();
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_DynamicBufferLateIngestStaged)->Apply(lateIngestShapes);
+
+static void BM_DynamicBufferUpdateInPlace(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, windowSize);
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<long> timestamps(0, static_cast<long>(windowSize) - 1);
+    std::uniform_int_distribution<size_t> columns(0, nVariables - 1);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(
+            buffer.addOrUpdateRecord(timestamps(generator), columns(generator), 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DynamicBufferUpdateInPlace)->Apply(ingestShapes);
+
+static void BM_DynamicBufferGetSlice(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize, storageMode(state.range(2)));
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    for (auto _: state) {
+        SliceView view = buffer.getSliceView(buffer.maxKey(), windowSize);
+        benchmark::DoNotOptimize(view);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DynamicBufferGetSlice)->Apply(storageModeShapes);
+
+static void BM_DynamicBufferGetSliceTimestamps(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    for (auto _: state) {
+        std::vector<long> timestamps = buffer.getSliceTimestamps(buffer.maxKey(), windowSize);
+        benchmark::DoNotOptimize(timestamps.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DynamicBufferGetSliceTimestamps)->Apply(ingestShapes);
+
+static void BM_DynamicBufferGetSliceWithTimestamps(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    size_t outSize;
+    const long *timestamps;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(
+            buffer.getSliceWithTimestamps(buffer.maxKey(), windowSize, outSize, timestamps));
+        benchmark::DoNotOptimize(timestamps);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DynamicBufferGetSliceWithTimestamps)->Apply(ingestShapes);
+
+// Feature code pattern: one variable read over the whole window
+static void BM_DynamicBufferColumnSum(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize, StorageMode::Contiguous,
+                         dataLayout(state.range(2)));
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    size_t column = nVariables / 2;
+    for (auto _: state) {
+        double sum = 0.0;
+        size_t outSize;
+        if (buffer.getDataLayout() == DataLayout::ColumnMajor) {
+            const double *values = buffer.getColumnSlice(column, buffer.maxKey(), windowSize, outSize);
+            for (size_t i = 0; i < outSize; ++i) {
+                sum += values[i];
+            }
+        } else {
+            const double *values = buffer.getSlice(buffer.maxKey(), windowSize, outSize);
+            for (size_t i = column; i < outSize; i += nVariables) {
+                sum += values[i];
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferColumnSum)->Apply(dataLayoutShapes);
+
+// Completeness check of the window: validity masks vs scanning the values
+static void BM_DynamicBufferCountFullRows(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(buffer.countFullRows(buffer.maxKey(), windowSize));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferCountFullRows)->Apply(ingestShapes);
+
+static void BM_DynamicBufferCountFullRowsNanScan(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    for (auto _: state) {
+        size_t outSize;
+        const double *values = buffer.getSlice(buffer.maxKey(), windowSize, outSize);
+        size_t fullRows = 0;
+        for (size_t row = 0; row < outSize; row += nVariables) {
+            fullRows += std::none_of(values + row, values + row + nVariables,
+                                     [](double value) { return std::isnan(value); });
+        }
+        benchmark::DoNotOptimize(fullRows);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferCountFullRowsNanScan)->Apply(ingestShapes);
+
+// Per-column mean of the window: in-place kernel vs a scalar pass over the slice
+static void BM_DynamicBufferAggregateMean(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    std::vector<double> means(nVariables);
+    for (auto _: state) {
+        buffer.aggregate(buffer.maxKey(), windowSize, Aggregate::Mean, means.data());
+        benchmark::DoNotOptimize(means.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferAggregateMean)->Apply(ingestShapes);
+
+static void BM_DynamicBufferAggregateMeanScalar(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    std::vector<double> sums(nVariables), counts(nVariables);
+    for (auto _: state) {
+        size_t outSize;
+        const double *values = buffer.getSlice(buffer.maxKey(), windowSize, outSize);
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0.0);
+        for (size_t cell = 0; cell < outSize; ++cell) {
+            if (!std::isnan(values[cell])) {
+                sums[cell % nVariables] += values[cell];
+                counts[cell % nVariables] += 1.0;
+            }
+        }
+        for (size_t column = 0; column < nVariables; ++column) {
+            sums[column] /= counts[column];
+        }
+        benchmark::DoNotOptimize(sums.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferAggregateMeanScalar)->Apply(ingestShapes);
+
+// Window resampled on a grid twice as coarse as the rows
+static void BM_DynamicBufferResampleLinear(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize);
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    size_t points = windowSize / 2;
+    std::vector<double> out(points * nVariables);
+    long start = buffer.maxKey() - static_cast<long>(windowSize);
+    for (auto _: state) {
+        buffer.resample(start, 2, points, ResampleMethod::Linear, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferResampleLinear)->Apply(ingestShapes);
+
+// One cycle evicts windowSize rows from a full buffer and appends as many
+static void BM_DynamicBufferRemoveFrontCycle(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize, storageMode(state.range(2)));
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    long nextTimestamp = static_cast<long>(capacity(windowSize));
+    for (auto _: state) {
+        buffer.removeFront(windowSize);
+        fillRows(buffer, nVariables, nextTimestamp, windowSize);
+        nextTimestamp += static_cast<long>(windowSize);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferRemoveFrontCycle)->Apply(storageModeShapes);
+
+// Same cycle, the oldest rows being released through their counters like
+// the application does once they left every window
+static void BM_DynamicBufferRemoveZeroCountCycle(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize, storageMode(state.range(2)));
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    long nextTimestamp = static_cast<long>(capacity(windowSize));
+    std::vector<long> released(windowSize * nVariables);
+    for (auto _: state) {
+        for (size_t row = 0; row < windowSize; ++row) {
+            std::fill_n(released.begin() + row * nVariables, nVariables,
+                        buffer.minKey() + static_cast<long>(row));
+        }
+        buffer.decrementCounters(released);
+        buffer.removeZeroCount();
+        fillRows(buffer, nVariables, nextTimestamp, windowSize);
+        nextTimestamp += static_cast<long>(windowSize);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicBufferRemoveZeroCountCycle)->Apply(storageModeShapes);
+
+// Each row receives a single variable, the others being carried over
+static void BM_LastKnownValuesUpdate(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    size_t nRows = capacity(windowSize);
+    for (auto _: state) {
+        state.PauseTiming();
+        LastKnownValuesBuffer buffer(nVariables, windowSize);
+        state.ResumeTiming();
+        for (size_t row = 0; row < nRows; ++row) {
+            buffer.updateLastKnownValue(static_cast<long>(row), row % nVariables, 1.0);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * nRows));
+}
+BENCHMARK(BM_LastKnownValuesUpdate)->Apply(ingestShapes);
+
+// Corrections of the oldest row, carried over by all the rows after it
+static void BM_LastKnownValuesCorrection(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    size_t nRows = capacity(windowSize);
+    LastKnownValuesBuffer buffer(nVariables, windowSize);
+    for (size_t column = 0; column < nVariables; ++column) {
+        buffer.updateLastKnownValue(0, column, 0.0);
+    }
+    for (size_t row = 1; row < nRows; ++row) {
+        buffer.updateLastKnownValue(static_cast<long>(row), nVariables - 1, 1.0);
+    }
+    double value = 0.0;
+    for (auto _: state) {
+        buffer.updateLastKnownValue(0, 0, ++value);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_LastKnownValuesCorrection)->Apply(ingestShapes);
+
+// Many small series created and filled a batch of rows at a time (one
+// sample per variable of each series and row): a buffer per series against
+// a pool of them. Arguments: {number of series, rows per series}.
+const size_t seriesVariables = 4;
+
+void seriesShapes(benchmark::internal::Benchmark *bench) {
+    bench->Args({10000, 64});
+    bench->Args({100000, 16});
+}
+
+BufferPolicy seriesPolicy() {
+    BufferPolicy policy;
+    policy.lazyAllocation = true;
+    return policy;
+}
+
+static void BM_SeriesSeparateBuffers(benchmark::State &state) {
+    size_t nSeries = state.range(0);
+    size_t nRows = state.range(1);
+    for (auto _: state) {
+        std::vector<std::unique_ptr<DynamicBuffer>> series;
+        for (size_t id = 0; id < nSeries; ++id) {
+            series.emplace_back(new DynamicBuffer(seriesVariables, nRows, StorageMode::Contiguous,
+                                                  DataLayout::RowMajor, seriesPolicy()));
+        }
+        for (size_t row = 0; row < nRows; ++row) {
+            for (size_t id = 0; id < nSeries; ++id) {
+                for (size_t column = 0; column < seriesVariables; ++column) {
+                    series[id]->addOrUpdateRecord(static_cast<long>(row), column, 1.0);
+                }
+            }
+        }
+        benchmark::ClobberMemory();
+    }
+    setIngestCounters(state, nSeries * nRows, seriesVariables);
+}
+BENCHMARK(BM_SeriesSeparateBuffers)->Apply(seriesShapes)->Unit(benchmark::kMillisecond);
+
+static void BM_SeriesPoolIngest(benchmark::State &state) {
+    size_t nSeries = state.range(0);
+    size_t nRows = state.range(1);
+    // One batch per row: every series gets its samples
+    std::vector<size_t> ids(nSeries * seriesVariables);
+    std::vector<size_t> columns(ids.size());
+    std::vector<long> timestamps(ids.size());
+    std::vector<double> values(ids.size(), 1.0);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ids[i] = i / seriesVariables;
+        columns[i] = i % seriesVariables;
+    }
+    for (auto _: state) {
+        DynamicBufferPool pool(seriesVariables, nRows, StorageMode::Contiguous, DataLayout::RowMajor,
+                               seriesPolicy());
+        pool.addSeries(nSeries);
+        for (size_t row = 0; row < nRows; ++row) {
+            std::fill(timestamps.begin(), timestamps.end(), static_cast<long>(row));
+            pool.ingest(ids.data(), timestamps.data(), columns.data(), values.data(), ids.size());
+        }
+        benchmark::ClobberMemory();
+    }
+    setIngestCounters(state, nSeries * nRows, seriesVariables);
+}
+BENCHMARK(BM_SeriesPoolIngest)->Apply(seriesShapes)->Unit(benchmark::kMillisecond);
+
+// Pool of nSeries series holding nRows rows each
+std::unique_ptr<DynamicBufferPool> filledPool(size_t nSeries, size_t nRows) {
+    std::unique_ptr<DynamicBufferPool> pool(new DynamicBufferPool(seriesVariables, nRows));
+    pool->addSeries(nSeries);
+    std::vector<size_t> ids(nSeries * seriesVariables);
+    std::vector<size_t> columns(ids.size());
+    std::vector<long> timestamps(ids.size());
+    std::vector<double> values(ids.size(), 1.0);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ids[i] = i / seriesVariables;
+        columns[i] = i % seriesVariables;
+    }
+    for (size_t row = 0; row < nRows; ++row) {
+        std::fill(timestamps.begin(), timestamps.end(), static_cast<long>(row));
+        pool->ingest(ids.data(), timestamps.data(), columns.data(), values.data(), ids.size());
+    }
+    return pool;
+}
+
+constexpr size_t gatherSeries = 10000;
+constexpr size_t gatherRows = 64;
+constexpr size_t gatherN = 32;
+
+// One slice per series then a copy into the tensor, as a loop over the
+// series stacking their slices would do
+static void BM_SeriesSliceLoop(benchmark::State &state) {
+    std::unique_ptr<DynamicBufferPool> pool = filledPool(gatherSeries, gatherRows);
+    std::vector<double> out(gatherSeries * gatherN * seriesVariables);
+    for (auto _: state) {
+        for (size_t id = 0; id < gatherSeries; ++id) {
+            const DynamicBuffer &buffer = pool->getSeries(id);
+            std::vector<double> slice(gatherN * seriesVariables);
+            buffer.copySlice(gatherRows / 2, gatherN, slice.data(), nullptr);
+            std::copy(slice.begin(), slice.end(), out.begin() + id * gatherN * seriesVariables);
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * gatherSeries);
+}
+BENCHMARK(BM_SeriesSliceLoop)->Unit(benchmark::kMillisecond);
+
+// gatherSlices over the same series with the given number of threads (0 for
+// one per core)
+static void BM_SeriesGatherSlices(benchmark::State &state) {
+    std::unique_ptr<DynamicBufferPool> pool = filledPool(gatherSeries, gatherRows);
+    std::vector<size_t> ids(gatherSeries);
+    for (size_t id = 0; id < gatherSeries; ++id) {
+        ids[id] = id;
+    }
+    std::vector<double> out(gatherSeries * gatherN * seriesVariables);
+    for (auto _: state) {
+        pool->gatherSlices(ids.data(), gatherSeries, gatherRows / 2, gatherN, out.data(), nullptr, nullptr,
+                           state.range(0));
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * gatherSeries);
+}
+BENCHMARK(BM_SeriesGatherSlices)->Arg(1)->Arg(4)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Restoring a buffer of nRows rows of 64 variables: replaying its history,
+// or loading a snapshot file copied or mapped (state.range(1))
+static void BM_SnapshotReplay(benchmark::State &state) {
+    size_t nRows = state.range(0);
+    for (auto _: state) {
+        DynamicBuffer buffer(64, nRows / DEFAULT_BUFFER_LENGTH_FACTOR + 1);
+        for (size_t row = 0; row < nRows; ++row) {
+            for (size_t column = 0; column < 64; ++column) {
+                buffer.addOrUpdateRecord(static_cast<long>(row), column, 1.0);
+            }
+        }
+        benchmark::DoNotOptimize(buffer.getNumRows());
+    }
+}
+BENCHMARK(BM_SnapshotReplay)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+static void BM_SnapshotLoad(benchmark::State &state) {
+    size_t nRows = state.range(0);
+    std::string path = "DynamicBuffer_bench_snapshot.bin";
+    {
+        DynamicBuffer buffer(64, nRows / DEFAULT_BUFFER_LENGTH_FACTOR + 1);
+        for (size_t row = 0; row < nRows; ++row) {
+            for (size_t column = 0; column < 64; ++column) {
+                buffer.addOrUpdateRecord(static_cast<long>(row), column, 1.0);
+            }
+        }
+        buffer.saveSnapshot(path);
+    }
+    for (auto _: state) {
+        DynamicBuffer buffer(1, 1);
+        buffer.loadSnapshot(path, state.range(1) != 0);
+        benchmark::DoNotOptimize(buffer.getNumRows());
+    }
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_SnapshotLoad)->ArgsProduct({{10000, 100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+// Ingesting 100k samples into a buffer of 64 variables without a
+// write-ahead log, with one (state.range(0) = 1) or with one synced on every
+// group written (2), and replaying that log into a fresh buffer
+static void BM_WriteAheadLogIngest(benchmark::State &state) {
+    const size_t nRows = 100000 / 64;
+    std::string path = "DynamicBuffer_bench_wal.bin";
+    WriteAheadLogPolicy policy;
+    policy.fsync = state.range(0) == 2 ? FsyncPolicy::EveryFlush : FsyncPolicy::Never;
+    for (auto _: state) {
+        std::remove(path.c_str());
+        DynamicBuffer buffer(64, nRows);
+        std::unique_ptr<WriteAheadLog> log;
+        if (state.range(0) != 0) {
+            log.reset(new WriteAheadLog(path, policy));
+            buffer.setWriteAheadLog(log.get());
+        }
+        for (size_t row = 0; row < nRows; ++row) {
+            for (size_t column = 0; column < 64; ++column) {
+                buffer.addOrUpdateRecord(static_cast<long>(row), column, 1.0);
+            }
+        }
+        if (log) {
+            log->flush();
+        }
+        benchmark::DoNotOptimize(buffer.getNumRows());
+    }
+    state.SetItemsProcessed(state.iterations() * nRows * 64);
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_WriteAheadLogIngest)->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+static void BM_WriteAheadLogReplay(benchmark::State &state) {
+    const size_t nRows = 100000 / 64;
+    std::string path = "DynamicBuffer_bench_wal.bin";
+    std::remove(path.c_str());
+    {
+        DynamicBuffer buffer(64, nRows);
+        WriteAheadLog log(path);
+        buffer.setWriteAheadLog(&log);
+        for (size_t row = 0; row < nRows; ++row) {
+            for (size_t column = 0; column < 64; ++column) {
+                buffer.addOrUpdateRecord(static_cast<long>(row), column, 1.0);
+            }
+        }
+        buffer.setWriteAheadLog(nullptr);
+    }
+    for (auto _: state) {
+        DynamicBuffer buffer(64, nRows);
+        benchmark::DoNotOptimize(buffer.replayWriteAheadLog(path));
+    }
+    state.SetItemsProcessed(state.iterations() * nRows * 64);
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_WriteAheadLogReplay)->Unit(benchmark::kMillisecond);
+
+// Arrow record batch of the window: copied rows vs columns served in place
+static void BM_ArrowExportSlice(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicBuffer buffer(nVariables, windowSize, StorageMode::Contiguous,
+                         dataLayout(state.range(2)));
+    fillRows(buffer, nVariables, 0, capacity(windowSize));
+    for (auto _: state) {
+        ArrowSchema schema;
+        ArrowArray array;
+        buffer.exportArrowSlice(buffer.maxKey(), windowSize, &schema, &array);
+        benchmark::DoNotOptimize(array.length);
+        array.release(&array);
+        schema.release(&schema);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_ArrowExportSlice)->Apply(dataLayoutShapes);
+
+// Baselines
+
+static void BM_BtreeOrderedIngest(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    std::vector<long> order = rowOrder(capacity(state.range(1)), 0);
+    for (auto _: state) {
+        BtreeRows rows;
+        btreeFill(rows, nVariables, order);
+        benchmark::DoNotOptimize(rows.size());
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_BtreeOrderedIngest)->Apply(ingestShapes);
+
+static void BM_BtreeLateIngest(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    std::vector<long> order = rowOrder(capacity(state.range(1)), state.range(2));
+    for (auto _: state) {
+        BtreeRows rows;
+        btreeFill(rows, nVariables, order);
+        benchmark::DoNotOptimize(rows.size());
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_BtreeLateIngest)->Apply(lateIngestShapes);
+
+static void BM_BtreeUpdateInPlace(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    BtreeRows rows;
+    btreeFill(rows, nVariables, rowOrder(windowSize, 0));
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<long> timestamps(0, static_cast<long>(windowSize) - 1);
+    std::uniform_int_distribution<size_t> columns(0, nVariables - 1);
+    for (auto _: state) {
+        btreeAddOrUpdate(rows, nVariables, timestamps(generator), columns(generator), 1.0);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BtreeUpdateInPlace)->Apply(ingestShapes);
+
+// The rows aren't contiguous, so the slice has to be gathered into a copy
+static void BM_BtreeGetSlice(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    BtreeRows rows;
+    btreeFill(rows, nVariables, rowOrder(capacity(windowSize), 0));
+    std::vector<double> slice(windowSize * nVariables);
+    for (auto _: state) {
+        auto it = rows.end();
+        for (size_t row = windowSize; row > 0 && it != rows.begin(); --row) {
+            --it;
+            std::copy(it->second.begin(), it->second.end(),
+                      slice.begin() + (row - 1) * nVariables);
+        }
+        benchmark::DoNotOptimize(slice.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BtreeGetSlice)->Apply(ingestShapes);
+
+static void BM_BtreeRemoveFrontCycle(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    BtreeRows rows;
+    btreeFill(rows, nVariables, rowOrder(capacity(windowSize), 0));
+    long nextTimestamp = static_cast<long>(capacity(windowSize));
+    for (auto _: state) {
+        auto last = rows.begin();
+        std::advance(last, windowSize);
+        rows.erase(rows.begin(), last);
+        for (size_t row = 0; row < windowSize; ++row, ++nextTimestamp) {
+            for (size_t column = 0; column < nVariables; ++column) {
+                btreeAddOrUpdate(rows, nVariables, nextTimestamp, column, 1.0);
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_BtreeRemoveFrontCycle)->Apply(ingestShapes);
+
+static void BM_DynamicArrayCythonOrderedIngest(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    std::vector<long> order = rowOrder(capacity(state.range(1)), 0);
+    for (auto _: state) {
+        DynamicArrayCython array(nVariables);
+        arrayFill(array, nVariables, order);
+        benchmark::DoNotOptimize(array.getNumRows());
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_DynamicArrayCythonOrderedIngest)->Apply(ingestShapes);
+
+static void BM_DynamicArrayCythonLateIngest(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    std::vector<long> order = rowOrder(capacity(state.range(1)), state.range(2));
+    for (auto _: state) {
+        DynamicArrayCython array(nVariables);
+        arrayFill(array, nVariables, order);
+        benchmark::DoNotOptimize(array.getNumRows());
+    }
+    setIngestCounters(state, order.size(), nVariables);
+}
+BENCHMARK(BM_DynamicArrayCythonLateIngest)->Apply(lateIngestShapes);
+
+static void BM_DynamicArrayCythonUpdateInPlace(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicArrayCython array(nVariables);
+    arrayFill(array, nVariables, rowOrder(windowSize, 0));
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<long> timestamps(0, static_cast<long>(windowSize) - 1);
+    std::uniform_int_distribution<size_t> columns(0, nVariables - 1);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(
+            array.addOrUpdateRow(timestamps(generator), columns(generator), 1.0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DynamicArrayCythonUpdateInPlace)->Apply(ingestShapes);
+
+static void BM_DynamicArrayCythonGetSlice(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicArrayCython array(nVariables);
+    arrayFill(array, nVariables, rowOrder(capacity(windowSize), 0));
+    for (auto _: state) {
+        std::vector<double> slice = array.getFlattenedSlice(array.maxKey(), windowSize);
+        benchmark::DoNotOptimize(slice.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DynamicArrayCythonGetSlice)->Apply(ingestShapes);
+
+static void BM_DynamicArrayCythonRemoveFrontCycle(benchmark::State &state) {
+    size_t nVariables = state.range(0);
+    size_t windowSize = state.range(1);
+    DynamicArrayCython array(nVariables);
+    arrayFill(array, nVariables, rowOrder(capacity(windowSize), 0));
+    long nextTimestamp = static_cast<long>(capacity(windowSize));
+    for (auto _: state) {
+        for (size_t row = 0; row < windowSize; ++row) {
+            array.removeFirstElement();
+        }
+        for (size_t row = 0; row < windowSize; ++row, ++nextTimestamp) {
+            for (size_t column = 0; column < nVariables; ++column) {
+                array.addOrUpdateRow(nextTimestamp, column, 1.0);
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * windowSize));
+}
+BENCHMARK(BM_DynamicArrayCythonRemoveFrontCycle)->Apply(ingestShapes);
+
+BENCHMARK_MAIN();
@@ -1,7 +1,36 @@
 #include "DynamicBuffer.h"
+#include "LastKnownValuesBuffer.h"
+#include "DynamicBufferPool.h"
 #include <gtest/gtest.h>
 #include <vector>
 #include <cmath> // For std::isnan
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <thread>
+
+// Counts the heap allocations of the test binary, to check the ingest path
+std::atomic<size_t> allocationCount(0);
+
+void *operator new(size_t size) {
+    ++allocationCount;
+    if (void *pointer = std::malloc(size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, size_t) noexcept { ::operator delete(pointer); }
+
+void *operator new[](size_t size) { return ::operator new(size); }
+
+void operator delete[](void *pointer) noexcept { ::operator delete(pointer); }
+
+void operator delete[](void *pointer, size_t) noexcept { ::operator delete(pointer); }
 
 class DynamicBufferTest : public ::testing::Test {
 protected:
@@ -236,6 +265,1161 @@ TEST_F(DynamicBufferTest, OrderedInsertionNewEntryCheckTwoVariable) {
     EXPECT_FALSE(secondEntry);
 }
 
+TEST_F(DynamicBufferTest, LookupAfterRemoveFrontTwoVariables) {
+    for (long timestamp = 100; timestamp < 110; ++timestamp) {
+        buffer.addOrUpdateRecord(timestamp, 0, timestamp * 0.1);
+    }
+    buffer.removeFront(4);
+
+    ASSERT_EQ(buffer.getNumRows(), 6u);
+    EXPECT_EQ(buffer.minKey(), 104);
+    EXPECT_EQ(buffer.maxKey(), 109);
+    EXPECT_THROW(buffer.getRecordByTimestamp(103), std::invalid_argument);
+    EXPECT_NEAR(buffer.getRecordByTimestamp(107)[0], 10.7, 1e-5);
+
+    // Late insertion between the remaining rows
+    buffer.addOrUpdateRecord(109, 1, 2.9);
+    buffer.deleteRecord(106);
+    auto timestamps = buffer.getSliceTimestamps(109, 10);
+    ASSERT_EQ(timestamps.size(), 5u);
+    EXPECT_EQ(timestamps[0], 104);
+    EXPECT_EQ(timestamps[2], 107);
+    EXPECT_EQ(timestamps[4], 109);
+}
+
+TEST_F(DynamicBufferTest, SliceStopsAtRequestedTimestamp) {
+    buffer.addOrUpdateRecord(100, 0, 1.0);
+    buffer.addOrUpdateRecord(101, 0, 1.1);
+    buffer.addOrUpdateRecord(102, 0, 1.2);
+
+    size_t outSize;
+    auto slice = buffer.getSlice(101, 5, outSize);
+    ASSERT_EQ(outSize, 2 * buffer.getNVariables());
+    EXPECT_NEAR(slice[0], 1.0, 1e-5);
+    EXPECT_NEAR(slice[2], 1.1, 1e-5);
+    EXPECT_EQ(buffer.getSliceTimestamps(101, 5).size(), 2u);
+
+    EXPECT_EQ(buffer.getSlice(99, 5, outSize), nullptr);
+    EXPECT_EQ(outSize, 0u);
+}
+
+TEST(CircularDynamicBufferTest, EvictionAdvancesHeadAndSliceWraps) {
+    DynamicBuffer ring(1, 2, StorageMode::Circular); // Room for 6 rows
+    for (long i = 0; i < 6; ++i) {
+        ring.addOrUpdateRecord(i * 10, 0, i);
+    }
+    ring.decrementCounters({0, 10, 20, 30});
+    for (long i = 6; i < 10; ++i) {
+        ring.addOrUpdateRecord(i * 10, 0, i); // Evicts the 4 oldest rows once
+    }
+    ASSERT_EQ(ring.getNumRows(), 6u);
+    EXPECT_EQ(ring.minKey(), 40);
+    EXPECT_EQ(ring.maxKey(), 90);
+
+    size_t outSize;
+    // Rows 40 to 70 wrap around the end of the storage
+    EXPECT_EQ(ring.getSlice(70, 4, outSize), nullptr);
+    SliceView view = ring.getSliceView(70, 4);
+    ASSERT_EQ(view.firstSize, 2u);
+    ASSERT_EQ(view.secondSize, 2u);
+    EXPECT_NEAR(view.first[0], 4, 1e-5);
+    EXPECT_NEAR(view.first[1], 5, 1e-5);
+    EXPECT_NEAR(view.second[0], 6, 1e-5);
+    EXPECT_NEAR(view.second[1], 7, 1e-5);
+
+    auto slice = ring.getSlice(90, 3, outSize);
+    ASSERT_EQ(outSize, 3u);
+    EXPECT_NEAR(slice[0], 7, 1e-5);
+    EXPECT_NEAR(slice[2], 9, 1e-5);
+
+    // Out of order insertion across the wrap point
+    ring.deleteRecord(80);
+    ring.addOrUpdateRecord(55, 0, 5.5);
+    std::vector<long> expected = {40, 50, 55, 60, 70, 90};
+    EXPECT_EQ(ring.getSliceTimestamps(90, 10), expected);
+    EXPECT_NEAR(ring.getRecordByTimestamp(55)[0], 5.5, 1e-5);
+    EXPECT_NEAR(ring.getRecordByTimestamp(60)[0], 6, 1e-5);
+    EXPECT_NEAR(ring.getRecordByTimestamp(90)[0], 9, 1e-5);
+}
+
+TEST_F(DynamicBufferTest, StagedLateArrivalsAreMergedBeforeReads) {
+    buffer.setLateArrivalStaging(3);
+    for (long timestamp = 100; timestamp <= 110; timestamp += 2) {
+        buffer.addOrUpdateRecord(timestamp, 0, timestamp * 0.1);
+    }
+    EXPECT_TRUE(buffer.addOrUpdateRecord(105, 0, 10.5));
+    EXPECT_TRUE(buffer.addOrUpdateRecord(101, 0, 10.1));
+    EXPECT_FALSE(buffer.addOrUpdateRecord(105, 1, 20.5)); // Update of a staged row
+    EXPECT_EQ(buffer.getStagedRowCount(), 2u);
+    EXPECT_EQ(buffer.getNumRows(), 8u);
+    EXPECT_EQ(buffer.minKey(), 100);
+    EXPECT_EQ(buffer.getVariableUpdateCount(105), 2u);
+
+    size_t outSize;
+    auto slice = buffer.getSlice(106, 4, outSize);
+    EXPECT_EQ(buffer.getStagedRowCount(), 0u);
+    ASSERT_EQ(outSize, 4 * buffer.getNVariables());
+    EXPECT_NEAR(slice[0], 10.2, 1e-5); // -> Timestamp 102
+    EXPECT_NEAR(slice[2], 10.4, 1e-5); // -> Timestamp 104
+    EXPECT_NEAR(slice[4], 10.5, 1e-5); // -> Timestamp 105 variable 0
+    EXPECT_NEAR(slice[5], 20.5, 1e-5); // -> Timestamp 105 variable 1
+    EXPECT_NEAR(slice[6], 10.6, 1e-5); // -> Timestamp 106
+
+    // The side buffer is merged as soon as it is full
+    buffer.addOrUpdateRecord(103, 0, 10.3);
+    buffer.addOrUpdateRecord(107, 0, 10.7);
+    EXPECT_EQ(buffer.getStagedRowCount(), 2u);
+    buffer.addOrUpdateRecord(109, 0, 10.9);
+    EXPECT_EQ(buffer.getStagedRowCount(), 0u);
+
+    std::vector<long> expected = {100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110};
+    EXPECT_EQ(buffer.getSliceTimestamps(110, 20), expected);
+}
+
+TEST_F(DynamicBufferTest, BatchedIngestMatchesSingleRecords) {
+    std::vector<long> timestamps = {104, 100, 102, 100, 101, 104, 103, 100, 99};
+    std::vector<size_t> columns = {0, 0, 1, 1, 0, 1, 0, 0, 1};
+    std::vector<double> values = {1.4, 1.0, 2.2, 2.0, 1.1, 2.4, 1.3, 1.05, 2.9};
+
+    // Ordered rows first, so that the batch has to insert late rows
+    buffer.addOrUpdateRecord(102, 0, 1.2);
+    buffer.addOrUpdateRecord(105, 0, 1.5);
+    bufferUniqueVariable.addOrUpdateRecord(102, 0, 1.2);
+    DynamicBuffer reference(2, 10);
+    reference.addOrUpdateRecord(102, 0, 1.2);
+    reference.addOrUpdateRecord(105, 0, 1.5);
+    for (size_t i = 0; i < timestamps.size(); ++i) {
+        reference.addOrUpdateRecord(timestamps[i], columns[i], values[i]);
+    }
+
+    size_t newRows = buffer.addOrUpdateRecords(timestamps.data(), columns.data(), values.data(),
+                                               timestamps.size());
+    EXPECT_EQ(newRows, 5u); // 99, 100, 101, 103 and 104
+    ASSERT_EQ(buffer.getNumRows(), reference.getNumRows());
+    EXPECT_EQ(buffer.getSliceTimestamps(105, 10), reference.getSliceTimestamps(105, 10));
+    for (long timestamp = 99; timestamp <= 105; ++timestamp) {
+        auto record = buffer.getRecordByTimestamp(timestamp);
+        auto expected = reference.getRecordByTimestamp(timestamp);
+        for (size_t column = 0; column < 2; ++column) {
+            if (std::isnan(expected[column])) {
+                EXPECT_TRUE(std::isnan(record[column]));
+            } else {
+                EXPECT_NEAR(record[column], expected[column], 1e-5);
+            }
+        }
+        EXPECT_EQ(buffer.getVariableUpdateCount(timestamp), reference.getVariableUpdateCount(timestamp));
+    }
+    EXPECT_EQ(buffer.getCounters(), reference.getCounters());
+
+    std::vector<size_t> badColumns = {0, 2};
+    EXPECT_THROW(bufferUniqueVariable.addOrUpdateRecords(timestamps.data(), badColumns.data(),
+                                                         values.data(), 2),
+                 std::invalid_argument);
+    EXPECT_EQ(bufferUniqueVariable.getNumRows(), 1u);
+}
+
+TEST(ConcurrentDynamicBufferTest, ReadersSeeConsistentSlicesWhileWriterEvicts) {
+    const size_t nVariables = 3;
+    DynamicBuffer shared(nVariables, 20, StorageMode::Circular);
+    shared.enableConcurrentAccess();
+    shared.setLateArrivalStaging(4);
+    std::atomic<long> latest(-1);
+    std::atomic<bool> done(false);
+    std::atomic<size_t> errors(0);
+
+    std::thread writer([&]() {
+        for (long timestamp = 0; timestamp < 20000; ++timestamp) {
+            for (size_t column = 0; column < nVariables; ++column) {
+                shared.addOrUpdateRecord(timestamp, column, timestamp * 10.0 + column);
+            }
+            if (timestamp % 7 == 0 && timestamp > 0) {
+                shared.deleteRecord(timestamp - 1);
+                shared.addOrUpdateRecord(timestamp - 1, 0, (timestamp - 1) * 10.0); // Late arrival
+            }
+            if (shared.getNumRows() > 40) {
+                shared.removeFront(10);
+            }
+            latest = timestamp;
+        }
+        done = true;
+    });
+
+    auto reader = [&](bool pin) {
+        std::vector<double> values(8 * nVariables);
+        std::vector<long> timestamps(8);
+        while (!done) {
+            long timestamp = latest;
+            if (timestamp < 0) {
+                continue;
+            }
+            if (pin) {
+                SliceView view = shared.pinSlice(timestamp, 8);
+                if (view.first == nullptr) {
+                    continue;
+                }
+                // The pinned rows can't move: they still hold their values
+                std::this_thread::yield();
+                const double *last = (view.second != nullptr)
+                                     ? view.second + view.secondSize - nVariables
+                                     : view.first + view.firstSize - nVariables;
+                if (last[0] != timestamp * 10.0) {
+                    ++errors;
+                }
+                shared.unpinSlice();
+            } else {
+                size_t rows = shared.copySlice(timestamp, 8, values.data(), timestamps.data());
+                for (size_t row = 0; row < rows; ++row) {
+                    if (row > 0 && timestamps[row] <= timestamps[row - 1]) {
+                        ++errors;
+                    }
+                    if (values[row * nVariables] == values[row * nVariables] &&
+                        values[row * nVariables] != timestamps[row] * 10.0) {
+                        ++errors;
+                    }
+                }
+            }
+        }
+    };
+    std::thread copyReader(reader, false);
+    std::thread pinReader(reader, true);
+    writer.join();
+    copyReader.join();
+    pinReader.join();
+
+    EXPECT_EQ(errors, 0u);
+    EXPECT_EQ(shared.maxKey(), 19999);
+}
+
+TEST_F(DynamicBufferTest, LeasedStorageSurvivesRowMoves) {
+    for (long timestamp = 100; timestamp < 106; timestamp += 2) {
+        buffer.addOrUpdateRecord(timestamp, 0, timestamp * 0.1);
+    }
+    size_t outSize;
+    const double *view = buffer.getSlice(104, 3, outSize);
+    size_t generation = buffer.acquireStorageLease();
+
+    // In-place updates are visible through the view
+    buffer.addOrUpdateRecord(104, 1, 20.4);
+    EXPECT_NEAR(view[5], 20.4, 1e-5);
+
+    // Moving rows leaves the leased block untouched
+    buffer.addOrUpdateRecord(101, 0, 10.1);
+    buffer.removeFront(1);
+    EXPECT_EQ(buffer.getRetiredStorageCount(), 1u);
+    EXPECT_NEAR(view[0], 10.0, 1e-5);
+    EXPECT_NEAR(view[2], 10.2, 1e-5);
+    EXPECT_NEAR(view[4], 10.4, 1e-5);
+
+    std::vector<long> expected = {101, 102, 104};
+    EXPECT_EQ(buffer.getSliceTimestamps(104, 3), expected);
+    EXPECT_NEAR(buffer.getRecordByTimestamp(101)[0], 10.1, 1e-5);
+
+    buffer.releaseStorageLease(generation);
+    EXPECT_EQ(buffer.getRetiredStorageCount(), 0u);
+}
+
+TEST_F(DynamicBufferTest, SliceWithTimestampsInSingleLookup) {
+    for (long timestamp = 100; timestamp < 110; timestamp += 2) {
+        buffer.addOrUpdateRecord(timestamp, 0, timestamp * 0.1);
+    }
+    size_t outSize;
+    const long *timestamps = nullptr;
+    const double *slice = buffer.getSliceWithTimestamps(106, 3, outSize, timestamps);
+    ASSERT_NE(slice, nullptr);
+    ASSERT_EQ(outSize, 3 * buffer.getNVariables());
+    EXPECT_EQ(timestamps[0], 102);
+    EXPECT_EQ(timestamps[2], 106);
+    EXPECT_NEAR(slice[4], 10.6, 1e-5);
+
+    // The leased timestamps stay in place when rows are moved
+    size_t generation = buffer.acquireStorageLease();
+    buffer.addOrUpdateRecord(103, 0, 10.3);
+    EXPECT_EQ(timestamps[1], 104);
+    std::vector<long> expected = {103, 104, 106};
+    EXPECT_EQ(buffer.getSliceTimestamps(106, 3), expected);
+    buffer.releaseStorageLease(generation);
+
+    // Unknown timestamp
+    EXPECT_EQ(buffer.getSliceWithTimestamps(105, 3, outSize, timestamps), nullptr);
+    EXPECT_EQ(timestamps, nullptr);
+}
+
+TEST(ColumnMajorDynamicBufferTest, ColumnSlicesAreContiguousAndRowSlicesGathered) {
+    DynamicBuffer buffer(2, 2, StorageMode::Circular, DataLayout::ColumnMajor); // 6 rows
+    for (long timestamp = 100; timestamp < 106; ++timestamp) {
+        buffer.addOrUpdateRecord(timestamp, 0, timestamp * 0.1);
+        buffer.addOrUpdateRecord(timestamp, 1, -timestamp * 0.1);
+    }
+    buffer.addOrUpdateRecord(103, 1, 5.0); // In place
+    buffer.deleteRecord(102);              // Moves rows
+
+    size_t outSize;
+    const double *column = buffer.getColumnSlice(1, 105, 3, outSize);
+    ASSERT_NE(column, nullptr);
+    ASSERT_EQ(outSize, 3u);
+    EXPECT_NEAR(column[0], 5.0, 1e-5);
+    EXPECT_NEAR(column[1], -10.4, 1e-5);
+    EXPECT_NEAR(column[2], -10.5, 1e-5);
+
+    // Row slices are gathered in row-major order
+    const double *slice = buffer.getSlice(104, 2, outSize);
+    ASSERT_EQ(outSize, 4u);
+    EXPECT_NEAR(slice[0], 10.3, 1e-5);
+    EXPECT_NEAR(slice[1], 5.0, 1e-5);
+    EXPECT_NEAR(slice[2], 10.4, 1e-5);
+    EXPECT_NEAR(slice[3], -10.4, 1e-5);
+
+    // Once the head advanced, a column slice may wrap around the ring
+    buffer.removeFront(3);
+    buffer.addOrUpdateRecord(106, 0, 10.6);
+    buffer.addOrUpdateRecord(107, 0, 10.7);
+    EXPECT_EQ(buffer.getColumnSlice(0, 107, 4, outSize), nullptr);
+    SliceView view = buffer.getColumnSliceView(0, 107, 4);
+    ASSERT_NE(view.second, nullptr);
+    std::vector<double> values(view.first, view.first + view.firstSize);
+    values.insert(values.end(), view.second, view.second + view.secondSize);
+    std::vector<long> timestamps(view.firstTimestamps, view.firstTimestamps + view.firstSize);
+    timestamps.insert(timestamps.end(), view.secondTimestamps,
+                      view.secondTimestamps + view.secondSize);
+    std::vector<long> expectedTimestamps = {104, 105, 106, 107};
+    EXPECT_EQ(timestamps, expectedTimestamps);
+    EXPECT_NEAR(values[0], 10.4, 1e-5);
+    EXPECT_NEAR(values[3], 10.7, 1e-5);
+
+    EXPECT_THROW(buffer.getColumnSliceView(2, 107, 1), std::invalid_argument);
+    DynamicBuffer rowMajor(2, 2);
+    rowMajor.addOrUpdateRecord(100, 0, 1.0);
+    EXPECT_EQ(rowMajor.getColumnSlice(0, 100, 1, outSize), nullptr);
+}
+
+TEST(TypedDynamicBufferTest, FloatAndIntegerPayloads) {
+    BasicDynamicBuffer<float> floats(2, 10);
+    floats.addOrUpdateRecord(100, 0, 1.5f);
+    floats.addOrUpdateRecord(99, 1, 2.5f);
+    size_t outSize;
+    const float *slice = floats.getSlice(100, 2, outSize);
+    ASSERT_EQ(outSize, 4u);
+    EXPECT_TRUE(std::isnan(slice[0]));
+    EXPECT_FLOAT_EQ(slice[1], 2.5f);
+    EXPECT_FLOAT_EQ(slice[2], 1.5f);
+
+    // Integers use the lowest value as the missing marker
+    BasicDynamicBuffer<int32_t> integers(2, 10);
+    const int32_t missing = MissingValue<int32_t>::value();
+    EXPECT_EQ(missing, std::numeric_limits<int32_t>::min());
+    EXPECT_TRUE(integers.addOrUpdateRecord(100, 0, 7));
+    EXPECT_TRUE(integers.addOrUpdateRecord(98, 1, 0));
+    EXPECT_FALSE(integers.addOrUpdateRecord(100, 1, 8));
+    std::vector<int32_t> expected = {missing, 0, 7, 8};
+    const int32_t *values = integers.getSlice(100, 2, outSize);
+    EXPECT_EQ(std::vector<int32_t>(values, values + outSize), expected);
+
+    BasicLastKnownValuesBuffer<int64_t> lastKnownValues(2, 10);
+    lastKnownValues.updateLastKnownValue(100, 0, 1);
+    lastKnownValues.updateLastKnownValue(101, 1, 2);
+    std::vector<int64_t> expectedRow = {1, 2};
+    EXPECT_EQ(lastKnownValues.getRecordByTimestamp(101), expectedRow);
+}
+
+TEST(ValidityDynamicBufferTest, FillMasksTrackWrittenCells) {
+    DynamicBuffer ring(3, 2, StorageMode::Circular); // Room for 6 rows
+    for (long t = 0; t < 8; ++t) {
+        ring.addOrUpdateRecord(t, 0, t);
+        if (t % 2 == 0) {
+            ring.addOrUpdateRecord(t, 1, t);
+            ring.addOrUpdateRecord(t, 2, NAN); // NaN payloads count as written
+        }
+    }
+    // Rows 0 and 1 were evicted, the remaining ones wrap around the storage
+    ASSERT_EQ(ring.minKey(), 2);
+    EXPECT_EQ(ring.getRowFillCount(6), 3u);
+    EXPECT_EQ(ring.getRowFillCount(7), 1u);
+    EXPECT_EQ(ring.getRowFillCount(1), 0u);
+    EXPECT_EQ(ring.getCounters()[4], 3);
+    EXPECT_EQ(ring.getCounters()[5], 1);
+
+    size_t words = 0;
+    const uint64_t *mask = ring.getRowFillMask(7, words);
+    ASSERT_EQ(words, 1u);
+    EXPECT_EQ(mask[0], 1u);
+    EXPECT_EQ(ring.countFullRows(7, 6), 3u);
+    std::vector<uint8_t> flags(6);
+    ASSERT_EQ(ring.getFullRowFlags(7, 10, flags.data()), 6u);
+    EXPECT_EQ(flags, std::vector<uint8_t>({1, 0, 1, 0, 1, 0}));
+
+    // Masks of more than 64 variables, staged rows and deletions
+    DynamicBuffer wide(70, 10);
+    wide.setLateArrivalStaging(4);
+    for (size_t column = 0; column < 70; ++column) {
+        wide.addOrUpdateRecord(10, column, 1.0);
+        wide.addOrUpdateRecord(7, column, 2.0);
+    }
+    wide.addOrUpdateRecord(5, 69, 3.0);
+    mask = wide.getRowFillMask(5, words);
+    ASSERT_EQ(words, 2u);
+    EXPECT_EQ(mask[0], 0u);
+    EXPECT_EQ(mask[1], uint64_t(1) << 5);
+    flags.assign(3, 0);
+    EXPECT_EQ(wide.getFullRowFlags(10, 3, flags.data()), 3u);
+    EXPECT_EQ(flags, std::vector<uint8_t>({0, 1, 1}));
+    wide.deleteRecord(7);
+    EXPECT_EQ(wide.countFullRows(10, 3), 1u);
+    EXPECT_EQ(wide.getRowFillCount(10), 70u);
+}
+
+TEST(EvictionDynamicBufferTest, ZeroPrefixIsTrackedAndEvictedAtHighWaterMark) {
+    DynamicBuffer buffer(1, 2); // Room for 6 rows
+    for (long i = 0; i < 6; ++i) {
+        buffer.addOrUpdateRecord(i * 10, 0, i);
+    }
+    // The rows inserted before the window was full are not counted
+    EXPECT_EQ(buffer.countSubsequentZerosCounters(), 2u);
+
+    std::vector<long> acks = {20, 30, 50};
+    buffer.decrementCounters(acks.data(), acks.size());
+    EXPECT_EQ(buffer.countSubsequentZerosCounters(), 4u);
+    std::vector<long> unsorted = {50, 20};
+    EXPECT_THROW(buffer.decrementCounters(unsorted.data(), unsorted.size()), std::invalid_argument);
+    buffer.deleteRecord(40); // The first counted row
+    EXPECT_EQ(buffer.countSubsequentZerosCounters(), 5u);
+    buffer.addOrUpdateRecord(5, 0, 0.5); // Outside of the window: not counted
+    EXPECT_EQ(buffer.countSubsequentZerosCounters(), 6u);
+    buffer.addOrUpdateRecord(60, 0, 6);
+    EXPECT_EQ(buffer.countSubsequentZerosCounters(), 1u); // Full: evicted before insertion
+    EXPECT_EQ(buffer.minKey(), 60);
+
+    DynamicBuffer early(1, 2);
+    EXPECT_THROW(early.setEvictionHighWaterMark(0), std::invalid_argument);
+    EXPECT_THROW(early.setEvictionHighWaterMark(7), std::invalid_argument);
+    early.setEvictionHighWaterMark(4);
+    for (long i = 0; i < 5; ++i) {
+        early.addOrUpdateRecord(i * 10, 0, i);
+    }
+    // Reaching 4 rows evicted the two uncounted ones before inserting the fifth
+    EXPECT_EQ(early.getNumRows(), 3u);
+    EXPECT_EQ(early.minKey(), 20);
+    EXPECT_EQ(early.countSubsequentZerosCounters(), 0u);
+}
+
+TEST(BufferPolicyTest, LazyGrowthUpToTheCapAndShrinkToFit) {
+    BufferPolicy policy;
+    policy.lazyAllocation = true;
+    policy.maxRows = 40;
+    DynamicBuffer lazy(2, 10, StorageMode::Circular, DataLayout::ColumnMajor, policy);
+    EXPECT_EQ(lazy.getCapacity(), 0u);
+    EXPECT_EQ(lazy.getMaxRows(), 40u);
+    for (long t = 0; t < 9; ++t) {
+        lazy.addOrUpdateRecord(t, t % 2, t);
+    }
+    EXPECT_EQ(lazy.getCapacity(), 16u); // 8, then 16 rows
+
+    // A leased column keeps its values when the storage grows
+    size_t generation = lazy.acquireStorageLease();
+    size_t outSize;
+    const double *column = lazy.getColumnSlice(0, 8, 9, outSize);
+    ASSERT_EQ(outSize, 9u);
+    for (long t = 9; t < 40; ++t) {
+        lazy.addOrUpdateRecord(t, t % 2, t);
+    }
+    EXPECT_EQ(lazy.getCapacity(), 40u);
+    EXPECT_NEAR(column[8], 8, 1e-5);
+    EXPECT_EQ(lazy.getRetiredStorageCount(), 1u);
+    lazy.releaseStorageLease(generation);
+    EXPECT_EQ(lazy.getRetiredStorageCount(), 0u);
+    for (long t = 0; t < 40; t += 13) {
+        EXPECT_NEAR(lazy.getRecordByTimestamp(t)[t % 2], t, 1e-5);
+    }
+
+    // Idle buffers release their storage, and grow again when needed
+    lazy.removeFront(38);
+    lazy.shrinkToFit();
+    EXPECT_EQ(lazy.getCapacity(), 2u);
+    lazy.addOrUpdateRecord(40, 0, 40);
+    EXPECT_EQ(lazy.getCapacity(), 8u);
+    std::vector<long> expected = {38, 39, 40};
+    EXPECT_EQ(lazy.getSliceTimestamps(40, 10), expected);
+    lazy.removeFront(3);
+    lazy.shrinkToFit();
+    EXPECT_EQ(lazy.getCapacity(), 0u);
+}
+
+TEST(BufferPolicyTest, EvictionRatioAndRetainedRowsFloor) {
+    BufferPolicy policy;
+    policy.evictionRatio = 0.5;
+    policy.minRetainedRows = 2;
+    DynamicBuffer buffer(1, 2, StorageMode::Contiguous, DataLayout::RowMajor, policy); // 6 rows
+    EXPECT_EQ(buffer.getEvictionHighWaterMark(), 3u);
+    for (long t = 0; t < 4; ++t) {
+        buffer.addOrUpdateRecord(t * 10, 0, t);
+    }
+    // Rows 0 and 10 have zero counters, but only one could go without
+    // leaving fewer than 2 rows
+    EXPECT_EQ(buffer.minKey(), 10);
+    EXPECT_EQ(buffer.getNumRows(), 3u);
+
+    BufferPolicy invalid;
+    invalid.growthFactor = 1.0;
+    EXPECT_THROW(DynamicBuffer(1, 2, StorageMode::Contiguous, DataLayout::RowMajor, invalid),
+                 std::invalid_argument);
+    invalid = BufferPolicy();
+    invalid.evictionRatio = 0.0;
+    EXPECT_THROW(DynamicBuffer(1, 2, StorageMode::Contiguous, DataLayout::RowMajor, invalid),
+                 std::invalid_argument);
+    invalid = BufferPolicy();
+    invalid.minRetainedRows = 6;
+    EXPECT_THROW(DynamicBuffer(1, 2, StorageMode::Contiguous, DataLayout::RowMajor, invalid),
+                 std::invalid_argument);
+}
+
+TEST(TimeRetentionTest, EvictsRowsOutOfTheSpanAndSlicesSince) {
+    BufferPolicy policy;
+    policy.maxRows = 6;
+    policy.retentionSpan = 25;
+    DynamicBuffer buffer(1, 2, StorageMode::Contiguous, DataLayout::RowMajor, policy);
+    for (long t = 0; t < 7; ++t) {
+        buffer.addOrUpdateRecord(t * 10, 0, t);
+    }
+    // Only 2 rows had a zero counter, but 0, 10 and 20 were out of the span
+    // of the latest row (50) when the buffer was full
+    EXPECT_EQ(buffer.minKey(), 30);
+    EXPECT_EQ(buffer.getNumRows(), 4u);
+
+    // (35, 60]: the end timestamp doesn't have to be stored
+    size_t outSize = 0;
+    const double *slice = buffer.getSliceSince(60, 25, outSize);
+    ASSERT_NE(slice, nullptr);
+    EXPECT_EQ(outSize, 3u);
+    EXPECT_EQ(slice[0], 4);
+    EXPECT_EQ(slice[2], 6);
+    EXPECT_EQ(buffer.getSliceSince(55, 10, outSize)[0], 5);
+    EXPECT_EQ(outSize, 1u);
+    EXPECT_EQ(buffer.getSliceSince(25, 10, outSize), nullptr);
+    EXPECT_EQ(outSize, 0u);
+
+    for (StorageMode mode: {StorageMode::Contiguous, StorageMode::Circular}) {
+        for (DataLayout layout: {DataLayout::RowMajor, DataLayout::ColumnMajor}) {
+            DynamicBuffer wrapped(2, 2, mode, layout); // 6 rows
+            for (long t = 0; t < 6; ++t) {
+                wrapped.addOrUpdateRecord(t, 0, t);
+                wrapped.addOrUpdateRecord(t, 1, -t);
+            }
+            wrapped.removeFront(4);
+            for (long t = 6; t < 9; ++t) {
+                wrapped.addOrUpdateRecord(t, 1, -t);
+            }
+            BasicSliceView<double> view = wrapped.getSliceViewSince(8, 4);
+            std::vector<long> timestamps(view.firstTimestamps, view.firstTimestamps + view.firstSize / 2);
+            timestamps.insert(timestamps.end(), view.secondTimestamps,
+                              view.secondTimestamps + view.secondSize / 2);
+            EXPECT_EQ(timestamps, (std::vector<long>{5, 6, 7, 8}));
+            EXPECT_EQ(view.first[1], -5);
+        }
+    }
+
+    BufferPolicy invalid;
+    invalid.retentionSpan = -1;
+    EXPECT_THROW(DynamicBuffer(1, 2, StorageMode::Contiguous, DataLayout::RowMajor, invalid),
+                 std::invalid_argument);
+}
+
+TEST(AggregateTest, PerColumnReductionsSkipMissingCells) {
+    for (DataLayout layout: {DataLayout::RowMajor, DataLayout::ColumnMajor}) {
+        // 6 variables: the first 4 go through the vectorised kernels
+        DynamicBuffer buffer(6, 4, StorageMode::Circular, layout);
+        for (long t = 0; t < 6; ++t) {
+            for (size_t column = 0; column < 6; ++column) {
+                if (column != 2 || t % 2 == 0) {
+                    buffer.addOrUpdateRecord(t, column, static_cast<double>(t * column));
+                }
+            }
+        }
+        buffer.addOrUpdateRecord(5, 5, NAN);
+        buffer.removeFront(2);
+        for (long t = 6; t < 8; ++t) {
+            buffer.addOrUpdateRecord(t, 0, static_cast<double>(t)); // Wraps around
+        }
+
+        // Rows 4 to 7: column 0 holds 0, 0, 6, 7, column 2 only has row 4 and
+        // column 5 is NaN at 5
+        std::vector<double> out(6);
+        EXPECT_EQ(buffer.aggregate(7, 4, Aggregate::Count, out.data()), 4u);
+        EXPECT_EQ(out, (std::vector<double>{4, 2, 1, 2, 2, 1}));
+        buffer.aggregate(7, 4, Aggregate::Sum, out.data());
+        EXPECT_EQ(out, (std::vector<double>{13, 9, 8, 27, 36, 20}));
+        buffer.aggregate(7, 4, Aggregate::Min, out.data());
+        EXPECT_EQ(out[0], 0);
+        EXPECT_EQ(out[5], 20);
+        buffer.aggregate(7, 4, Aggregate::Max, out.data());
+        EXPECT_EQ(out[0], 7);
+        buffer.aggregate(7, 4, Aggregate::Mean, out.data());
+        EXPECT_DOUBLE_EQ(out[0], 3.25);
+        buffer.aggregate(7, 4, Aggregate::Std, out.data());
+        EXPECT_DOUBLE_EQ(out[0], std::sqrt(10.6875));
+        EXPECT_DOUBLE_EQ(out[1], 0.5);
+        EXPECT_EQ(out[2], 0);
+
+        EXPECT_EQ(buffer.aggregateSince(7, 2, Aggregate::Mean, out.data()), 2u);
+        EXPECT_DOUBLE_EQ(out[0], 6.5);
+        EXPECT_TRUE(std::isnan(out[1]));
+        EXPECT_EQ(buffer.aggregateSince(20, 2, Aggregate::Count, out.data()), 0u);
+        EXPECT_EQ(out, std::vector<double>(6, 0.0));
+        EXPECT_EQ(buffer.aggregate(20, 4, Aggregate::Sum, out.data()), 0u);
+    }
+}
+
+TEST(ResampleTest, PreviousLinearAndBucketValuesOnAGrid) {
+    DynamicBuffer buffer(2, 10);
+    buffer.addOrUpdateRecord(0, 0, 1.0);
+    buffer.addOrUpdateRecord(4, 0, 5.0);
+    buffer.addOrUpdateRecord(4, 1, 7.0);
+    buffer.addOrUpdateRecord(5, 0, 3.0);
+    buffer.addOrUpdateRecord(10, 0, 2.0);
+
+    // Grid 0, 3, 6, 9, 12
+    std::vector<double> out(10);
+    buffer.resample(0, 3, 5, ResampleMethod::Previous, out.data());
+    EXPECT_EQ(out[2], 1);
+    EXPECT_EQ(out[4], 3);
+    EXPECT_EQ(out[8], 2);
+    EXPECT_EQ(out[9], 7);
+    EXPECT_TRUE(std::isnan(out[1]));
+
+    buffer.resample(0, 3, 5, ResampleMethod::Linear, out.data());
+    EXPECT_EQ(out[0], 1);
+    EXPECT_EQ(out[2], 4);
+    EXPECT_DOUBLE_EQ(out[4], 2.8);
+    EXPECT_DOUBLE_EQ(out[6], 2.2);
+    EXPECT_TRUE(std::isnan(out[8])); // After the last value
+    EXPECT_TRUE(std::isnan(out[3])); // A single value can't be interpolated
+
+    buffer.resample(0, 3, 5, ResampleMethod::BucketMean, out.data());
+    EXPECT_EQ(out[2], 4); // Mean of 5 and 3 in [3, 6)
+    EXPECT_EQ(out[3], 7);
+    EXPECT_TRUE(std::isnan(out[4])); // Empty bucket [6, 9)
+    buffer.resample(0, 3, 5, ResampleMethod::BucketLast, out.data());
+    EXPECT_EQ(out[2], 3);
+    EXPECT_EQ(out[6], 2);
+
+    EXPECT_THROW(buffer.resample(0, 0, 5, ResampleMethod::Linear, out.data()),
+                 std::invalid_argument);
+}
+
+TEST(RollingStatisticsTest, FollowUpdatesLateArrivalsAndEvictions) {
+    DynamicBuffer buffer(2, 10, StorageMode::Circular);
+    buffer.setLateArrivalStaging(4);
+    std::vector<double> out(2);
+    EXPECT_THROW(buffer.getRollingStatistics(Aggregate::Mean, out.data()), std::logic_error);
+
+    for (long t = 0; t < 4; ++t) {
+        buffer.addOrUpdateRecord(t * 10, 0, static_cast<double>(t)); // 0, 1, 2, 3
+    }
+    buffer.enableRollingStatistics(); // Starts from the stored rows
+    buffer.addOrUpdateRecord(40, 1, 7.0);
+    buffer.addOrUpdateRecord(15, 0, -2.0); // Staged late arrival
+    buffer.getRollingStatistics(Aggregate::Min, out.data());
+    EXPECT_EQ(out[0], -2);
+    EXPECT_EQ(out[1], 7);
+
+    buffer.addOrUpdateRecord(15, 0, 5.0); // The minimum gets updated
+    buffer.getRollingStatistics(Aggregate::Min, out.data());
+    EXPECT_EQ(out[0], 0);
+    buffer.getRollingStatistics(Aggregate::Max, out.data());
+    EXPECT_EQ(out[0], 5);
+
+    buffer.removeFront(1); // Drops 0
+    buffer.deleteRecord(15);
+    buffer.getRollingStatistics(Aggregate::Count, out.data());
+    EXPECT_EQ(out, (std::vector<double>{3, 1}));
+    buffer.getRollingStatistics(Aggregate::Mean, out.data());
+    EXPECT_DOUBLE_EQ(out[0], 2);
+    buffer.getRollingStatistics(Aggregate::Std, out.data());
+    EXPECT_DOUBLE_EQ(out[0], std::sqrt(2.0 / 3));
+    EXPECT_EQ(out[1], 0);
+    buffer.getRollingStatistics(Aggregate::Min, out.data());
+    EXPECT_EQ(out[0], 1);
+    buffer.getRollingStatistics(Aggregate::Max, out.data());
+    EXPECT_EQ(out[0], 3);
+
+    buffer.removeFront(4);
+    buffer.getRollingStatistics(Aggregate::Sum, out.data());
+    EXPECT_EQ(out, (std::vector<double>{0, 0}));
+    buffer.getRollingStatistics(Aggregate::Max, out.data());
+    EXPECT_TRUE(std::isnan(out[0]));
+}
+
+TEST(FillStrategyTest, FilledCellsFollowLateWritesUpToTheNextWrittenValue) {
+    LastKnownValuesBuffer buffer(4, 10);
+    FillStrategy linear;
+    linear.method = FillMethod::Linear;
+    FillStrategy decay;
+    decay.method = FillMethod::Decay;
+    decay.decayRate = std::log(2.0) / 10; // Halves every 10 time units
+    FillStrategy constant;
+    constant.method = FillMethod::Constant;
+    constant.constant = -1;
+    buffer.setFillStrategy(1, linear);
+    buffer.setFillStrategy(2, decay);
+    buffer.setFillStrategy(3, constant);
+    EXPECT_EQ(buffer.getFillStrategy(0).method, FillMethod::ForwardFill);
+    EXPECT_THROW(buffer.setFillStrategy(4, linear), std::invalid_argument);
+
+    buffer.updateLastKnownValue(0, 0, 1);
+    buffer.updateLastKnownValue(0, 1, 0);
+    buffer.updateLastKnownValue(0, 2, 8);
+    buffer.updateLastKnownValue(20, 1, 10);
+    buffer.updateLastKnownValue(10, 3, 5); // Late row, filled from both sides
+    std::vector<double> row = buffer.getRecordByTimestamp(10);
+    EXPECT_EQ(row[0], 1);
+    EXPECT_EQ(row[1], 5);
+    EXPECT_NEAR(row[2], 4, 1e-9);
+    EXPECT_EQ(row[3], 5);
+    row = buffer.getRecordByTimestamp(20);
+    EXPECT_NEAR(row[2], 2, 1e-9);
+    EXPECT_EQ(row[3], -1);
+    EXPECT_EQ(buffer.getRecordByTimestamp(0)[3], -1);
+
+    // An update of a written value is carried up to the next written one
+    buffer.updateLastKnownValue(0, 0, 3);
+    EXPECT_EQ(buffer.getRecordByTimestamp(20)[0], 3);
+    buffer.updateLastKnownValue(10, 0, 9);
+    buffer.updateLastKnownValue(0, 0, 4);
+    EXPECT_EQ(buffer.getRecordByTimestamp(10)[0], 9);
+    EXPECT_EQ(buffer.getRecordByTimestamp(20)[0], 9);
+    buffer.updateLastKnownValue(0, 1, 4); // Moves the interpolation
+    EXPECT_EQ(buffer.getRecordByTimestamp(10)[1], 7);
+
+    // Changing the strategy refills the stored rows
+    buffer.setFillStrategy(3, FillStrategy());
+    EXPECT_TRUE(std::isnan(buffer.getRecordByTimestamp(0)[3]));
+    EXPECT_EQ(buffer.getRecordByTimestamp(20)[3], 5);
+    EXPECT_EQ(buffer.getRowFillCount(0), 3u);
+}
+
+TEST(FillStrategyTest, ForwardFillCorrectionsRewriteTheInheritedRunAcrossTheRing) {
+    LastKnownValuesBuffer buffer(2, 2, StorageMode::Circular, DataLayout::ColumnMajor); // 6 rows
+    for (long t = 0; t < 6; ++t) {
+        buffer.updateLastKnownValue(t, 1, static_cast<double>(t));
+    }
+    buffer.removeFront(3);
+    for (long t = 6; t < 9; ++t) {
+        buffer.updateLastKnownValue(t, 1, static_cast<double>(t)); // Wraps around the storage
+    }
+    auto column = [&buffer](long timestamp) { return buffer.getRecordByTimestamp(timestamp)[0]; };
+
+    // First value of the column, arriving late: fills the rows after it
+    buffer.updateLastKnownValue(4, 0, 1);
+    EXPECT_TRUE(std::isnan(column(3)));
+    for (long t = 4; t < 9; ++t) {
+        EXPECT_EQ(column(t), 1);
+    }
+    EXPECT_EQ(buffer.getRowFillCount(3), 1u);
+    EXPECT_EQ(buffer.getRowFillCount(8), 2u);
+
+    // Corrections stop at the next written value
+    buffer.updateLastKnownValue(7, 0, 2);
+    buffer.updateLastKnownValue(4, 0, 5);
+    EXPECT_EQ(column(6), 5);
+    EXPECT_EQ(column(7), 2);
+    EXPECT_EQ(column(8), 2);
+
+    // Writing the inherited value makes it a written one
+    buffer.updateLastKnownValue(5, 0, 5);
+    buffer.updateLastKnownValue(4, 0, 6);
+    EXPECT_EQ(column(4), 6);
+    EXPECT_EQ(column(5), 5);
+    EXPECT_EQ(column(6), 5);
+}
+
+TEST(DynamicBufferPoolTest, BatchedIngestAndSlicesOverSeriesSharingAnArena) {
+    BufferPolicy policy;
+    policy.lazyAllocation = true;
+    DynamicBufferPool pool(2, 10, StorageMode::Contiguous, DataLayout::RowMajor, policy);
+    EXPECT_EQ(pool.addSeries(100), 0u);
+    EXPECT_EQ(pool.addSeries(), 100u);
+    EXPECT_EQ(pool.getSeriesCount(), 101u);
+
+    // Interleaved samples, the last value written to a cell wins
+    std::vector<size_t> ids = {2, 0, 2, 0, 2, 100};
+    std::vector<long> timestamps = {10, 5, 11, 5, 10, 1};
+    std::vector<size_t> columns = {0, 1, 1, 1, 0, 0};
+    std::vector<double> values = {1, 2, 3, 4, 5, 6};
+    EXPECT_EQ(pool.ingest(ids.data(), timestamps.data(), columns.data(), values.data(), ids.size()), 4u);
+    EXPECT_EQ(pool.getSeries(2).getRecordByTimestamp(10)[0], 5);
+    EXPECT_EQ(pool.getSeries(0).getRecordByTimestamp(5)[1], 4);
+    EXPECT_EQ(pool.getSeries(1).getNumRows(), 0u);
+
+    // Two rows per series, the missing ones padded
+    std::vector<size_t> selected = {2, 1, 0};
+    std::vector<double> out(3 * 2 * 2);
+    std::vector<long> outTimestamps(3 * 2);
+    std::vector<size_t> counts(3);
+    pool.getSlices(selected.data(), 3, 2, out.data(), outTimestamps.data(), counts.data());
+    EXPECT_EQ(counts, std::vector<size_t>({2, 0, 1}));
+    EXPECT_EQ(outTimestamps, std::vector<long>({10, 11, 0, 0, 5, 0}));
+    EXPECT_EQ(out[0], 5);
+    EXPECT_EQ(out[3], 3);
+    EXPECT_TRUE(std::isnan(out[4]));
+    EXPECT_EQ(out[9], 4);
+    EXPECT_TRUE(std::isnan(out[10]));
+
+    EXPECT_THROW(pool.getSeries(101), std::out_of_range);
+    ids[0] = 101;
+    EXPECT_THROW(pool.ingest(ids.data(), timestamps.data(), columns.data(), values.data(), ids.size()),
+                 std::out_of_range);
+    EXPECT_EQ(pool.getSeries(0).getNumRows(), 1u); // Nothing written
+
+    // The buffers and their rows all come from the pool's slab
+    std::vector<size_t> allIds(100);
+    std::vector<long> allTimestamps(100, 20);
+    std::vector<size_t> allColumns(100, 0);
+    std::vector<double> allValues(100, 1.0);
+    for (size_t id = 0; id < 100; ++id) {
+        allIds[id] = id;
+    }
+    size_t before = allocationCount.load();
+    EXPECT_EQ(pool.ingest(allIds.data(), allTimestamps.data(), allColumns.data(), allValues.data(), 100), 100u);
+    EXPECT_EQ(allocationCount.load(), before);
+    EXPECT_EQ(pool.getArena().getSlabCount(), 1u);
+    EXPECT_GT(pool.getArena().getUsedBytes(), 101 * sizeof(BasicDynamicBuffer<double>));
+}
+
+TEST(GatherSlicesTest, LastRowsBeforeAReferenceTimestampAreAlignedAcrossThreads) {
+    DynamicBufferPool pool(2, 10, StorageMode::Circular);
+    pool.addSeries(300);
+    // Series i holds the timestamps 0, 1, ... i % 5 with values 10 * ts + column
+    std::vector<size_t> ids;
+    std::vector<long> timestamps;
+    std::vector<size_t> columns;
+    std::vector<double> values;
+    for (size_t id = 0; id < 300; ++id) {
+        for (long ts = 0; ts <= long(id % 5); ++ts) {
+            for (size_t column = 0; column < 2; ++column) {
+                ids.push_back(id);
+                timestamps.push_back(ts);
+                columns.push_back(column);
+                values.push_back(10.0 * ts + column);
+            }
+        }
+    }
+    pool.ingest(ids.data(), timestamps.data(), columns.data(), values.data(), ids.size());
+
+    std::vector<size_t> selected(300);
+    for (size_t i = 0; i < 300; ++i) {
+        selected[i] = 299 - i;
+    }
+    for (size_t nThreads : {1, 4}) {
+        std::vector<double> out(300 * 3 * 2);
+        std::vector<long> outTimestamps(300 * 3);
+        std::vector<size_t> counts(300);
+        pool.gatherSlices(selected.data(), 300, 2, 3, out.data(), outTimestamps.data(), counts.data(), nThreads);
+        for (size_t i = 0; i < 300; ++i) {
+            long last = std::min<long>(2, selected[i] % 5);
+            size_t rows = size_t(last) + 1;
+            ASSERT_EQ(counts[i], rows);
+            for (size_t row = 0; row < 3; ++row) {
+                const double *cells = out.data() + (i * 3 + row) * 2;
+                if (row < 3 - rows) {
+                    EXPECT_TRUE(std::isnan(cells[0]));
+                    EXPECT_EQ(outTimestamps[i * 3 + row], 0);
+                } else {
+                    long ts = last - long(2 - row);
+                    EXPECT_EQ(outTimestamps[i * 3 + row], ts);
+                    EXPECT_EQ(cells[0], 10.0 * ts);
+                    EXPECT_EQ(cells[1], 10.0 * ts + 1);
+                }
+            }
+        }
+    }
+
+    // A reference between the rows takes the row before it
+    DynamicBuffer a(1, 10), b(1, 10);
+    a.addOrUpdateRecord(10, 0, 1.0);
+    a.addOrUpdateRecord(20, 0, 2.0);
+    b.addOrUpdateRecord(30, 0, 3.0);
+    const DynamicBuffer *buffers[] = {&a, &b};
+    std::vector<double> out(2 * 2);
+    gatherSlices(buffers, 2, 15, 2, out.data(), nullptr, nullptr);
+    EXPECT_TRUE(std::isnan(out[0]));
+    EXPECT_EQ(out[1], 1.0);
+    EXPECT_TRUE(std::isnan(out[2]));
+    EXPECT_TRUE(std::isnan(out[3]));
+}
+
+TEST(SnapshotTest, RestoresTheStateFromBytesOrAMappedFile) {
+    BufferPolicy policy;
+    policy.retentionSpan = 50;
+    DynamicBuffer buffer(3, 10, StorageMode::Circular, DataLayout::RowMajor, policy);
+    for (long ts = 0; ts < 40; ++ts) {
+        buffer.addOrUpdateRecord(ts, ts % 3, static_cast<double>(ts));
+    }
+    buffer.removeFront(5); // The rows wrap around the ring
+    buffer.enableRollingStatistics();
+    buffer.setLateArrivalStaging(4);
+    buffer.addOrUpdateRecord(10, 1, -1.0); // Staged, merged by the snapshot
+
+    std::vector<char> bytes = buffer.getSnapshotBytes();
+    EXPECT_EQ(bytes.size() % SNAPSHOT_PAGE_BYTES, 0u);
+    DynamicBuffer restored(1, 1);
+    restored.loadSnapshotBytes(bytes.data(), bytes.size());
+    EXPECT_EQ(restored.getNVariables(), 3u);
+    EXPECT_EQ(restored.getStorageMode(), StorageMode::Circular);
+    EXPECT_EQ(restored.getRetentionSpan(), 50);
+    EXPECT_EQ(restored.getNumRows(), buffer.getNumRows());
+    EXPECT_EQ(restored.getCounters(), buffer.getCounters());
+    EXPECT_EQ(restored.getSliceTimestamps(39, 35), buffer.getSliceTimestamps(39, 35));
+    EXPECT_EQ(restored.getRecordByTimestamp(10)[1], -1.0);
+    for (long ts : {10, 30}) {
+        EXPECT_EQ(restored.getVariableUpdateCount(ts), buffer.getVariableUpdateCount(ts));
+        EXPECT_EQ(restored.getRowFillCount(ts), buffer.getRowFillCount(ts));
+    }
+    double sums[3], expectedSums[3];
+    restored.getRollingStatistics(Aggregate::Sum, sums);
+    buffer.getRollingStatistics(Aggregate::Sum, expectedSums);
+    EXPECT_EQ(std::vector<double>(sums, sums + 3), std::vector<double>(expectedSums, expectedSums + 3));
+
+    // Mapped: the rows are read from the file in place, and the writes only
+    // reach private copies of its pages
+    std::string path = ::testing::TempDir() + "dynamic_buffer_snapshot.bin";
+    buffer.saveSnapshot(path);
+    DynamicBuffer copied(1, 1), mapped(1, 1);
+    size_t before = allocationCount.load();
+    copied.loadSnapshot(path);
+    size_t copiedAllocations = allocationCount.load() - before;
+    before = allocationCount.load();
+    mapped.loadSnapshot(path, true);
+    size_t mappedAllocations = allocationCount.load() - before;
+    EXPECT_EQ(copiedAllocations - mappedAllocations, 5u); // No storage block
+    EXPECT_EQ(mapped.getRecordByTimestamp(20)[2], 20.0);
+    mapped.addOrUpdateRecord(20, 0, 100.0);
+    mapped.removeFront(mapped.getNumRows());
+    mapped.addOrUpdateRecord(40, 0, 1.0);
+    EXPECT_EQ(mapped.getNumRows(), 1u);
+    DynamicBuffer reloaded(1, 1);
+    reloaded.loadSnapshot(path);
+    EXPECT_TRUE(std::isnan(reloaded.getRecordByTimestamp(20)[0]));
+    EXPECT_EQ(reloaded.getCounters(), buffer.getCounters());
+
+    // Saved back over the file it is mapped from
+    DynamicBuffer resaved(1, 1);
+    resaved.loadSnapshot(path, true);
+    resaved.addOrUpdateRecord(39, 0, -39.0);
+    resaved.saveSnapshot(path);
+    EXPECT_EQ(resaved.getRecordByTimestamp(20)[2], 20.0);
+    reloaded.loadSnapshot(path, true);
+    EXPECT_EQ(reloaded.getRecordByTimestamp(39)[0], -39.0);
+    EXPECT_EQ(reloaded.getSliceTimestamps(39, 35), buffer.getSliceTimestamps(39, 35));
+    EXPECT_EQ(reloaded.getCounters(), buffer.getCounters());
+    std::ifstream temporary(path + ".tmp");
+    EXPECT_FALSE(temporary.good());
+    std::remove(path.c_str());
+
+    // Fill strategies go along with a last known values snapshot
+    LastKnownValuesBuffer lastKnown(2, 10);
+    FillStrategy zero;
+    zero.method = FillMethod::Zero;
+    lastKnown.setFillStrategy(1, zero);
+    lastKnown.updateLastKnownValue(1, 0, 5.0);
+    lastKnown.updateLastKnownValue(2, 1, 3.0);
+    bytes = lastKnown.getSnapshotBytes();
+    LastKnownValuesBuffer restoredLastKnown(2, 10);
+    restoredLastKnown.loadSnapshotBytes(bytes.data(), bytes.size());
+    EXPECT_EQ(restoredLastKnown.getFillStrategy(1).method, FillMethod::Zero);
+    restoredLastKnown.updateLastKnownValue(3, 0, 7.0);
+    EXPECT_EQ(restoredLastKnown.getRecordByTimestamp(3), std::vector<double>({7.0, 0.0}));
+
+    // Snapshots of another class or value type, or truncated
+    EXPECT_THROW(restored.loadSnapshotBytes(bytes.data(), bytes.size()), std::invalid_argument);
+    BasicDynamicBuffer<float> floats(3, 10);
+    bytes = buffer.getSnapshotBytes();
+    EXPECT_THROW(floats.loadSnapshotBytes(bytes.data(), bytes.size()), std::invalid_argument);
+    EXPECT_THROW(restored.loadSnapshotBytes(bytes.data(), bytes.size() - 1), std::invalid_argument);
+    EXPECT_THROW(restored.loadSnapshot(path), std::runtime_error);
+}
+
+TEST(WriteAheadLogTest, ReplayRebuildsTheLoggedBufferUpToATornTail) {
+    std::string path = ::testing::TempDir() + "dynamic_buffer_wal.bin";
+    std::remove(path.c_str());
+    WriteAheadLogPolicy policy;
+    policy.flushIntervalMillis = 0; // Written once flushBytes are buffered
+    DynamicBuffer buffer(3, 20, StorageMode::Circular);
+    {
+        WriteAheadLog log(path, policy);
+        buffer.setWriteAheadLog(&log);
+        for (long ts = 0; ts < 40; ++ts) {
+            buffer.addOrUpdateRecord(ts, ts % 3, static_cast<double>(ts));
+        }
+        std::vector<long> timestamps = {41, 45, 42, 41};
+        std::vector<size_t> columns = {0, 1, 2, 1};
+        std::vector<double> values = {1.0, 2.0, 3.0, 4.0};
+        buffer.addOrUpdateRecords(timestamps.data(), columns.data(), values.data(), 4);
+        buffer.decrementCounters(std::vector<long>({2, 0, 1}));
+        buffer.decrementCounters(std::vector<long>({3, 4}));
+        buffer.deleteRecord(20);
+        buffer.removeZeroCount();
+        buffer.removeFront(2);
+        // One record per call and per sample or timestamp of a batch, none
+        // written yet
+        EXPECT_EQ(log.getBufferedRecordCount(), 55u);
+        EXPECT_EQ(log.getFlushCount(), 0u);
+        buffer.setWriteAheadLog(nullptr);
+    }
+
+    // A crash in the middle of a write leaves a partial group behind
+    std::FILE *file = std::fopen(path.c_str(), "ab");
+    std::fwrite("torn", 1, 4, file);
+    std::fclose(file);
+
+    DynamicBuffer replayed(3, 20, StorageMode::Circular);
+    EXPECT_EQ(replayed.replayWriteAheadLog(path), 55u);
+    EXPECT_EQ(replayed.getNumRows(), buffer.getNumRows());
+    EXPECT_EQ(replayed.getCounters(), buffer.getCounters());
+    EXPECT_EQ(replayed.getSliceTimestamps(45, 40), buffer.getSliceTimestamps(45, 40));
+    EXPECT_EQ(replayed.getRecordByTimestamp(41)[1], 4.0); // The last sample of the cell wins
+    EXPECT_EQ(replayed.getRecordByTimestamp(30)[0], 30.0);
+    EXPECT_EQ(replayed.getRowFillCount(30), buffer.getRowFillCount(30));
+    EXPECT_EQ(replayed.getVariableUpdateCount(41), 2u);
+
+    // Logging resumes after the recovery: the torn group is truncated on
+    // reopening, so that the new groups get replayed too
+    {
+        WriteAheadLog log(path, policy);
+        replayed.setWriteAheadLog(&log);
+        for (long ts = 50; ts < 60; ++ts) {
+            replayed.addOrUpdateRecord(ts, 0, static_cast<double>(ts));
+        }
+        replayed.setWriteAheadLog(nullptr);
+    }
+    file = std::fopen(path.c_str(), "ab");
+    std::fwrite("torn", 1, 4, file);
+    std::fclose(file);
+    DynamicBuffer recovered(3, 20, StorageMode::Circular);
+    EXPECT_EQ(recovered.replayWriteAheadLog(path), 65u);
+    EXPECT_EQ(recovered.getSliceTimestamps(59, 40), replayed.getSliceTimestamps(59, 40));
+    EXPECT_EQ(recovered.getRecordByTimestamp(59)[0], 59.0);
+
+    // Last known values are replayed by a LastKnownValuesBuffer only
+    std::remove(path.c_str());
+    LastKnownValuesBuffer lastKnown(2, 10);
+    {
+        WriteAheadLog log(path);
+        lastKnown.setWriteAheadLog(&log);
+        lastKnown.updateLastKnownValue(1, 0, 5.0);
+        lastKnown.updateLastKnownValue(2, 1, 3.0);
+        lastKnown.setWriteAheadLog(nullptr);
+    }
+    LastKnownValuesBuffer replayedLastKnown(2, 10);
+    EXPECT_EQ(replayedLastKnown.replayWriteAheadLog(path), 2u);
+    EXPECT_EQ(replayedLastKnown.getRecordByTimestamp(2), std::vector<double>({5.0, 3.0}));
+    EXPECT_THROW(DynamicBuffer(2, 10).replayWriteAheadLog(path), std::invalid_argument);
+    BasicDynamicBuffer<float> floats(2, 10);
+    EXPECT_THROW(floats.replayWriteAheadLog(path), std::invalid_argument);
+    WriteAheadLog reopened(path);
+    EXPECT_THROW(floats.setWriteAheadLog(&reopened), std::invalid_argument);
+    std::remove(path.c_str());
+}
+
+TEST(ArrowExportTest, SlicesAreExportedAsRecordBatchesInPlaceWhenColumnar) {
+    DynamicBuffer buffer(2, 10, StorageMode::Circular, DataLayout::ColumnMajor);
+    for (long ts = 0; ts < 5; ++ts) {
+        buffer.addOrUpdateRecord(ts, 0, static_cast<double>(ts));
+    }
+    buffer.addOrUpdateRecord(3, 1, -3.0);
+
+    ArrowSchema schema;
+    ArrowArray array;
+    int released = 0;
+    buffer.exportArrowSlice(4, 3, &schema, &array, [](void *count) { ++*static_cast<int *>(count); },
+                            &released);
+    EXPECT_STREQ(schema.format, "+s");
+    ASSERT_EQ(schema.n_children, 3);
+    EXPECT_STREQ(schema.children[0]->name, "timestamp");
+    EXPECT_STREQ(schema.children[0]->format, "l");
+    EXPECT_STREQ(schema.children[2]->name, "1");
+    EXPECT_STREQ(schema.children[2]->format, "g");
+    EXPECT_EQ(array.length, 3);
+    const int64_t *timestamps = static_cast<const int64_t *>(array.children[0]->buffers[1]);
+    EXPECT_EQ(std::vector<int64_t>(timestamps, timestamps + 3), std::vector<int64_t>({2, 3, 4}));
+
+    // Served from the storage, the missing values being null
+    size_t size = 0;
+    EXPECT_EQ(array.children[1]->buffers[1], buffer.getColumnSlice(0, 4, 3, size));
+    EXPECT_EQ(array.children[1]->null_count, 0);
+    EXPECT_EQ(array.children[1]->buffers[0], nullptr);
+    EXPECT_EQ(array.children[2]->null_count, 2);
+    EXPECT_EQ(static_cast<const uint8_t *>(array.children[2]->buffers[0])[0], 0x2);
+    EXPECT_EQ(static_cast<const double *>(array.children[2]->buffers[1])[1], -3.0);
+
+    // A child moved out by the consumer outlives the batch
+    ArrowArray column = *array.children[1];
+    array.children[1]->release = nullptr;
+    array.release(&array);
+    schema.release(&schema);
+    EXPECT_EQ(released, 0);
+    buffer.addOrUpdateRecord(2, 0, 20.0); // The batch stays immutable
+    EXPECT_EQ(static_cast<const double *>(column.buffers[1])[0], 2.0);
+    EXPECT_EQ(buffer.getColumnSlice(0, 4, 3, size)[0], 20.0);
+    buffer.removeFront(2);
+    EXPECT_EQ(static_cast<const double *>(column.buffers[1])[0], 2.0);
+    column.release(&column);
+    EXPECT_EQ(released, 1);
+    EXPECT_EQ(buffer.getRetiredStorageCount(), 0u);
+
+    // Row-major, the timestamps and the variables are copied into columns:
+    // the batch holds no lease, and the writes carry on in place
+    DynamicBuffer rows(2, 10);
+    rows.addOrUpdateRecord(1, 1, 7.0);
+    const double *stored = rows.getRecordByTimestampPtr(1, size);
+    rows.exportArrowSlice(1, 3, &schema, &array);
+    EXPECT_EQ(array.length, 1);
+    EXPECT_EQ(static_cast<const int64_t *>(array.children[0]->buffers[1])[0], 1);
+    EXPECT_EQ(static_cast<const double *>(array.children[2]->buffers[1])[0], 7.0);
+    EXPECT_EQ(array.children[1]->null_count, 1);
+    size_t before = allocationCount.load();
+    rows.addOrUpdateRecord(1, 1, 8.0);
+    rows.addOrUpdateRecord(2, 0, 9.0);
+    EXPECT_EQ(allocationCount.load(), before);
+    EXPECT_EQ(rows.getRecordByTimestampPtr(1, size), stored);
+    EXPECT_EQ(static_cast<const double *>(array.children[2]->buffers[1])[0], 7.0);
+    array.release(&array);
+    schema.release(&schema);
+    EXPECT_THROW(rows.exportArrowSlice(3, 3, &schema, &array), std::invalid_argument); // Not stored
+}
+
+TEST(AllocationFreeIngestTest, SteadyStateIngestDoesNotAllocate) {
+    for (StorageMode mode: {StorageMode::Contiguous, StorageMode::Circular}) {
+        DynamicBuffer buffer(4, 100, mode); // Room for 300 rows
+        buffer.setLateArrivalStaging(8);
+        std::vector<long> timestamps(4);
+        std::vector<size_t> columns = {0, 1, 2, 3};
+        std::vector<double> values(4, 1.0);
+        auto ingest = [&](long first, long last) {
+            for (long i = first; i < last; ++i) {
+                for (size_t column = 0; column < 2; ++column) {
+                    buffer.addOrUpdateRecord(2 * i, column, 1.0);
+                }
+                std::fill(timestamps.begin(), timestamps.end(), 2 * i);
+                buffer.addOrUpdateRecords(timestamps.data(), columns.data(), values.data(), 4);
+                if (i % 10 == 0) {
+                    buffer.addOrUpdateRecord(2 * i - 5, 0, 2.0); // Staged late arrival
+                }
+                if (buffer.getNumRows() > 250) {
+                    buffer.removeFront(100);
+                }
+            }
+        };
+        ingest(1, 1000); // Warm up
+
+        size_t before = allocationCount.load();
+        ingest(1000, 3000);
+        EXPECT_EQ(allocationCount.load(), before);
+
+        // Per-row update counts follow the rows through staging and evictions
+        EXPECT_EQ(buffer.getVariableUpdateCount(2 * 2999), 6u);
+        EXPECT_EQ(buffer.getVariableUpdateCount(2 * 2990 - 5), 1u);
+        EXPECT_EQ(buffer.getVariableUpdateCount(2 * 1000), 0u); // Evicted
+    }
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
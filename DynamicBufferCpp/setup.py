@@ -1,9 +1,29 @@
 import numpy
+from Cython import Tempita
 from Cython.Build import cythonize
 from setuptools import setup, Extension, find_packages
 import os
 
 BASE_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def render_templates(*templates):
+    """Renders the Tempita templates (X.pxi.in) included by the .pyx file to X.pxi, only
+    rewriting those that changed so that cythonize doesn't rebuild needlessly"""
+    for template in templates:
+        path = os.path.join(BASE_DIR, "src", template)
+        with open(path) as f:
+            rendered = Tempita.sub(f.read())
+        target = path[:-len(".in")]
+        if os.path.exists(target):
+            with open(target) as f:
+                if f.read() == rendered:
+                    continue
+        with open(target, "w") as f:
+            f.write(rendered)
+
+
+render_templates("DynamicBufferClasses.pxi.in")
 extra_compile_args = ['-std=c++14', '-static', '-static-libgcc', '-static-libstdc++', '-O3']
 
 extensions = [
@@ -12,6 +32,11 @@ extensions = [
                   os.path.join(BASE_DIR, "src", "DynamicBufferWrapper.pyx"),  # path to your .pyx file
                   os.path.join(BASE_DIR, "src", "DynamicBuffer_lib", "DynamicBuffer.cpp"),  # path to your .cpp file
                   os.path.join(BASE_DIR, "src", "DynamicBuffer_lib", "LastKnownValuesBuffer.cpp"),  # and so on for other files
+                  os.path.join(BASE_DIR, "src", "DynamicBuffer_lib", "SlabArena.cpp"),
+                  os.path.join(BASE_DIR, "src", "DynamicBuffer_lib", "DynamicBufferPool.cpp"),
+                  os.path.join(BASE_DIR, "src", "DynamicBuffer_lib", "Snapshot.cpp"),
+                  os.path.join(BASE_DIR, "src", "DynamicBuffer_lib", "WriteAheadLog.cpp"),
+                  os.path.join(BASE_DIR, "src", "DynamicBuffer_lib", "ArrowExport.cpp"),
               ],
               include_dirs=[numpy.get_include()],
               language="c++",
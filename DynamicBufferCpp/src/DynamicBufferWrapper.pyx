@@ -1,118 +1,934 @@
 # distutils: language = c++
-from libc.stdint cimport int64_t
+from libc.stdint cimport int32_t, int64_t, uint8_t, uint64_t, uintptr_t
 from libcpp.vector cimport vector
+from libcpp.string cimport string
 from cpython cimport array
 from libcpp cimport bool
+from cpython.ref cimport Py_INCREF, Py_DECREF
+from cpython.pythread cimport (PyThread_type_lock, PyThread_allocate_lock, PyThread_free_lock,
+                               PyThread_acquire_lock, PyThread_release_lock, WAIT_LOCK)
+import os
 import numpy as np
 cimport numpy as np
 
 np.import_array()
 
-cdef extern from "DynamicBuffer_lib/DynamicBuffer.h":
-    cdef cppclass DynamicBuffer:
-        DynamicBuffer(size_t nVariables, size_t windowSize) except +
-        bool deleteRecord(long timestamp)
-        bool addOrUpdateRecord(long timestamp, size_t column_index, double value)
-        void print()
-        const double *getRecordByTimestampPtr(long timestamp, size_t &outSize) const
-        const double *getSlice(long timestamp, size_t N, size_t &outSize) const
+cdef extern from "DynamicBuffer_lib/WriteAheadLog.h" nogil:
+    cdef enum class FsyncPolicy:
+        Never
+        EveryFlush
+        Periodic
+
+    cdef cppclass WriteAheadLogPolicy:
+        size_t flushBytes
+        long flushIntervalMillis
+        FsyncPolicy fsync
+        long fsyncIntervalMillis
+
+    cdef cppclass WriteAheadLog:
+        WriteAheadLog(const string &path, const WriteAheadLogPolicy &policy) except +
+        void flush() except +
+        void sync() except +
+        void reset() except +
+        size_t getBufferedRecordCount() const
+        size_t getFlushCount() const
+
+cdef extern from "DynamicBuffer_lib/ArrowExport.h" nogil:
+    cdef struct ArrowSchema:
+        void (*release)(ArrowSchema *)
+
+    cdef struct ArrowArray:
+        void (*release)(ArrowArray *)
+
+cdef extern from "DynamicBuffer_lib/DynamicBuffer.h" nogil:
+    cdef enum class StorageMode:
+        Contiguous
+        Circular
+
+    cdef enum class DataLayout:
+        RowMajor
+        ColumnMajor
+
+    cdef enum class ResampleMethod:
+        Previous
+        Linear
+        BucketMean
+        BucketLast
+
+    cdef enum class Aggregate:
+        Sum
+        Mean
+        Min
+        Max
+        Std
+        Count
+
+    cdef cppclass BufferPolicy:
+        size_t maxRows
+        bool lazyAllocation
+        double growthFactor
+        double evictionRatio
+        size_t minRetainedRows
+        long retentionSpan
+
+    cdef cppclass MissingValue[T]:
+        @staticmethod
+        T value()
+
+    cdef cppclass BasicSliceView[T]:
+        const T *first
+        size_t firstSize
+        const T *second
+        size_t secondSize
+        const long *firstTimestamps
+        const long *secondTimestamps
+
+    # Every call that can merge the staged rows, write or allocate is declared except +, a C++
+    # exception reaching Python otherwise terminating the interpreter
+    cdef cppclass BasicDynamicBuffer[T]:
+        BasicDynamicBuffer(size_t nVariables, size_t windowSize, StorageMode storageMode,
+                           DataLayout dataLayout, const BufferPolicy &policy) except +
+        bool deleteRecord(long timestamp) except +
+        bool addOrUpdateRecord(long timestamp, size_t column_index, T value) except +
+        size_t addOrUpdateRecords(const long *timestamps, const size_t *columnIndexes,
+                                  const T *values, size_t n) except +
+        void print() except +
+        const T *getRecordByTimestampPtr(long timestamp, size_t &outSize) except +
+        const T *getSlice(long timestamp, size_t N, size_t &outSize) except +
+        BasicSliceView[T] getSliceView(long timestamp, size_t N) except +
+        BasicSliceView[T] getSliceViewSince(long timestamp, long span) except +
+        size_t aggregate(long timestamp, size_t N, Aggregate op, double *out) except +
+        size_t aggregateSince(long timestamp, long span, Aggregate op, double *out) except +
+        void resample(long start, long step, size_t count, ResampleMethod method,
+                      double *out) except +
+        void enableRollingStatistics() except +
+        bool isRollingStatisticsEnabled() const
+        void getRollingStatistics(Aggregate op, double *out) except +
+        const T *getSliceWithTimestamps(long timestamp, size_t N, size_t &outSize,
+                                        const long *&outTimestamps) except +
+        BasicSliceView[T] getColumnSliceView(size_t columnIndex, long timestamp, size_t N) except +
         size_t getNVariables() const
-        void removeFront(size_t removeCount)
+        DataLayout getDataLayout() const
+        void removeFront(size_t removeCount) except +
         long minKey() const
         long maxKey() const
         size_t getNumRows() const
-        vector[long] getSliceTimestamps(long timestamp, size_t N) const
-        void decrementCounters(const vector[long]& timestamps)
-        vector[int] getCounters() const
-        void printCounters() const
-        size_t getVariableUpdateCount(long timestamp)
+        size_t getCapacity() const
+        size_t getMaxRows() const
+        long getRetentionSpan() const
+        void shrinkToFit() except +
+        vector[long] getSliceTimestamps(long timestamp, size_t N) except +
+        void decrementCounters(const vector[long]& timestamps) except +
+        void decrementCounters(const long *timestamps, size_t n) except +
+        void setEvictionHighWaterMark(size_t rows) except +
+        size_t getEvictionHighWaterMark() const
+        vector[int] getCounters() except +
+        void printCounters() except +
+        size_t getVariableUpdateCount(long timestamp) except +
+        const uint64_t *getRowFillMask(long timestamp, size_t &outWords) except +
+        size_t getRowFillCount(long timestamp) except +
+        size_t getFullRowFlags(long timestamp, size_t N, uint8_t *outFlags) except +
+        size_t countFullRows(long timestamp, size_t N) except +
+        void setLateArrivalStaging(size_t maxStagedRows) except +
+        size_t getStagedRowCount() const
+        void mergeStagedRows() except +
+        void enableConcurrentAccess() except +
+        bool isConcurrentAccessEnabled() const
+        size_t copySlice(long timestamp, size_t N, T *out, long *outTimestamps) except +
+        BasicSliceView[T] pinSlice(long timestamp, size_t N) except +
+        void unpinSlice() const
+        size_t acquireStorageLease() except +
+        void releaseStorageLease(size_t generation) except +
+        void saveSnapshot(const string &path) except +
+        vector[char] getSnapshotBytes() except +
+        void loadSnapshot(const string &path, bool mapped) except +
+        void loadSnapshotBytes(const char *bytes, size_t size) except +
+        void setWriteAheadLog(WriteAheadLog *log) except +
+        size_t replayWriteAheadLog(const string &path) except +
+        void exportArrowSlice(long timestamp, size_t N, ArrowSchema *schema, ArrowArray *array,
+                              void (*onRelease)(void *), void *context) except +
+
+    ctypedef BasicSliceView[double] SliceView
+    ctypedef BasicDynamicBuffer[double] DynamicBuffer
+
+cdef extern from "DynamicBuffer_lib/LastKnownValuesBuffer.h" nogil:
+    cdef enum class FillMethod:
+        ForwardFill
+        Zero
+        Constant
+        Linear
+        Decay
+
+    cdef cppclass FillStrategy:
+        FillMethod method
+        double constant
+        double decayRate
+
+    cdef cppclass BasicLastKnownValuesBuffer[T](BasicDynamicBuffer[T]):
+        BasicLastKnownValuesBuffer(size_t nVariables, size_t windowSize, StorageMode storageMode,
+                                   DataLayout dataLayout, const BufferPolicy &policy) except +
+        bool updateLastKnownValue(long timestamp, size_t column_index, T value) except +
+        void setFillStrategy(const FillStrategy &strategy) except +
+        void setFillStrategy(size_t columnIndex, const FillStrategy &strategy) except +
+        void saveSnapshot(const string &path) except +
+        vector[char] getSnapshotBytes() except +
+        void loadSnapshot(const string &path, bool mapped) except +
+        void loadSnapshotBytes(const char *bytes, size_t size) except +
+        size_t replayWriteAheadLog(const string &path) except +
+
+    ctypedef BasicLastKnownValuesBuffer[double] LastKnownValuesBuffer
+
+cdef extern from "DynamicBuffer_lib/DynamicBufferPool.h" nogil:
+    cdef cppclass SlabArena:
+        size_t getSlabCount() const
+        size_t getReservedBytes() const
+        size_t getUsedBytes() const
+
+    cdef cppclass BasicDynamicBufferPool[T]:
+        BasicDynamicBufferPool(size_t nVariables, size_t windowSize, StorageMode storageMode,
+                               DataLayout dataLayout, const BufferPolicy &policy,
+                               size_t slabBytes) except +
+        size_t addSeries(size_t count) except +
+        size_t getSeriesCount() const
+        size_t getNVariables() const
+        size_t ingest(const size_t *seriesIds, const long *timestamps, const size_t *columnIndexes,
+                      const T *values, size_t n) except +
+        void getSlices(const size_t *seriesIds, size_t nSeries, size_t N, T *out,
+                       long *outTimestamps, size_t *outCounts) except +
+        void gatherSlices(const size_t *seriesIds, size_t nSeries, long timestamp, size_t N, T *out,
+                          long *outTimestamps, size_t *outCounts, size_t nThreads) except +
+        const SlabArena &getArena() const
+
+    ctypedef BasicDynamicBufferPool[double] DynamicBufferPool
+
+    void gatherSlices(DynamicBuffer **buffers, size_t nSeries, long timestamp, size_t N, double *out,
+                      long *outTimestamps, size_t *outCounts, size_t nThreads) except +
+
+# Value types the buffers are instantiated for
+ctypedef fused value_t:
+    float
+    double
+    int32_t
+    int64_t
+
+
+cdef StorageMode _storage_mode(bint circular):
+    return StorageMode.Circular if circular else StorageMode.Contiguous
+
+
+cdef DataLayout _data_layout(bint columnar):
+    return DataLayout.ColumnMajor if columnar else DataLayout.RowMajor
+
+
+_AGGREGATES = {'sum': Aggregate.Sum, 'mean': Aggregate.Mean, 'min': Aggregate.Min,
+               'max': Aggregate.Max, 'std': Aggregate.Std, 'count': Aggregate.Count}
+
+
+cdef Aggregate _aggregate_op(str op) except *:
+    try:
+        return _AGGREGATES[op]
+    except KeyError:
+        raise ValueError("Unknown aggregate %r, expected one of %s" % (op, ", ".join(_AGGREGATES)))
+
+
+_RESAMPLE_METHODS = {'previous': ResampleMethod.Previous, 'linear': ResampleMethod.Linear,
+                     'mean': ResampleMethod.BucketMean, 'last': ResampleMethod.BucketLast}
+
+_FILL_METHODS = {'forward': FillMethod.ForwardFill, 'zero': FillMethod.Zero,
+                 'constant': FillMethod.Constant, 'linear': FillMethod.Linear,
+                 'decay': FillMethod.Decay}
+
 
-cdef extern from "DynamicBuffer_lib/LastKnownValuesBuffer.h":
-    cdef cppclass LastKnownValuesBuffer(DynamicBuffer):
-        LastKnownValuesBuffer(size_t nVariables, size_t windowSize) except +
-        bool updateLastKnownValue(long timestamp, size_t column_index, double value)
+cdef BufferPolicy _buffer_policy(dict options) except *:
+    """Policy from the keyword arguments of the constructors: max_rows, lazy,
+    growth_factor, eviction_ratio, min_retained_rows and retention_span"""
+    cdef BufferPolicy policy
+    options = dict(options)
+    policy.maxRows = options.pop('max_rows', policy.maxRows)
+    policy.lazyAllocation = options.pop('lazy', policy.lazyAllocation)
+    policy.growthFactor = options.pop('growth_factor', policy.growthFactor)
+    policy.evictionRatio = options.pop('eviction_ratio', policy.evictionRatio)
+    policy.minRetainedRows = options.pop('min_retained_rows', policy.minRetainedRows)
+    policy.retentionSpan = options.pop('retention_span', policy.retentionSpan)
+    if options:
+        raise TypeError("Unknown buffer policy options: %s" % ", ".join(options))
+    return policy
 
 
-cdef class PyDynamicBuffer:
-    cdef DynamicBuffer *thisptr
-    def __cinit__(self, size_t nVariables, size_t windowSize):
-        self.thisptr = new DynamicBuffer(nVariables, windowSize)
+_FSYNC_POLICIES = {'never': FsyncPolicy.Never, 'flush': FsyncPolicy.EveryFlush,
+                   'periodic': FsyncPolicy.Periodic}
+
+
+cdef class PyWriteAheadLog:
+    """Append-only log of the mutations of the buffers attached to it (see
+    set_write_ahead_log). The records are written in groups once flush_bytes bytes are
+    buffered or the oldest one is flush_interval_ms old (0 for the size only), and synced
+    'never', on every 'flush' or at most every fsync_interval_ms ('periodic')."""
+    cdef WriteAheadLog *thisptr
+
+    def __cinit__(self, path, flush_bytes=None, flush_interval_ms=None, str fsync='never',
+                  fsync_interval_ms=None):
+        if fsync not in _FSYNC_POLICIES:
+            raise ValueError("Unknown fsync policy %r, expected one of %s"
+                             % (fsync, ", ".join(_FSYNC_POLICIES)))
+        cdef WriteAheadLogPolicy policy
+        if flush_bytes is not None:
+            policy.flushBytes = flush_bytes
+        if flush_interval_ms is not None:
+            policy.flushIntervalMillis = flush_interval_ms
+        policy.fsync = _FSYNC_POLICIES[fsync]
+        if fsync_interval_ms is not None:
+            policy.fsyncIntervalMillis = fsync_interval_ms
+        self.thisptr = new WriteAheadLog(os.fsencode(path), policy)
 
     def __dealloc__(self):
         del self.thisptr
 
-    def delete_record(self, long timestamp):
-        return self.thisptr.deleteRecord(timestamp)
+    def flush(self):
+        self.thisptr.flush()
 
-    def add_or_update_record(self, long timestamp, size_t column_index, double value):
-        cdef bool res = self.thisptr.addOrUpdateRecord(timestamp, column_index, value)
-        return res
+    def sync(self):
+        self.thisptr.sync()
 
-    def print(self):
-        self.thisptr.print()
+    def reset(self):
+        """Drops the logged records, once a snapshot holds them"""
+        self.thisptr.reset()
 
-    def get_row_as_numpy(self, long timestamp):
-        cdef size_t rowSize = 0
-        cdef np.npy_intp shape[1]
-        cdef const double *row = self.thisptr.getRecordByTimestampPtr(timestamp, rowSize)
-        if row is not NULL and rowSize > 0:
-            shape[0] = rowSize
-            return np.PyArray_SimpleNewFromData(1, shape, np.NPY_DOUBLE, <void*>row)
-        else:
-            return np.array([])
+    def get_buffered_record_count(self):
+        return self.thisptr.getBufferedRecordCount()
+
+    def get_flush_count(self):
+        return self.thisptr.getFlushCount()
+
+
+cdef class _LeasedBuffer
+
+
+cdef class _StorageLease:
+    """Base object of the zero-copy arrays: keeps the buffer and the leased memory alive"""
+    cdef _LeasedBuffer buffer
+    cdef size_t generation
+
+    def __dealloc__(self):
+        if self.buffer is not None:
+            self.buffer._release_storage_lease(self.generation)
+
+
+cdef class _LeasedBuffer:
+    """Base of the buffer classes, whatever their value type"""
+    cdef PyWriteAheadLog write_ahead_log  # Kept alive as long as it is attached
+
+    cdef size_t _acquire_storage_lease(self):
+        return 0
+
+    cdef void _release_storage_lease(self, size_t generation):
+        pass
+
+    cdef object _leased_array(self, int nd, np.npy_intp *dims, const void *data, int typenum):
+        array = np.PyArray_SimpleNewFromData(nd, dims, typenum, <void*>data)
+        cdef _StorageLease lease = _StorageLease.__new__(_StorageLease)
+        lease.generation = self._acquire_storage_lease()
+        lease.buffer = self
+        np.set_array_base(array, lease)
+        return array
+
+
+# Implementations shared by the buffer classes of every value type
+
+cdef int _typenum(BasicDynamicBuffer[value_t] *buffer):
+    if value_t is float:
+        return np.NPY_FLOAT32
+    elif value_t is double:
+        return np.NPY_FLOAT64
+    elif value_t is int32_t:
+        return np.NPY_INT32
+    else:
+        return np.NPY_INT64
+
+
+cdef bint _columnar(BasicDynamicBuffer[value_t] *buffer):
+    return buffer.getDataLayout() == DataLayout.ColumnMajor
+
+
+cdef int _reject_concurrent(BasicDynamicBuffer[value_t] *buffer, str what) except -1:
+    # Only the copies retry while the writer modifies the buffer
+    if buffer.isConcurrentAccessEnabled():
+        raise RuntimeError("%s are not available in concurrent mode" % what)
+    return 0
+
+
+# The writer calls below release the GIL in concurrent mode only: otherwise another
+# thread could run a call on the buffer meanwhile
+
+cdef object _delete_record(BasicDynamicBuffer[value_t] *buffer, long timestamp):
+    cdef bool res
+    if not buffer.isConcurrentAccessEnabled():
+        return buffer.deleteRecord(timestamp)
+    with nogil:
+        res = buffer.deleteRecord(timestamp)
+    return res
+
+
+cdef object _add_or_update_record(BasicDynamicBuffer[value_t] *buffer, long timestamp,
+                                  size_t column_index, value_t value):
+    cdef bool res
+    if not buffer.isConcurrentAccessEnabled():
+        return buffer.addOrUpdateRecord(timestamp, column_index, value)
+    with nogil:
+        res = buffer.addOrUpdateRecord(timestamp, column_index, value)
+    return res
+
+
+cdef void _remove_front(BasicDynamicBuffer[value_t] *buffer, size_t removeCount) except *:
+    if not buffer.isConcurrentAccessEnabled():
+        buffer.removeFront(removeCount)
+        return
+    with nogil:
+        buffer.removeFront(removeCount)
+
+
+cdef object _add_or_update_records(BasicDynamicBuffer[value_t] *buffer, timestamps,
+                                   column_indexes, values):
+    cdef const long[::1] ts = np.ascontiguousarray(timestamps, dtype=np.dtype('l'))
+    cdef const size_t[::1] cols = np.ascontiguousarray(column_indexes, dtype=np.uintp)
+    cdef np.ndarray vals = np.ascontiguousarray(
+        values, dtype=np.PyArray_DescrFromType(_typenum(buffer)))
+    cdef size_t n = ts.shape[0]
+    if <size_t>cols.shape[0] != n or <size_t>vals.shape[0] != n:
+        raise ValueError("timestamps, column_indexes and values must have the same length")
+    if n == 0:
+        return 0
+    cdef const value_t *valuesPtr = <const value_t*>np.PyArray_DATA(vals)
+    cdef size_t newRows
+    if not buffer.isConcurrentAccessEnabled():
+        return buffer.addOrUpdateRecords(&ts[0], &cols[0], valuesPtr, n)
+    with nogil:
+        newRows = buffer.addOrUpdateRecords(&ts[0], &cols[0], valuesPtr, n)
+    return newRows
+
+
+cdef object _row_as_numpy(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                          long timestamp):
+    cdef size_t rowSize = 0
+    cdef np.npy_intp shape[1]
+    cdef const value_t *row = buffer.getRecordByTimestampPtr(timestamp, rowSize)
+    if row is NULL or rowSize == 0:
+        return np.array([])
+    shape[0] = rowSize
+    if _columnar(buffer):
+        # Gathered row, overwritten by the next read
+        return np.PyArray_SimpleNewFromData(1, shape, _typenum(buffer), <void*>row).copy()
+    return owner._leased_array(1, shape, row, _typenum(buffer))
 
-    def get_slice_as_numpy(self, long timestamp, size_t N):
-        cdef size_t sliceSize = 0
-        cdef const double *slice = self.thisptr.getSlice(timestamp, N, sliceSize)
-        if slice is NULL:
-            raise ValueError("Slice cannot be retrieved")
 
-        cdef size_t num_elements = sliceSize  # Total number of double elements in the slice
-        cdef size_t num_rows = num_elements // self.thisptr.getNVariables()  # Calculate the number of rows
-        cdef np.npy_intp dims[2]
-        dims[0] = num_rows
-        dims[1] = self.thisptr.getNVariables()
+cdef object _slice_as_numpy(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                            long timestamp, size_t N):
+    cdef BasicSliceView[value_t] view = buffer.getSliceView(timestamp, N)
+    if view.first is NULL:
+        raise ValueError("Slice cannot be retrieved")
+    return _view_as_numpy(owner, buffer, view)
 
-        # Note: Setting mode='c' ensures the NumPy array is C-contiguous
-        return np.PyArray_SimpleNewFromData(2, dims, np.NPY_FLOAT64, <void*>slice)
 
-    def get_slice_timestamps(self, long timestamp, size_t N):
-        cdef vector[long] timestamps = self.thisptr.getSliceTimestamps(timestamp, N)
-        return [timestamp for timestamp in timestamps]
+cdef object _copy_slice(BasicDynamicBuffer[value_t] *buffer, long timestamp, size_t N,
+                        bint with_timestamps):
+    cdef size_t nVariables = buffer.getNVariables()
+    cdef np.ndarray out = np.empty((N, nVariables), dtype=np.PyArray_DescrFromType(_typenum(buffer)))
+    cdef np.ndarray[long, ndim=1] outTimestamps = np.empty(N if with_timestamps else 0,
+                                                           dtype=np.dtype('l'))
+    cdef value_t *values = <value_t*>np.PyArray_DATA(out) if N > 0 and nVariables > 0 else NULL
+    cdef long *timestamps = &outTimestamps[0] if with_timestamps and N > 0 else NULL
+    cdef size_t rows
+    if buffer.isConcurrentAccessEnabled():
+        with nogil:
+            rows = buffer.copySlice(timestamp, N, values, timestamps)
+    else:
+        rows = buffer.copySlice(timestamp, N, values, timestamps)
+    if rows == 0:
+        raise ValueError("Slice cannot be retrieved")
+    if with_timestamps:
+        return out[:rows], outTimestamps[:rows]
+    return out[:rows]
 
-    def remove_front(self, size_t removeCount):
-        self.thisptr.removeFront(removeCount)
 
-    def min_key(self):
-        return self.thisptr.minKey()
+cdef object _view_as_numpy(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                           BasicSliceView[value_t] view):
+    cdef int typenum = _typenum(buffer)
+    cdef size_t nVariables = buffer.getNVariables()
+    cdef np.npy_intp dims[2]
+    dims[0] = view.firstSize // nVariables  # Calculate the number of rows
+    dims[1] = nVariables
 
-    def max_key(self):
-        return self.thisptr.maxKey()
+    if _columnar(buffer):
+        # Gathered rows, overwritten by the next read
+        return np.PyArray_SimpleNewFromData(2, dims, typenum, <void*>view.first).copy()
 
-    def get_num_rows(self):
-        return self.thisptr.getNumRows()
+    if view.second is NULL:
+        # Zero-copy view: its lease keeps the rows in place while the array is alive
+        return owner._leased_array(2, dims, view.first, typenum)
 
-    def decrement_counters(self, list timestamps):
-        cdef vector[long] cpp_timestamps = vector[long]()
-        for timestamp in timestamps:
-            cpp_timestamps.push_back(timestamp)
-        self.thisptr.decrementCounters(cpp_timestamps)
+    first = np.PyArray_SimpleNewFromData(2, dims, typenum, <void*>view.first)
+    # The window wraps around the end of a circular buffer: the two
+    # segments have to be copied into a single array
+    dims[0] = view.secondSize // nVariables
+    second = np.PyArray_SimpleNewFromData(2, dims, typenum, <void*>view.second)
+    return np.concatenate((first, second))
 
-    def get_counters(self):
-        cdef vector[int] counters = self.thisptr.getCounters()
-        return [counter for counter in counters]
 
-    def print_counters(self):
-        self.thisptr.printCounters()
+cdef object _view_timestamps(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                             BasicSliceView[value_t] view):
+    cdef size_t nVariables = buffer.getNVariables()
+    cdef np.npy_intp dims[1]
+    dims[0] = view.firstSize // nVariables
+    if _columnar(buffer):
+        return np.PyArray_SimpleNewFromData(1, dims, np.NPY_LONG, <void*>view.firstTimestamps).copy()
+    if view.second is NULL:
+        return owner._leased_array(1, dims, view.firstTimestamps, np.NPY_LONG)
+    first = np.PyArray_SimpleNewFromData(1, dims, np.NPY_LONG, <void*>view.firstTimestamps)
+    dims[0] = view.secondSize // nVariables
+    second = np.PyArray_SimpleNewFromData(1, dims, np.NPY_LONG, <void*>view.secondTimestamps)
+    return np.concatenate((first, second))
 
-    def get_variable_update_count(self, long timestamp):
-        return self.thisptr.getVariableUpdateCount(timestamp)
+
+cdef object _slice_since(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                         long timestamp, long span, bint with_timestamps):
+    cdef BasicSliceView[value_t] view = buffer.getSliceViewSince(timestamp, span)
+    cdef np.npy_intp dims[2]
+    if view.first is NULL:
+        # No row in the time span
+        dims[0] = 0
+        dims[1] = buffer.getNVariables()
+        values = np.PyArray_SimpleNew(2, dims, _typenum(buffer))
+        if with_timestamps:
+            return values, np.empty(0, dtype=np.dtype('l'))
+        return values
+    values = _view_as_numpy(owner, buffer, view)
+    if with_timestamps:
+        return values, _view_timestamps(owner, buffer, view)
+    return values
+
+
+cdef object _slice_with_timestamps(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                                   long timestamp, size_t N):
+    cdef size_t sliceSize = 0
+    cdef const long *timestamps = NULL
+    cdef const value_t *slice = buffer.getSliceWithTimestamps(timestamp, N, sliceSize, timestamps)
+    if slice is NULL:
+        # The window wraps around the end of a circular buffer (or doesn't exist)
+        values = _slice_as_numpy(owner, buffer, timestamp, N)
+        return values, np.asarray(buffer.getSliceTimestamps(timestamp, N), dtype=np.dtype('l'))
+
+    cdef int typenum = _typenum(buffer)
+    cdef size_t nVariables = buffer.getNVariables()
+    cdef np.npy_intp dims[2]
+    dims[0] = sliceSize // nVariables
+    dims[1] = nVariables
+    if _columnar(buffer):
+        # Gathered rows, overwritten by the next read
+        return (np.PyArray_SimpleNewFromData(2, dims, typenum, <void*>slice).copy(),
+                np.PyArray_SimpleNewFromData(1, dims, np.NPY_LONG, <void*>timestamps).copy())
+    values = owner._leased_array(2, dims, slice, typenum)
+    return values, owner._leased_array(1, dims, timestamps, np.NPY_LONG)
+
+
+cdef object _column_slice_as_numpy(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                                   size_t column_index, long timestamp, size_t N):
+    if column_index >= buffer.getNVariables():
+        raise IndexError("Column index out of range")
+    if not _columnar(buffer):
+        return _slice_as_numpy(owner, buffer, timestamp, N)[:, column_index]
+
+    cdef BasicSliceView[value_t] view = buffer.getColumnSliceView(column_index, timestamp, N)
+    if view.first is NULL:
+        raise ValueError("Slice cannot be retrieved")
+    cdef int typenum = _typenum(buffer)
+    cdef np.npy_intp dims[1]
+    dims[0] = view.firstSize
+    if view.second is NULL:
+        return owner._leased_array(1, dims, view.first, typenum)
+
+    # The column wraps around the end of a circular buffer
+    first = np.PyArray_SimpleNewFromData(1, dims, typenum, <void*>view.first)
+    dims[0] = view.secondSize
+    second = np.PyArray_SimpleNewFromData(1, dims, typenum, <void*>view.second)
+    return np.concatenate((first, second))
+
+
+cdef object _row_fill_mask(BasicDynamicBuffer[value_t] *buffer, long timestamp):
+    cdef size_t words = 0
+    cdef const uint64_t *mask = buffer.getRowFillMask(timestamp, words)
+    if mask is NULL:
+        return np.array([], dtype=np.bool_)
+    cdef size_t nVariables = buffer.getNVariables()
+    cdef np.ndarray[np.uint8_t, ndim=1] out = np.empty(nVariables, dtype=np.uint8)
+    cdef size_t column
+    for column in range(nVariables):
+        out[column] = (mask[column // 64] >> (column % 64)) & 1
+    return out.view(np.bool_)
+
+
+cdef object _full_row_flags(BasicDynamicBuffer[value_t] *buffer, long timestamp, size_t N):
+    cdef np.ndarray[np.uint8_t, ndim=1] out = np.zeros(N, dtype=np.uint8)
+    cdef size_t rows = buffer.getFullRowFlags(timestamp, N, &out[0] if N > 0 else NULL)
+    return out[:rows].view(np.bool_)
+
+
+cdef object _aggregate(BasicDynamicBuffer[value_t] *buffer, long timestamp, size_t N, str op):
+    cdef Aggregate aggregate = _aggregate_op(op)
+    cdef np.ndarray[np.float64_t, ndim=1] out = np.empty(buffer.getNVariables(), dtype=np.float64)
+    cdef size_t rows = buffer.aggregate(timestamp, N, aggregate,
+                                        &out[0] if out.shape[0] > 0 else NULL)
+    if rows == 0:
+        raise ValueError("Slice cannot be retrieved")
+    return out
+
+
+cdef object _aggregate_since(BasicDynamicBuffer[value_t] *buffer, long timestamp, long span,
+                             str op):
+    cdef Aggregate aggregate = _aggregate_op(op)
+    cdef np.ndarray[np.float64_t, ndim=1] out = np.empty(buffer.getNVariables(), dtype=np.float64)
+    buffer.aggregateSince(timestamp, span, aggregate, &out[0] if out.shape[0] > 0 else NULL)
+    return out
+
+
+cdef object _resample(BasicDynamicBuffer[value_t] *buffer, long start, long step, size_t count,
+                      str method):
+    if method not in _RESAMPLE_METHODS:
+        raise ValueError("Unknown resampling method %r, expected one of %s"
+                         % (method, ", ".join(_RESAMPLE_METHODS)))
+    cdef ResampleMethod resampleMethod = _RESAMPLE_METHODS[method]
+    cdef size_t nVariables = buffer.getNVariables()
+    cdef np.ndarray[np.float64_t, ndim=2] out = np.empty((count, nVariables), dtype=np.float64)
+    buffer.resample(start, step, count, resampleMethod,
+                    &out[0, 0] if count > 0 and nVariables > 0 else NULL)
+    return out
+
+
+cdef object _rolling_statistics(BasicDynamicBuffer[value_t] *buffer, str op):
+    cdef Aggregate aggregate = _aggregate_op(op)
+    cdef np.ndarray[np.float64_t, ndim=1] out = np.empty(buffer.getNVariables(), dtype=np.float64)
+    buffer.getRollingStatistics(aggregate, &out[0] if out.shape[0] > 0 else NULL)
+    return out
+
+
+cdef void _decrement_counters(BasicDynamicBuffer[value_t] *buffer, timestamps) except *:
+    # Sorted once so that the rows are matched in a single forward walk
+    cdef const long[::1] ts = np.sort(np.asarray(timestamps, dtype=np.dtype('l')), kind='stable')
+    if ts.shape[0] == 0:
+        return
+    if not buffer.isConcurrentAccessEnabled():
+        buffer.decrementCounters(&ts[0], ts.shape[0])
+        return
+    with nogil:
+        buffer.decrementCounters(&ts[0], ts.shape[0])
+
+
+cdef void _save_snapshot(BasicDynamicBuffer[value_t] *buffer, path) except *:
+    cdef string encoded = os.fsencode(path)
+    if not buffer.isConcurrentAccessEnabled():
+        buffer.saveSnapshot(encoded)
+        return
+    with nogil:
+        buffer.saveSnapshot(encoded)
+
+
+cdef void _load_snapshot(BasicDynamicBuffer[value_t] *buffer, path, bint mapped) except *:
+    cdef string encoded = os.fsencode(path)
+    if not buffer.isConcurrentAccessEnabled():
+        buffer.loadSnapshot(encoded, mapped)
+        return
+    with nogil:
+        buffer.loadSnapshot(encoded, mapped)
+
+
+cdef bytes _snapshot_bytes(BasicDynamicBuffer[value_t] *buffer):
+    cdef vector[char] snapshot = buffer.getSnapshotBytes()
+    return snapshot.data()[:snapshot.size()]
+
+
+cdef void _load_snapshot_bytes(BasicDynamicBuffer[value_t] *buffer, bytes snapshot) except *:
+    buffer.loadSnapshotBytes(snapshot, len(snapshot))
+
+
+cdef void _set_write_ahead_log(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer,
+                               PyWriteAheadLog log) except *:
+    buffer.setWriteAheadLog(log.thisptr if log is not None else NULL)
+    owner.write_ahead_log = log
+
+
+cdef size_t _replay_write_ahead_log(BasicDynamicBuffer[value_t] *buffer, path) except *:
+    cdef string encoded = os.fsencode(path)
+    cdef size_t replayed
+    if not buffer.isConcurrentAccessEnabled():
+        return buffer.replayWriteAheadLog(encoded)
+    with nogil:
+        replayed = buffer.replayWriteAheadLog(encoded)
+    return replayed
+
+
+cdef void _release_arrow_owner(void *owner) noexcept with gil:
+    # Called by pyarrow from any thread, once the lease of the batch is released
+    Py_DECREF(<object>owner)
+
+
+cdef object _slice_as_arrow(_LeasedBuffer owner, BasicDynamicBuffer[value_t] *buffer, long timestamp,
+                            size_t N):
+    import pyarrow as pa
+    cdef ArrowSchema schema
+    cdef ArrowArray array
+    buffer.exportArrowSlice(timestamp, N, &schema, &array, _release_arrow_owner, <void*>owner)
+    # The batch keeps the buffer alive until pyarrow releases it
+    Py_INCREF(owner)
+    try:
+        return pa.RecordBatch._import_from_c(<uintptr_t>&array, <uintptr_t>&schema)
+    finally:
+        # Moved out by pyarrow, unless the import failed
+        if array.release is not NULL:
+            array.release(&array)
+        if schema.release is not NULL:
+            schema.release(&schema)
+
+
+def _load_buffer(cls, bytes snapshot):
+    """Unpickles a buffer of class cls from its snapshot"""
+    buffer = cls(1, 1)
+    buffer.load_snapshot_bytes(snapshot)
+    return buffer
+
+
+# PyDynamicBuffer, PyDynamicBufferFloat32, PyDynamicBufferInt32 and PyDynamicBufferInt64,
+# rendered from DynamicBufferClasses.pxi.in by setup.py
+include "DynamicBufferClasses.pxi"
 
 
 cdef class PyLastKnownValuesBuffer(PyDynamicBuffer):
-    def __cinit__(self, size_t nVariables, size_t windowSize):
-        self.thisptr = new LastKnownValuesBuffer(nVariables, windowSize)
+    def __cinit__(self, size_t nVariables, size_t windowSize, bint circular=False,
+                  bint columnar=False, **policy):
+        del self.thisptr  # Allocated by PyDynamicBuffer.__cinit__
+        self.thisptr = new LastKnownValuesBuffer(nVariables, windowSize, _storage_mode(circular),
+                                                 _data_layout(columnar), _buffer_policy(policy))
 
     def update_last_known_value(self, long timestamp, size_t column_index, double value):
-        cdef bool res = (<LastKnownValuesBuffer*>self.thisptr).updateLastKnownValue(timestamp, column_index, value)
+        cdef bool res
+        if not self.thisptr.isConcurrentAccessEnabled():
+            return (<LastKnownValuesBuffer*>self.thisptr).updateLastKnownValue(timestamp, column_index, value)
+        with nogil:
+            res = (<LastKnownValuesBuffer*>self.thisptr).updateLastKnownValue(timestamp, column_index, value)
         return res
+
+    def set_fill_strategy(self, str method, column_index=None, double constant=0.0,
+                          double decay_rate=0.0):
+        """Fills the cells that were not written with the 'forward' (default), 'zero',
+        'constant', 'linear' or 'decay' method, for one column or all of them"""
+        if method not in _FILL_METHODS:
+            raise ValueError("Unknown fill method %r, expected one of %s"
+                             % (method, ", ".join(_FILL_METHODS)))
+        cdef FillStrategy strategy
+        strategy.method = _FILL_METHODS[method]
+        strategy.constant = constant
+        strategy.decayRate = decay_rate
+        if column_index is None:
+            (<LastKnownValuesBuffer*>self.thisptr).setFillStrategy(strategy)
+        else:
+            (<LastKnownValuesBuffer*>self.thisptr).setFillStrategy(<size_t>column_index, strategy)
+
+    def save_snapshot(self, path):
+        """Writes the state of the buffer, fill strategies included, to a snapshot file"""
+        cdef string encoded = os.fsencode(path)
+        if not self.thisptr.isConcurrentAccessEnabled():
+            (<LastKnownValuesBuffer*>self.thisptr).saveSnapshot(encoded)
+            return
+        with nogil:
+            (<LastKnownValuesBuffer*>self.thisptr).saveSnapshot(encoded)
+
+    def load_snapshot(self, path, bint mapped=False):
+        cdef string encoded = os.fsencode(path)
+        if not self.thisptr.isConcurrentAccessEnabled():
+            (<LastKnownValuesBuffer*>self.thisptr).loadSnapshot(encoded, mapped)
+            return
+        with nogil:
+            (<LastKnownValuesBuffer*>self.thisptr).loadSnapshot(encoded, mapped)
+
+    def get_snapshot_bytes(self):
+        cdef vector[char] snapshot = (<LastKnownValuesBuffer*>self.thisptr).getSnapshotBytes()
+        return snapshot.data()[:snapshot.size()]
+
+    def load_snapshot_bytes(self, bytes snapshot):
+        (<LastKnownValuesBuffer*>self.thisptr).loadSnapshotBytes(snapshot, len(snapshot))
+
+    def replay_write_ahead_log(self, path):
+        cdef string encoded = os.fsencode(path)
+        cdef size_t replayed
+        if not self.thisptr.isConcurrentAccessEnabled():
+            return (<LastKnownValuesBuffer*>self.thisptr).replayWriteAheadLog(encoded)
+        with nogil:
+            replayed = (<LastKnownValuesBuffer*>self.thisptr).replayWriteAheadLog(encoded)
+        return replayed
+
+
+cdef class PyDynamicBufferPool:
+    """Series of double values sharing one arena, addressed by integer IDs. The calls on the
+    pool are serialised by its lock, so that ingest, get_slices and gather_slices run without
+    the GIL."""
+    cdef DynamicBufferPool *thisptr
+    cdef PyThread_type_lock lock
+
+    def __cinit__(self, size_t nVariables, size_t windowSize, bint circular=False,
+                  bint columnar=False, size_t slab_bytes=1 << 20, **policy):
+        self.lock = PyThread_allocate_lock()
+        if self.lock is NULL:
+            raise MemoryError()
+        self.thisptr = new DynamicBufferPool(nVariables, windowSize, _storage_mode(circular),
+                                             _data_layout(columnar), _buffer_policy(policy),
+                                             slab_bytes)
+
+    def __dealloc__(self):
+        del self.thisptr
+        if self.lock is not NULL:
+            PyThread_free_lock(self.lock)
+
+    cdef void _acquire(self) noexcept:
+        # Waited for without the GIL, which the holder may need back
+        with nogil:
+            PyThread_acquire_lock(self.lock, WAIT_LOCK)
+
+    cdef void _release(self) noexcept:
+        PyThread_release_lock(self.lock)
+
+    def add_series(self, size_t count=1):
+        """Adds count empty series, returns the ID of the first one"""
+        self._acquire()
+        try:
+            return self.thisptr.addSeries(count)
+        finally:
+            self._release()
+
+    def get_series_count(self):
+        self._acquire()
+        try:
+            return self.thisptr.getSeriesCount()
+        finally:
+            self._release()
+
+    def ingest(self, series_ids, timestamps, column_indexes, values):
+        """Ingests parallel arrays of samples of any series, returns the number of new rows"""
+        cdef const size_t[::1] ids = np.ascontiguousarray(series_ids, dtype=np.uintp)
+        cdef const long[::1] ts = np.ascontiguousarray(timestamps, dtype=np.dtype('l'))
+        cdef const size_t[::1] cols = np.ascontiguousarray(column_indexes, dtype=np.uintp)
+        cdef const double[::1] vals = np.ascontiguousarray(values, dtype=np.float64)
+        cdef size_t n = ids.shape[0]
+        if <size_t>ts.shape[0] != n or <size_t>cols.shape[0] != n or <size_t>vals.shape[0] != n:
+            raise ValueError("series_ids, timestamps, column_indexes and values must have the same length")
+        if n == 0:
+            return 0
+        cdef size_t newRows
+        self._acquire()
+        try:
+            with nogil:
+                newRows = self.thisptr.ingest(&ids[0], &ts[0], &cols[0], &vals[0], n)
+        finally:
+            self._release()
+        return newRows
+
+    def get_slices(self, series_ids, size_t N):
+        """Last N rows of each series as a (series, N, nVariables) array (NaN past the end of
+        the shorter ones), with their timestamps and numbers of rows"""
+        cdef const size_t[::1] ids = np.ascontiguousarray(series_ids, dtype=np.uintp)
+        cdef size_t nSeries = ids.shape[0]
+        cdef size_t nVariables = self.thisptr.getNVariables()
+        cdef np.ndarray[np.float64_t, ndim=3] out = np.empty((nSeries, N, nVariables), dtype=np.float64)
+        cdef np.ndarray[long, ndim=2] outTimestamps = np.empty((nSeries, N), dtype=np.dtype('l'))
+        cdef np.ndarray counts = np.empty(nSeries, dtype=np.uintp)
+        if nSeries == 0 or N == 0:
+            return out, outTimestamps, np.zeros(nSeries, dtype=np.uintp)
+        cdef double *values = &out[0, 0, 0] if nVariables > 0 else NULL
+        cdef long *timestamps = &outTimestamps[0, 0]
+        cdef size_t *rows = <size_t*>np.PyArray_DATA(counts)
+        self._acquire()
+        try:
+            with nogil:
+                self.thisptr.getSlices(&ids[0], nSeries, N, values, timestamps, rows)
+        finally:
+            self._release()
+        return out, outTimestamps, counts
+
+    def gather_slices(self, series_ids, long timestamp, size_t N, size_t threads=0):
+        """Last N rows at or before timestamp of each series, as in gather_slices"""
+        cdef const size_t[::1] ids = np.ascontiguousarray(series_ids, dtype=np.uintp)
+        cdef size_t nSeries = ids.shape[0]
+        cdef size_t nVariables = self.thisptr.getNVariables()
+        cdef np.ndarray[np.float64_t, ndim=3] out = np.empty((nSeries, N, nVariables), dtype=np.float64)
+        cdef np.ndarray[long, ndim=2] outTimestamps = np.empty((nSeries, N), dtype=np.dtype('l'))
+        cdef np.ndarray counts = np.empty(nSeries, dtype=np.uintp)
+        if nSeries == 0 or N == 0:
+            return out, outTimestamps, np.zeros(nSeries, dtype=np.uintp)
+        cdef double *values = &out[0, 0, 0] if nVariables > 0 else NULL
+        cdef long *timestamps = &outTimestamps[0, 0]
+        cdef size_t *rows = <size_t*>np.PyArray_DATA(counts)
+        self._acquire()
+        try:
+            with nogil:
+                self.thisptr.gatherSlices(&ids[0], nSeries, timestamp, N, values, timestamps, rows,
+                                          threads)
+        finally:
+            self._release()
+        return out, outTimestamps, counts
+
+    def get_arena_usage(self):
+        """Bytes handed out to the series and bytes reserved by the arena's slabs"""
+        self._acquire()
+        try:
+            return self.thisptr.getArena().getUsedBytes(), self.thisptr.getArena().getReservedBytes()
+        finally:
+            self._release()
+
+
+def gather_slices(buffers, long timestamp, size_t N, size_t threads=0):
+    """Last N rows at or before timestamp of each of the float64 buffers as one
+    (buffers, N, nVariables) array aligned on the last rows (NaN before the first row of the
+    shorter ones), with their timestamps (0 for the padding) and numbers of rows. The buffers
+    are copied on threads (0 for one per core), without the GIL if they are all in concurrent
+    mode."""
+    cdef vector[DynamicBuffer*] pointers
+    cdef PyDynamicBuffer buffer
+    cdef bint concurrent = True
+    for item in buffers:
+        if not isinstance(item, PyDynamicBuffer):
+            raise TypeError("gather_slices expects float64 buffers, got %s" % type(item).__name__)
+        buffer = item
+        if not buffer.thisptr.isConcurrentAccessEnabled():
+            buffer.thisptr.mergeStagedRows()
+            concurrent = False
+        pointers.push_back(buffer.thisptr)
+    cdef size_t nSeries = pointers.size()
+    cdef size_t nVariables = pointers[0].getNVariables() if nSeries > 0 else 0
+    cdef np.ndarray[np.float64_t, ndim=3] out = np.empty((nSeries, N, nVariables), dtype=np.float64)
+    cdef np.ndarray[long, ndim=2] outTimestamps = np.empty((nSeries, N), dtype=np.dtype('l'))
+    cdef np.ndarray counts = np.empty(nSeries, dtype=np.uintp)
+    if nSeries == 0 or N == 0:
+        return out, outTimestamps, np.zeros(nSeries, dtype=np.uintp)
+    if not concurrent:
+        gatherSlices(pointers.data(), nSeries, timestamp, N, &out[0, 0, 0] if nVariables > 0 else NULL,
+                     &outTimestamps[0, 0], <size_t*>np.PyArray_DATA(counts), threads)
+        return out, outTimestamps, counts
+    with nogil:
+        gatherSlices(pointers.data(), nSeries, timestamp, N, &out[0, 0, 0] if nVariables > 0 else NULL,
+                     &outTimestamps[0, 0], <size_t*>np.PyArray_DATA(counts), threads)
+    return out, outTimestamps, counts
+
+
+_BUFFER_CLASSES = {
+    np.dtype(np.float32): PyDynamicBufferFloat32,
+    np.dtype(np.float64): PyDynamicBuffer,
+    np.dtype(np.int32): PyDynamicBufferInt32,
+    np.dtype(np.int64): PyDynamicBufferInt64,
+}
+
+
+def make_dynamic_buffer(size_t nVariables, size_t windowSize, dtype=np.float64,
+                        bint circular=False, bint columnar=False, **policy):
+    """Buffer of the class storing dtype values (float32, float64, int32 or int64)"""
+    try:
+        cls = _BUFFER_CLASSES[np.dtype(dtype)]
+    except KeyError:
+        raise TypeError("Unsupported value type: %s" % np.dtype(dtype))
+    return cls(nVariables, windowSize, circular, columnar, **policy)
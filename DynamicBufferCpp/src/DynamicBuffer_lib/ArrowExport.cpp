@@ -0,0 +1,113 @@
+#include "ArrowExport.h"
+
+ArrowBatchStorage::~ArrowBatchStorage() {
+    if (onRelease != nullptr) {
+        onRelease(context);
+    }
+}
+
+namespace {
+// Each array and schema of a batch holds a reference to the state of the
+// whole batch, so that the children moved out by the consumer outlive the
+// parent
+struct ExportedSchema {
+    std::vector<std::string> names;
+    std::vector<ArrowSchema> children;
+    std::vector<ArrowSchema *> childPointers;
+};
+
+struct ExportedBatch {
+    std::shared_ptr<ArrowBatchStorage> storage;
+    std::vector<const void *> buffers; // Validity (always null) of the batch, then of each column
+    std::vector<ArrowArray> children;
+    std::vector<ArrowArray *> childPointers;
+};
+
+void releaseSchema(ArrowSchema *schema) {
+    for (int64_t i = 0; i < schema->n_children; ++i) {
+        ArrowSchema *child = schema->children[i];
+        if (child->release != nullptr) {
+            child->release(child);
+        }
+    }
+    delete static_cast<std::shared_ptr<ExportedSchema> *>(schema->private_data);
+    schema->release = nullptr;
+}
+
+void releaseArray(ArrowArray *array) {
+    for (int64_t i = 0; i < array->n_children; ++i) {
+        ArrowArray *child = array->children[i];
+        if (child->release != nullptr) {
+            child->release(child);
+        }
+    }
+    delete static_cast<std::shared_ptr<ExportedBatch> *>(array->private_data);
+    array->release = nullptr;
+}
+} // namespace
+
+void exportArrowBatch(const std::vector<ArrowExportColumn> &columns, int64_t length,
+                      const std::shared_ptr<ArrowBatchStorage> &storage, ArrowSchema *schema,
+                      ArrowArray *array) {
+    size_t nColumns = columns.size();
+
+    auto exportedSchema = std::make_shared<ExportedSchema>();
+    exportedSchema->names.reserve(nColumns);
+    exportedSchema->children.resize(nColumns);
+    for (size_t i = 0; i < nColumns; ++i) {
+        exportedSchema->names.push_back(columns[i].name);
+        ArrowSchema &child = exportedSchema->children[i];
+        child.format = columns[i].format;
+        child.name = exportedSchema->names[i].c_str();
+        child.metadata = nullptr;
+        child.flags = ARROW_FLAG_NULLABLE;
+        child.n_children = 0;
+        child.children = nullptr;
+        child.dictionary = nullptr;
+        child.release = releaseSchema;
+        child.private_data = new std::shared_ptr<ExportedSchema>(exportedSchema);
+        exportedSchema->childPointers.push_back(&child);
+    }
+    schema->format = "+s";
+    schema->name = "";
+    schema->metadata = nullptr;
+    schema->flags = 0;
+    schema->n_children = static_cast<int64_t>(nColumns);
+    schema->children = exportedSchema->childPointers.data();
+    schema->dictionary = nullptr;
+    schema->release = releaseSchema;
+    schema->private_data = new std::shared_ptr<ExportedSchema>(exportedSchema);
+
+    auto batch = std::make_shared<ExportedBatch>();
+    batch->storage = storage;
+    batch->buffers.push_back(nullptr);
+    for (const ArrowExportColumn &column : columns) {
+        batch->buffers.push_back(column.validity);
+        batch->buffers.push_back(column.values);
+    }
+    batch->children.resize(nColumns);
+    for (size_t i = 0; i < nColumns; ++i) {
+        ArrowArray &child = batch->children[i];
+        child.length = length;
+        child.null_count = columns[i].nullCount;
+        child.offset = 0;
+        child.n_buffers = 2;
+        child.n_children = 0;
+        child.buffers = &batch->buffers[1 + 2 * i];
+        child.children = nullptr;
+        child.dictionary = nullptr;
+        child.release = releaseArray;
+        child.private_data = new std::shared_ptr<ExportedBatch>(batch);
+        batch->childPointers.push_back(&child);
+    }
+    array->length = length;
+    array->null_count = 0;
+    array->offset = 0;
+    array->n_buffers = 1;
+    array->n_children = static_cast<int64_t>(nColumns);
+    array->buffers = batch->buffers.data();
+    array->children = batch->childPointers.data();
+    array->dictionary = nullptr;
+    array->release = releaseArray;
+    array->private_data = new std::shared_ptr<ExportedBatch>(batch);
+}
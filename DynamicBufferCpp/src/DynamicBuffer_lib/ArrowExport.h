@@ -0,0 +1,87 @@
+#ifndef ARROW_EXPORT_H
+#define ARROW_EXPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Arrow C data interface, as given by the specification
+// (https://arrow.apache.org/docs/format/CDataInterface.html) so that it can
+// be used along with Arrow's own headers. No Arrow library is needed.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char *format;
+  const char *name;
+  const char *metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema **children;
+  struct ArrowSchema *dictionary;
+  void (*release)(struct ArrowSchema *);
+  void *private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void **buffers;
+  struct ArrowArray **children;
+  struct ArrowArray *dictionary;
+  void (*release)(struct ArrowArray *);
+  void *private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+// Memory of an exported record batch: the columns copied for it, and what
+// keeps the columns served in place alive. Freed along with the last of the
+// exported arrays, calling onRelease(context) if set.
+class ArrowBatchStorage {
+public:
+  ArrowBatchStorage() : onRelease(nullptr), context(nullptr) {}
+  ~ArrowBatchStorage();
+  ArrowBatchStorage(const ArrowBatchStorage &) = delete;
+  ArrowBatchStorage &operator=(const ArrowBatchStorage &) = delete;
+
+  // Zeroed block of count elements, aligned on 8 bytes
+  template <typename U>
+  U *allocate(size_t count) {
+    blocks.emplace_back((count * sizeof(U) + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    return reinterpret_cast<U *>(blocks.back().data());
+  }
+
+  void (*onRelease)(void *context);
+  void *context;
+
+private:
+  std::vector<std::vector<uint64_t>> blocks;
+};
+
+// Primitive column of an exported record batch
+struct ArrowExportColumn {
+  const char *format; // Arrow format string, e.g. "g" for float64
+  std::string name;
+  const void *values;
+  const uint8_t *validity; // Null without missing values
+  int64_t nullCount;
+};
+
+// Exports the columns (length values each, held by storage) as a record
+// batch: a struct array along with its schema. The consumer owns both and
+// releases them through their release callbacks.
+void exportArrowBatch(const std::vector<ArrowExportColumn> &columns, int64_t length,
+                      const std::shared_ptr<ArrowBatchStorage> &storage, ArrowSchema *schema,
+                      ArrowArray *array);
+
+#endif // ARROW_EXPORT_H
@@ -2,452 +2,2577 @@
 #include "constants.h"
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
-DynamicBuffer::DynamicBuffer(size_t
-nVariables,
-size_t windowSize
-)
-:
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DYNAMIC_BUFFER_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+// Branch-light lower bound: the loop only narrows the range with a
+// conditional move, so its trip count only depends on the length
+size_t lowerBound(const long *first, size_t length, long timestamp) {
+    if (length == 0) {
+        return 0;
+    }
+    const long *base = first;
+    while (length > 1) {
+        size_t half = length / 2;
+        base = (base[half] < timestamp) ? base + half : base;
+        length -= half;
+    }
+    return static_cast<size_t>(base - first) + (*base < timestamp);
+}
+
+// Counts, sums and extrema per column of nRows rows (stride values apart),
+// skipping the missing cells and NaN
+template <typename T, typename Missing>
+void accumulateMomentsScalar(const T *rows, size_t nRows, size_t stride, size_t nColumns,
+                             double *count, double *sum, double *min, double *max) {
+    for (size_t row = 0; row < nRows; ++row) {
+        const T *values = rows + row * stride;
+        for (size_t column = 0; column < nColumns; ++column) {
+            T value = values[column];
+            if (Missing::isMissing(value) || value != value) {
+                continue;
+            }
+            double x = static_cast<double>(value);
+            count[column] += 1.0;
+            sum[column] += x;
+            min[column] = std::min(min[column], x);
+            max[column] = std::max(max[column], x);
+        }
+    }
+}
+
+// Sums of the squared deviations from mean per column, for the std
+template <typename T, typename Missing>
+void accumulateSquaresScalar(const T *rows, size_t nRows, size_t stride, size_t nColumns,
+                             const double *mean, double *squares) {
+    for (size_t row = 0; row < nRows; ++row) {
+        const T *values = rows + row * stride;
+        for (size_t column = 0; column < nColumns; ++column) {
+            T value = values[column];
+            if (Missing::isMissing(value) || value != value) {
+                continue;
+            }
+            double deviation = static_cast<double>(value) - mean[column];
+            squares[column] += deviation * deviation;
+        }
+    }
+}
+
+// Vectorised versions of the kernels above, over the first columns of the
+// rows (the returned count, a multiple of 4). Only the types whose missing
+// cells are NaN have one, the generic version handles no column.
+template <typename T, typename Missing>
+struct SimdKernels {
+    static size_t moments(const T *, size_t, size_t, size_t, double *, double *, double *,
+                          double *) {
+        return 0;
+    }
+    static size_t squares(const T *, size_t, size_t, size_t, const double *, double *) {
+        return 0;
+    }
+};
+
+#ifdef DYNAMIC_BUFFER_AVX2
+bool cpuHasAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+__attribute__((target("avx2"))) inline __m256d loadDoubles(const double *values) {
+    return _mm256_loadu_pd(values);
+}
+
+__attribute__((target("avx2"))) inline __m256d loadDoubles(const float *values) {
+    return _mm256_cvtps_pd(_mm_loadu_ps(values));
+}
+
+// Each group of 4 columns is accumulated over all the rows in registers
+template <typename T>
+__attribute__((target("avx2"))) size_t accumulateMomentsAvx2(const T *rows, size_t nRows,
+                                                              size_t stride, size_t nColumns,
+                                                              double *count, double *sum,
+                                                              double *min, double *max) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    size_t vectorColumns = nColumns - nColumns % 4;
+    for (size_t column = 0; column < vectorColumns; column += 4) {
+        __m256d columnCount = _mm256_loadu_pd(count + column);
+        __m256d columnSum = _mm256_loadu_pd(sum + column);
+        __m256d columnMin = _mm256_loadu_pd(min + column);
+        __m256d columnMax = _mm256_loadu_pd(max + column);
+        for (size_t row = 0; row < nRows; ++row) {
+            __m256d value = loadDoubles(rows + row * stride + column);
+            __m256d present = _mm256_cmp_pd(value, value, _CMP_ORD_Q);
+            columnCount = _mm256_add_pd(columnCount, _mm256_and_pd(present, one));
+            columnSum = _mm256_add_pd(columnSum, _mm256_and_pd(present, value));
+            // min/max return their second operand when the first one is NaN
+            columnMin = _mm256_min_pd(value, columnMin);
+            columnMax = _mm256_max_pd(value, columnMax);
+        }
+        _mm256_storeu_pd(count + column, columnCount);
+        _mm256_storeu_pd(sum + column, columnSum);
+        _mm256_storeu_pd(min + column, columnMin);
+        _mm256_storeu_pd(max + column, columnMax);
+    }
+    return vectorColumns;
+}
+
+template <typename T>
+__attribute__((target("avx2"))) size_t accumulateSquaresAvx2(const T *rows, size_t nRows,
+                                                              size_t stride, size_t nColumns,
+                                                              const double *mean,
+                                                              double *squares) {
+    size_t vectorColumns = nColumns - nColumns % 4;
+    for (size_t column = 0; column < vectorColumns; column += 4) {
+        __m256d columnMean = _mm256_loadu_pd(mean + column);
+        __m256d columnSquares = _mm256_loadu_pd(squares + column);
+        for (size_t row = 0; row < nRows; ++row) {
+            __m256d value = loadDoubles(rows + row * stride + column);
+            __m256d present = _mm256_cmp_pd(value, value, _CMP_ORD_Q);
+            __m256d deviation = _mm256_and_pd(present, _mm256_sub_pd(value, columnMean));
+            columnSquares = _mm256_add_pd(columnSquares, _mm256_mul_pd(deviation, deviation));
+        }
+        _mm256_storeu_pd(squares + column, columnSquares);
+    }
+    return vectorColumns;
+}
+
+template <typename T>
+struct Avx2Kernels {
+    static size_t moments(const T *rows, size_t nRows, size_t stride, size_t nColumns,
+                          double *count, double *sum, double *min, double *max) {
+        return cpuHasAvx2() ? accumulateMomentsAvx2(rows, nRows, stride, nColumns, count, sum,
+                                                    min, max)
+                            : 0;
+    }
+    static size_t squares(const T *rows, size_t nRows, size_t stride, size_t nColumns,
+                          const double *mean, double *squares) {
+        return cpuHasAvx2() ? accumulateSquaresAvx2(rows, nRows, stride, nColumns, mean, squares)
+                            : 0;
+    }
+};
+
+template <>
+struct SimdKernels<double, MissingValue<double>> : Avx2Kernels<double> {};
+
+template <>
+struct SimdKernels<float, MissingValue<float>> : Avx2Kernels<float> {};
+#endif
+
+// Monotonic deque of the (timestamp, value) candidates to the extremum of a
+// variable: each candidate is the extremum of the values from its timestamp
+// on, so the front is the extremum. before(a, b) tells whether a is strictly
+// more extreme than b.
+typedef std::deque<std::pair<long, double>> Candidates;
+
+Candidates::iterator findCandidate(Candidates &candidates, long timestamp) {
+    if (candidates.empty() || candidates.back().first < timestamp) {
+        // Appends don't have a candidate yet
+        return candidates.end();
+    }
+    auto it = std::lower_bound(candidates.begin(), candidates.end(), timestamp,
+                               [](const std::pair<long, double> &candidate, long t) {
+                                   return candidate.first < t;
+                               });
+    return (it != candidates.end() && it->first == timestamp) ? it : candidates.end();
+}
+
+// Value written at a timestamp without a candidate, in any order
+template <typename Before>
+void insertCandidate(Candidates &candidates, long timestamp, double value, Before before) {
+    if (candidates.empty() || candidates.back().first < timestamp) {
+        // Append: the classic sliding window update
+        while (!candidates.empty() && !before(candidates.back().second, value)) {
+            candidates.pop_back();
+        }
+        candidates.emplace_back(timestamp, value);
+        return;
+    }
+    auto next = std::upper_bound(candidates.begin(), candidates.end(), timestamp,
+                                 [](long t, const std::pair<long, double> &candidate) {
+                                     return t < candidate.first;
+                                 });
+    if (next != candidates.end() && !before(value, next->second)) {
+        // A later value is at least as extreme
+        return;
+    }
+    // The earlier candidates that are not more extreme are dominated
+    auto first = next;
+    while (first != candidates.begin() && !before(std::prev(first)->second, value)) {
+        --first;
+    }
+    candidates.insert(candidates.erase(first, next), std::make_pair(timestamp, value));
+}
+
+// Returns false if the deque can't be corrected and must be rebuilt
+template <typename Before>
+bool writeCandidate(Candidates &candidates, long timestamp, bool present, double value,
+                    Before before) {
+    auto it = findCandidate(candidates, timestamp);
+    if (it != candidates.end()) {
+        if (!present || before(it->second, value)) {
+            // A candidate became less extreme: earlier values may take its place
+            return false;
+        }
+        candidates.erase(it);
+    }
+    if (present) {
+        insertCandidate(candidates, timestamp, value, before);
+    }
+    return true;
+}
+
+// Same when the row at timestamp is removed
+bool removeCandidate(Candidates &candidates, long timestamp, bool oldest) {
+    auto it = findCandidate(candidates, timestamp);
+    if (it == candidates.end()) {
+        return true;
+    }
+    if (oldest) {
+        // Nothing precedes it, the next candidate takes over
+        candidates.pop_front();
+        return true;
+    }
+    return false;
+}
+
+template <typename T, typename Missing>
+void accumulateMoments(const T *rows, size_t nRows, size_t stride, size_t nColumns,
+                       double *count, double *sum, double *min, double *max) {
+    size_t done = SimdKernels<T, Missing>::moments(rows, nRows, stride, nColumns, count, sum,
+                                                   min, max);
+    accumulateMomentsScalar<T, Missing>(rows + done, nRows, stride, nColumns - done,
+                                        count + done, sum + done, min + done, max + done);
+}
+
+template <typename T, typename Missing>
+void accumulateSquares(const T *rows, size_t nRows, size_t stride, size_t nColumns,
+                       const double *mean, double *squares) {
+    size_t done = SimdKernels<T, Missing>::squares(rows, nRows, stride, nColumns, mean, squares);
+    accumulateSquaresScalar<T, Missing>(rows + done, nRows, stride, nColumns - done, mean + done,
+                                        squares + done);
+}
+} // namespace
+
+template <typename T, typename Missing>
+BasicDynamicBuffer<T, Missing>::BasicDynamicBuffer(size_t nVariables, size_t windowSize,
+                                                   StorageMode storageMode,
+                                                   DataLayout dataLayout,
+                                                   const BufferPolicy &policy)
+    : storageMode(storageMode), dataLayout(dataLayout), headRow(0), numRows(0),
+      nVariables(nVariables), windowSize(windowSize), policy(policy),
+      maxRows(policy.maxRows > 0 ? policy.maxRows : DEFAULT_BUFFER_LENGTH_FACTOR * windowSize),
+      bufferRows(0), bufferLength(0),
+      rowStride(dataLayout == DataLayout::RowMajor ? nVariables : 1),
+      columnStride(dataLayout == DataLayout::RowMajor ? 1 : 0), zeroPrefix(0),
+      maskWords((nVariables + 63) / 64), maskStride(maskWords), maxStagedRows(0), rollingStatistics(false),
+      concurrentAccess(false), writeDepth(0), sequence(0), activePins(0),
+      storageGeneration(0), storageLeases(0), frozenLeases(0), writeAheadLog(nullptr) {
+    if (policy.growthFactor <= 1.0) {
+        throw std::invalid_argument("Growth factor must be greater than 1");
+    }
+    if (policy.evictionRatio <= 0.0 || policy.evictionRatio > 1.0) {
+        throw std::invalid_argument("Eviction ratio must be in (0, 1]");
+    }
+    if (policy.minRetainedRows > 0 && policy.minRetainedRows >= maxRows) {
+        throw std::invalid_argument("Minimum retained rows must be lower than the capacity");
+    }
+    if (policy.retentionSpan < 0) {
+        throw std::invalid_argument("Retention span must not be negative");
+    }
+    evictionHighWaterMark =
+            std::max<size_t>(1, static_cast<size_t>(std::ceil(policy.evictionRatio * maxRows)));
+    if (!policy.lazyAllocation) {
+        reallocateStorage(maxRows);
+    }
+}
+
+template <typename T, typename Missing>
+BasicDynamicBuffer<T, Missing>::WriteSection::WriteSection(BasicDynamicBuffer &buffer)
+    : buffer(buffer) {
+    if (buffer.writeDepth++ == 0) {
+        buffer.detachFrozenStorage();
+        if (buffer.concurrentAccess) {
+            // Odd sequence: readers retry (and can't pin rows) until the section ends
+            buffer.sequence.fetch_add(1);
+        }
+    }
+}
+
+template <typename T, typename Missing>
+BasicDynamicBuffer<T, Missing>::WriteSection::~WriteSection() {
+    if (--buffer.writeDepth == 0 && buffer.concurrentAccess) {
+        buffer.sequence.fetch_add(1, std::memory_order_release);
+    }
+}
+
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::rowsPinned() const {
+    return concurrentAccess && activePins.load() > 0;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::waitForUnpinnedRows() const {
+    // Called within a write section: no new pin can be taken meanwhile
+    while (rowsPinned()) {
+        std::this_thread::yield();
+    }
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::lowerBoundRow(long timestamp) const {
+    size_t firstLength = std::min(numRows, bufferRows - headRow);
+    const long *first = rowTimestamps.data() + headRow;
+    if (firstLength == numRows || timestamp <= first[firstLength - 1]) {
+        return lowerBound(first, firstLength, timestamp);
+    }
+    // The rows wrap around the end of the storage and the timestamp lies
+    // past the first segment
+    return firstLength + lowerBound(rowTimestamps.data(), numRows - firstLength, timestamp);
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::findRow(long timestamp) const {
+    if (numRows == 0) {
+        return npos;
+    }
+    // Fast path: appends and updates mostly target the latest row
+    long lastTimestamp = rowTimestamp(numRows - 1);
+    if (lastTimestamp == timestamp) {
+        return numRows - 1;
+    }
+    if (timestamp > lastTimestamp) {
+        return npos;
+    }
+    size_t rowIndex = lowerBoundRow(timestamp);
+    return (rowIndex < numRows && rowTimestamp(rowIndex) == timestamp) ? rowIndex : npos;
+}
+
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::isInWindow(size_t rowIndex) const {
+    return rowIndex > (numRows - 1 - windowSize);
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::shiftRows(size_t first, size_t last, std::ptrdiff_t shift) {
+    if (first >= last) {
+        return;
+    }
+    size_t count = last - first;
+    size_t source = physicalRow(first);
+    size_t destination = physicalRow(first + shift);
+
+    if (source + count <= bufferRows && destination + count <= bufferRows) {
+        // Neither range wraps: move everything at once
+        if (dataLayout == DataLayout::ColumnMajor) {
+            // One contiguous range per column
+            for (size_t column = 0; column < nVariables; ++column) {
+                auto columnBegin = data.begin() + column * columnStride;
+                if (shift > 0) {
+                    std::move_backward(columnBegin + source, columnBegin + source + count,
+                                       columnBegin + destination + count);
+                } else {
+                    std::move(columnBegin + source, columnBegin + source + count,
+                              columnBegin + destination);
+                }
+            }
+        } else if (shift > 0) {
+            std::move_backward(data.begin() + source * nVariables,
+                               data.begin() + (source + count) * nVariables,
+                               data.begin() + (destination + count) * nVariables);
+        } else {
+            std::move(data.begin() + source * nVariables,
+                      data.begin() + (source + count) * nVariables,
+                      data.begin() + destination * nVariables);
+        }
+        if (shift > 0) {
+            std::move_backward(rowTimestamps.begin() + source,
+                               rowTimestamps.begin() + source + count,
+                               rowTimestamps.begin() + destination + count);
+            std::move_backward(counters.begin() + source,
+                               counters.begin() + source + count,
+                               counters.begin() + destination + count);
+            std::move_backward(updateCounts.begin() + source,
+                               updateCounts.begin() + source + count,
+                               updateCounts.begin() + destination + count);
+            std::move_backward(validity.begin() + source * maskStride,
+                               validity.begin() + (source + count) * maskStride,
+                               validity.begin() + (destination + count) * maskStride);
+        } else {
+            std::move(rowTimestamps.begin() + source, rowTimestamps.begin() + source + count,
+                      rowTimestamps.begin() + destination);
+            std::move(counters.begin() + source, counters.begin() + source + count,
+                      counters.begin() + destination);
+            std::move(updateCounts.begin() + source, updateCounts.begin() + source + count,
+                      updateCounts.begin() + destination);
+            std::move(validity.begin() + source * maskStride,
+                      validity.begin() + (source + count) * maskStride,
+                      validity.begin() + destination * maskStride);
+        }
+        return;
+    }
+
+    // Row by row, in an order that never overwrites a row before it is moved
+    for (size_t i = 0; i < count; ++i) {
+        size_t row = (shift > 0) ? last - 1 - i : first + i;
+        size_t from = physicalRow(row);
+        size_t to = physicalRow(row + shift);
+        for (size_t column = 0; column < nVariables; ++column) {
+            data[to * rowStride + column * columnStride] =
+                    data[from * rowStride + column * columnStride];
+        }
+        rowTimestamps[to] = rowTimestamps[from];
+        counters[to] = counters[from];
+        updateCounts[to] = updateCounts[from];
+        std::copy_n(&validity[from * maskStride], maskStride, &validity[to * maskStride]);
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::trackInheritedCells() {
+    if (maskStride > maskWords) {
+        return;
+    }
+    StorageVector<uint64_t> newValidity(bufferRows * 2 * maskWords, 0, policy.arena);
+    for (size_t row = 0; row < bufferRows; ++row) {
+        std::copy_n(&validity[row * maskWords], maskWords, &newValidity[row * 2 * maskWords]);
+    }
+    validity = std::move(newValidity);
+    maskStride = 2 * maskWords;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::clearRow(size_t row) {
+    std::fill_n(rowMask(row), maskStride, 0);
+    rowUpdateCount(row) = 0;
+    if (dataLayout == DataLayout::RowMajor) {
+        std::fill_n(rowData(row), nVariables, Missing::value());
+        return;
+    }
+    for (size_t column = 0; column < nVariables; ++column) {
+        cell(row, column) = Missing::value();
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::writeRow(size_t row, const T *values, const uint64_t *mask) {
+    std::copy_n(mask, maskWords, rowMask(row));
+    // Written cells, none of them inherited
+    std::fill(rowMask(row) + maskWords, rowMask(row) + maskStride, 0);
+    if (dataLayout == DataLayout::RowMajor) {
+        std::copy_n(values, nVariables, rowData(row));
+        return;
+    }
+    for (size_t column = 0; column < nVariables; ++column) {
+        cell(row, column) = values[column];
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::copyRow(size_t fromRow, size_t toRow) {
+    std::copy_n(rowMask(fromRow), maskWords, rowMask(toRow));
+    if (dataLayout == DataLayout::RowMajor) {
+        std::copy_n(rowData(fromRow), nVariables, rowData(toRow));
+        return;
+    }
+    for (size_t column = 0; column < nVariables; ++column) {
+        cell(toRow, column) = cell(fromRow, column);
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::fillColumn(size_t column, size_t firstRow, size_t lastRow, T value) {
+    size_t word = column / 64;
+    uint64_t bit = uint64_t(1) << (column % 64);
+    bool inherited = maskStride > maskWords;
+    // The rows are a ring of at most two contiguous segments
+    while (firstRow < lastRow) {
+        size_t start = physicalRow(firstRow);
+        size_t count = std::min(lastRow - firstRow, bufferRows - start);
+        T *values = &data[start * rowStride + column * columnStride];
+        if (dataLayout == DataLayout::ColumnMajor) {
+            std::fill_n(values, count, value);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                values[i * nVariables] = value;
+            }
+        }
+        uint64_t *masks = &validity[start * maskStride + word];
+        for (size_t i = 0; i < count; ++i) {
+            masks[i * maskStride] |= bit;
+            if (inherited) {
+                masks[i * maskStride + maskWords] |= bit;
+            }
+        }
+        firstRow += count;
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::copyRows(size_t firstRow, size_t lastRow, T *out,
+                                              long *outTimestamps) const {
+    size_t count = lastRow + 1 - firstRow;
+    if (dataLayout == DataLayout::RowMajor) {
+        BasicSliceView<T> view = rowsView(firstRow, lastRow);
+        std::copy_n(view.first, view.firstSize, out);
+        if (view.second != nullptr) {
+            std::copy_n(view.second, view.secondSize, out + view.firstSize);
+        }
+    } else {
+        // Gather column by column, each column being read sequentially
+        for (size_t column = 0; column < nVariables; ++column) {
+            for (size_t i = 0; i < count; ++i) {
+                out[i * nVariables + column] = cell(firstRow + i, column);
+            }
+        }
+    }
+    if (outTimestamps != nullptr) {
+        // The timestamps are a ring of at most two contiguous segments
+        size_t start = physicalRow(firstRow);
+        size_t firstCount = std::min(count, bufferRows - start);
+        std::copy_n(&rowTimestamps[start], firstCount, outTimestamps);
+        std::copy_n(&rowTimestamps[0], count - firstCount, outTimestamps + firstCount);
+    }
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::scanFullRows(size_t firstRow, size_t lastRow,
+                                                   uint8_t *outFlags) const {
+    // Mask of a full row: all words set, except the unused bits of the last one
+    uint64_t fullLastWord = (nVariables % 64 == 0) ? ~uint64_t(0)
+                                                   : (uint64_t(1) << (nVariables % 64)) - 1;
+    size_t count = lastRow + 1 - firstRow;
+    size_t start = physicalRow(firstRow);
+    size_t firstCount = std::min(count, bufferRows - start);
+    size_t fullRows = 0;
+    // The masks are a ring of at most two contiguous segments
+    for (size_t segment = 0; segment < 2; ++segment) {
+        const uint64_t *masks = &validity[(segment == 0 ? start : 0) * maskStride];
+        size_t rows = (segment == 0) ? firstCount : count - firstCount;
+        uint8_t *flags = (outFlags == nullptr || segment == 0) ? outFlags : outFlags + firstCount;
+        if (maskStride == 1) {
+            // Single word per row: branchless, vectorisable loop
+            for (size_t i = 0; i < rows; ++i) {
+                uint8_t full = (masks[i] == fullLastWord);
+                fullRows += full;
+                if (flags != nullptr) {
+                    flags[i] = full;
+                }
+            }
+            continue;
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            const uint64_t *mask = masks + i * maskStride;
+            bool full = (mask[maskWords - 1] == fullLastWord) &&
+                        std::all_of(mask, mask + maskWords - 1,
+                                    [](uint64_t word) { return word == ~uint64_t(0); });
+            fullRows += full;
+            if (flags != nullptr) {
+                flags[i] = full;
+            }
+        }
+    }
+    return fullRows;
+}
+
+template <typename T, typename Missing>
+BasicSliceView<T> BasicDynamicBuffer<T, Missing>::rowsView(size_t firstRow, size_t lastRow) const {
+    BasicSliceView<T> view;
+    size_t start = physicalRow(firstRow);
+    size_t count = lastRow + 1 - firstRow;
+    size_t firstCount = std::min(count, bufferRows - start);
+    view.first = &data[start * nVariables];
+    view.firstSize = firstCount * nVariables;
+    view.firstTimestamps = &rowTimestamps[start];
+    if (firstCount < count) {
+        view.second = &data[0];
+        view.secondSize = (count - firstCount) * nVariables;
+        view.secondTimestamps = &rowTimestamps[0];
+    }
+    return view;
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::insertRow(long timestamp) {
+    // Check if there is enough room for a new record
+    if (!hasEnoughRoomForNewRecord()) {
+        // Remove all rows with zero counters
+        removeZeroCount();
+        if (!hasEnoughRoomForNewRecord()) {
+            throw std::out_of_range("Buffer is full and can't be emptied further.");
+        }
+    } else if (numRows + stagedTimestamps.size() >= evictionHighWaterMark &&
+               (zeroPrefix > 0 || expiredRows() > 0) &&
+               numRows > policy.minRetainedRows && !rowsPinned()) {
+        // Early eviction, the pinned rows only hold it back when the buffer is full
+        removeZeroCount();
+    }
+    reserveRows(numRows + 1);
+
+    size_t rowIndex = (numRows == 0 || timestamp > rowTimestamp(numRows - 1))
+                      ? numRows
+                      : lowerBoundRow(timestamp);
+
+    // Shift the rows coming after the new one to make room for it
+    if (rowIndex < numRows) {
+        waitForUnpinnedRows();
+        detachLeasedStorage();
+    }
+    shiftRows(rowIndex, numRows, 1);
+    ++numRows;
+
+    // Prepare space for new data
+    clearRow(rowIndex);
+    rowTimestamps[physicalRow(rowIndex)] = timestamp;
+    counters[physicalRow(rowIndex)] = 0;
+    if (rowIndex <= zeroPrefix) {
+        ++zeroPrefix;
+    }
+
+    return rowIndex;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::updateCell(size_t rowIndex, size_t columnIndex, T value) {
+    uint64_t *mask = rowMask(rowIndex);
+    bool wasMissing = !isMarked(mask, columnIndex);
+    trackCellWrite(columnIndex, rowTimestamp(rowIndex),
+                   wasMissing ? nullptr : &cell(rowIndex, columnIndex), value);
+    markCell(mask, columnIndex);
+    if (maskStride > maskWords) {
+        unmarkCell(mask + maskWords, columnIndex);
+    }
+    cell(rowIndex, columnIndex) = value;
+    // only increment counter if the row is within the window range
+    if (isInWindow(rowIndex)) {
+        // Only increment counter if the value was missing before, else it would mean it is an update
+        if (wasMissing) {
+            incrementRowCounter(rowIndex);
+        }
+    }
+}
+
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::stageRecord(long timestamp, size_t columnIndex, T value) {
+    auto it = std::lower_bound(stagedTimestamps.begin(), stagedTimestamps.end(), timestamp);
+    bool newRow = (it == stagedTimestamps.end() || *it != timestamp);
+    if (newRow) {
+        if (!hasEnoughRoomForNewRecord()) {
+            // Merge the staged rows so that rows with zero counters can be evicted
+            removeZeroCount();
+            if (!hasEnoughRoomForNewRecord()) {
+                throw std::out_of_range("Buffer is full and can't be emptied further.");
+            }
+            it = stagedTimestamps.begin();
+        }
+        size_t stagedRow = it - stagedTimestamps.begin();
+        stagedTimestamps.insert(it, timestamp);
+        stagedData.insert(stagedData.begin() + stagedRow * nVariables, nVariables, Missing::value());
+        stagedValidity.insert(stagedValidity.begin() + stagedRow * maskWords, maskWords, 0);
+        stagedUpdateCounts.insert(stagedUpdateCounts.begin() + stagedRow, 1);
+        trackCellWrite(columnIndex, timestamp, nullptr, value);
+        stagedData[stagedRow * nVariables + columnIndex] = value;
+        markCell(&stagedValidity[stagedRow * maskWords], columnIndex);
+    } else {
+        size_t stagedRow = it - stagedTimestamps.begin();
+        T &stagedValue = stagedData[stagedRow * nVariables + columnIndex];
+        trackCellWrite(columnIndex, timestamp,
+                       isMarked(&stagedValidity[stagedRow * maskWords], columnIndex) ? &stagedValue
+                                                                                     : nullptr,
+                       value);
+        stagedValue = value;
+        markCell(&stagedValidity[stagedRow * maskWords], columnIndex);
+        ++stagedUpdateCounts[stagedRow];
+    }
+    return newRow;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::setLateArrivalStaging(size_t maxStagedRows) {
+    WriteSection section(*this);
+    mergeStagedRows();
+    this->maxStagedRows = maxStagedRows;
+    stagedTimestamps.reserve(maxStagedRows);
+    stagedData.reserve(maxStagedRows * nVariables);
+    stagedValidity.reserve(maxStagedRows * maskWords);
+    stagedUpdateCounts.reserve(maxStagedRows);
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getStagedRowCount() const { return stagedTimestamps.size(); }
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::mergeStagedRows() {
+    size_t stagedCount = stagedTimestamps.size();
+    if (stagedCount == 0) {
+        return;
+    }
+    WriteSection section(*this);
+    if (rowsPinned()) {
+        // Merging moves rows: deferred until the readers release their slices
+        return;
+    }
+    reserveRows(numRows + stagedCount);
+    detachLeasedStorage();
+    size_t totalRows = numRows + stagedCount;
+    size_t windowStart = totalRows - 1 - windowSize;
+
+    // Merge from the back: each run of rows between two staged rows is moved
+    // only once, directly to its final position
+    size_t mainRows = numRows;
+    for (size_t staged = stagedCount; staged > 0; --staged) {
+        const T *values = &stagedData[(staged - 1) * nVariables];
+        const uint64_t *mask = &stagedValidity[(staged - 1) * maskWords];
+        numRows = mainRows; // Rows [0, mainRows) are still in place
+        size_t position = lowerBoundRow(stagedTimestamps[staged - 1]);
+        shiftRows(position, mainRows, staged);
+
+        size_t row = position + staged - 1;
+        writeRow(row, values, mask);
+        rowTimestamps[physicalRow(row)] = stagedTimestamps[staged - 1];
+        rowUpdateCount(row) = stagedUpdateCounts[staged - 1];
+        // only count the values if the row is within the window range
+        counters[physicalRow(row)] = (row > windowStart) ? static_cast<int>(fillCount(mask)) : 0;
+        mainRows = position;
+    }
+    numRows = totalRows;
+    zeroPrefix = 0;
+    extendZeroPrefix();
+
+    stagedTimestamps.clear();
+    stagedData.clear();
+    stagedValidity.clear();
+    stagedUpdateCounts.clear();
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::flushStagedRows() {
+    if (!stagedTimestamps.empty()) {
+        waitForUnpinnedRows();
+        mergeStagedRows();
+    }
+}
+
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::deleteRecord(long timestamp) {
+    if (logsOperations()) {
+        logOperation(WriteAheadOp::Delete, 0, timestamp, 0);
+    }
+    WriteSection section(*this);
+    waitForUnpinnedRows();
+    flushStagedRows();
+    detachLeasedStorage();
+    // Find the row for the given timestamp
+    size_t rowIndex = findRow(timestamp);
+    if (rowIndex == npos) {
+        // Timestamp not found
+        return false;
+    }
+
+    trackRowRemoval(rowIndex, rowIndex == 0);
+    // Move the subsequent rows one row up and clear the freed last row
+    shiftRows(rowIndex + 1, numRows, -1);
+    clearRow(numRows - 1);
+    counters[physicalRow(numRows - 1)] = 0;
+    --numRows;
+    if (rowIndex < zeroPrefix) {
+        --zeroPrefix;
+    } else if (rowIndex == zeroPrefix) {
+        // The first counted row is gone
+        extendZeroPrefix();
+    }
+
+    return true;
+}
+
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::addOrUpdateRecord(long timestamp, size_t columnIndex,
+                                                       T value) {
+    bool newEntry = true;
+    if (columnIndex >= nVariables) {
+        throw std::invalid_argument("Column index out of range");
+    }
+    if (logsOperations()) {
+        logOperation(WriteAheadOp::AddOrUpdate, columnIndex, timestamp, encodeLoggedValue(value));
+    }
+
+    WriteSection section(*this);
+    size_t rowIndex = findRow(timestamp);
+
+    if (rowIndex == npos && (maxStagedRows > 0 || rowsPinned()) && numRows > 0 &&
+        timestamp < rowTimestamp(numRows - 1)) {
+        // Late arrival: staged instead of shifting all the rows coming after it
+        newEntry = stageRecord(timestamp, columnIndex, value);
+        if (stagedTimestamps.size() >= maxStagedRows) {
+            mergeStagedRows();
+        }
+    } else if (rowIndex != npos) {
+        newEntry = false;
+        // Timestamp exists: update the value directly.
+        updateCell(rowIndex, columnIndex, value);
+        rowUpdateCount(rowIndex)++;
+    } else {
+        rowIndex = insertRow(timestamp);
+        trackCellWrite(columnIndex, timestamp, nullptr, value);
+        // Insert new value at the correct column
+        cell(rowIndex, columnIndex) = value;
+        markCell(rowMask(rowIndex), columnIndex);
+
+        // only increment counter if the row is within the window range
+        if (isInWindow(rowIndex)) {
+            setRowCounter(rowIndex, 1);
+        }
+
+        rowUpdateCount(rowIndex) = 1;
+    }
+
+    return newEntry;
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::addOrUpdateRecords(const long *timestamps,
+                                                          const size_t *columnIndexes,
+                                                          const T *values, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (columnIndexes[i] >= nVariables) {
+            throw std::invalid_argument("Column index out of range");
+        }
+    }
+    if (logsOperations()) {
+        // The batch then its samples, replayed as one batch
+        WriteAheadRecord *records = writeAheadLog->beginRecords(n + 1);
+        records[0] = {static_cast<uint32_t>(WriteAheadOp::AddOrUpdateBatch), 0, 0, n};
+        for (size_t i = 0; i < n; ++i) {
+            records[i + 1] = {static_cast<uint32_t>(WriteAheadOp::BatchSample),
+                              static_cast<uint32_t>(columnIndexes[i]), timestamps[i],
+                              encodeLoggedValue(values[i])};
+        }
+        writeAheadLog->commitRecords();
+    }
+
+    // Group the samples by timestamp, keeping their order within a timestamp
+    // so that the last value written to a cell wins
+    std::vector<size_t> order;
+    bool sorted = std::is_sorted(timestamps, timestamps + n);
+    if (!sorted) {
+        order.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [timestamps](size_t a, size_t b) {
+            return timestamps[a] < timestamps[b];
+        });
+    }
+
+    WriteSection section(*this);
+    size_t newRows = 0;
+    size_t begin = 0;
+    while (begin < n) {
+        long timestamp = timestamps[sorted ? begin : order[begin]];
+        size_t end = begin + 1;
+        while (end < n && timestamps[sorted ? end : order[end]] == timestamp) {
+            ++end;
+        }
+
+        size_t rowIndex = findRow(timestamp);
+        bool newRow = false;
+        if (rowIndex == npos && numRows > 0 && timestamp < rowTimestamp(numRows - 1)) {
+            // Late rows are staged and merged all at once after the batch
+            for (size_t i = begin; i < end; ++i) {
+                size_t sample = sorted ? i : order[i];
+                newRow |= stageRecord(timestamp, columnIndexes[sample], values[sample]);
+            }
+        } else {
+            if (rowIndex == npos) {
+                rowIndex = insertRow(timestamp);
+                newRow = true;
+            }
+            for (size_t i = begin; i < end; ++i) {
+                size_t sample = sorted ? i : order[i];
+                updateCell(rowIndex, columnIndexes[sample], values[sample]);
+            }
+            rowUpdateCount(rowIndex) += end - begin;
+        }
+
+        if (newRow) {
+            ++newRows;
+        }
+        begin = end;
+    }
+
+    if (stagedTimestamps.size() >= maxStagedRows) {
+        mergeStagedRows();
+    }
+    return newRows;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::print() {
+    mergeStagedRows();
+    // Debug method to print the contents of the buffer
+    for (size_t row = 0; row < numRows; ++row) {
+        std::cout << rowTimestamp(row) << ": ";
+
+        for (size_t i = 0; i < nVariables; ++i) {
+            std::cout << cell(row, i) << ", ";
+        }
+
+        std::cout << std::endl;
+    }
+}
+
+template <typename T, typename Missing>
+std::vector<T> BasicDynamicBuffer<T, Missing>::getRecordByTimestamp(long timestamp) {
+    mergeStagedRows();
+    size_t rowIndex = findRow(timestamp);
+    if (rowIndex == npos) {
+        throw std::invalid_argument("Timestamp not found");
+    }
+    std::vector<T> values(nVariables);
+    copyRows(rowIndex, rowIndex, values.data(), nullptr);
+    return values;
+}
+
+template <typename T, typename Missing>
+std::vector<T> BasicDynamicBuffer<T, Missing>::getRecordByIndex(size_t index) {
+    mergeStagedRows();
+    if (index >= numRows) {
+        throw std::out_of_range("Index out of range");
+    }
+    std::vector<T> values(nVariables);
+    copyRows(index, index, values.data(), nullptr);
+    return values;
+}
+
+template <typename T, typename Missing>
+const T *BasicDynamicBuffer<T, Missing>::getRecordByTimestampPtr(long timestamp,
+                                                                 size_t &outSize) {
+    mergeStagedRows();
+    size_t rowIndex = findRow(timestamp);
+    if (rowIndex != npos) {
+        outSize = nVariables;
+        if (dataLayout == DataLayout::ColumnMajor) {
+            gatheredRows.resize(nVariables);
+            copyRows(rowIndex, rowIndex, gatheredRows.data(), nullptr);
+            return gatheredRows.data();
+        }
+        return rowData(rowIndex);
+    }
+    outSize = 0;
+    return nullptr;
+}
+
+template <typename T, typename Missing>
+const T *BasicDynamicBuffer<T, Missing>::getRecordByIndexPtr(size_t index) {
+    mergeStagedRows();
+    if (index < bufferRows) {
+        if (dataLayout == DataLayout::ColumnMajor) {
+            gatheredRows.resize(nVariables);
+            copyRows(index, index, gatheredRows.data(), nullptr);
+            return gatheredRows.data();
+        }
+        return rowData(index);
+    }
+
+    return nullptr;
+}
+
+template <typename T, typename Missing>
+const T *BasicDynamicBuffer<T, Missing>::getSlice(long timestamp, size_t N,
+                                                  size_t &outSize) {
+    BasicSliceView<T> view = getSliceView(timestamp, N);
+    if (view.first != nullptr && view.second == nullptr) {
+        // Size of the slice in terms of number of doubles
+        outSize = view.firstSize;
+        return view.first;
+    }
+    outSize = 0;
+    return nullptr; // Return nullptr if the request cannot be fulfilled
+}
+
+template <typename T, typename Missing>
+BasicSliceView<T> BasicDynamicBuffer<T, Missing>::getSliceView(long timestamp, size_t N) {
+    mergeStagedRows();
+    size_t targetRow = findRow(timestamp);
+    if (targetRow == npos || N == 0) {
+        return BasicSliceView<T>();
+    }
+    // The slice ends at the requested timestamp and holds at most N rows
+    size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+    return sliceRows(startRow, targetRow);
+}
+
+template <typename T, typename Missing>
+BasicSliceView<T> BasicDynamicBuffer<T, Missing>::getSliceViewSince(long timestamp, long span) {
+    mergeStagedRows();
+    if (span <= 0) {
+        return BasicSliceView<T>();
+    }
+    // Both ends are found by binary search, (timestamp - span, timestamp]
+    size_t endRow = lowerBoundRow(timestamp + 1);
+    size_t startRow = lowerBoundRow(timestamp - span + 1);
+    if (startRow >= endRow) {
+        return BasicSliceView<T>();
+    }
+    return sliceRows(startRow, endRow - 1);
+}
+
+template <typename T, typename Missing>
+const T *BasicDynamicBuffer<T, Missing>::getSliceSince(long timestamp, long span,
+                                                       size_t &outSize) {
+    BasicSliceView<T> view = getSliceViewSince(timestamp, span);
+    if (view.first != nullptr && view.second == nullptr) {
+        outSize = view.firstSize;
+        return view.first;
+    }
+    outSize = 0;
+    return nullptr;
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::aggregate(long timestamp, size_t N, Aggregate op,
+                                                 double *out) {
+    mergeStagedRows();
+    size_t targetRow = findRow(timestamp);
+    if (targetRow == npos || N == 0) {
+        return 0;
+    }
+    size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+    aggregateRows(startRow, targetRow, op, out);
+    return targetRow + 1 - startRow;
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::aggregateSince(long timestamp, long span, Aggregate op,
+                                                      double *out) {
+    mergeStagedRows();
+    size_t endRow = span > 0 ? lowerBoundRow(timestamp + 1) : 0;
+    size_t startRow = span > 0 ? lowerBoundRow(timestamp - span + 1) : 0;
+    if (startRow >= endRow) {
+        bool additive = op == Aggregate::Sum || op == Aggregate::Count;
+        std::fill(out, out + nVariables,
+                  additive ? 0.0 : std::numeric_limits<double>::quiet_NaN());
+        return 0;
+    }
+    aggregateRows(startRow, endRow - 1, op, out);
+    return endRow - startRow;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::aggregateRows(size_t startRow, size_t targetRow,
+                                                   Aggregate op, double *out) {
+    aggregateScratch.resize(4 * nVariables);
+    double *count = aggregateScratch.data();
+    double *sum = count + nVariables;
+    double *min = sum + nVariables;
+    double *max = min + nVariables;
+    std::fill(count, min, 0.0);
+    std::fill(min, max, std::numeric_limits<double>::infinity());
+    std::fill(max, max + nVariables, -std::numeric_limits<double>::infinity());
+
+    // The window is made of at most two runs of physical rows
+    size_t start = physicalRow(startRow);
+    size_t rows = targetRow + 1 - startRow;
+    size_t firstRows = std::min(rows, bufferRows - start);
+    const size_t runs[2][2] = {{start, firstRows}, {0, rows - firstRows}};
+    auto forEachRun = [&](auto &&kernel) {
+        for (const auto &run: runs) {
+            if (run[1] == 0) {
+                continue;
+            }
+            if (dataLayout == DataLayout::RowMajor) {
+                kernel(&data[run[0] * nVariables], run[1], nVariables, nVariables, 0);
+            } else {
+                // Each column is a contiguous run of values
+                for (size_t column = 0; column < nVariables; ++column) {
+                    kernel(&data[column * columnStride + run[0]], run[1], 1, 1, column);
+                }
+            }
+        }
+    };
+    forEachRun([&](const T *values, size_t nRows, size_t stride, size_t nColumns, size_t column) {
+        accumulateMoments<T, Missing>(values, nRows, stride, nColumns, count + column,
+                                      sum + column, min + column, max + column);
+    });
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    if (op == Aggregate::Std) {
+        // Second pass over the squared deviations, the means replace the
+        // minimums and their sums the maximums
+        for (size_t column = 0; column < nVariables; ++column) {
+            min[column] = count[column] > 0 ? sum[column] / count[column] : 0.0;
+            max[column] = 0.0;
+        }
+        forEachRun([&](const T *values, size_t nRows, size_t stride, size_t nColumns,
+                       size_t column) {
+            accumulateSquares<T, Missing>(values, nRows, stride, nColumns, min + column,
+                                          max + column);
+        });
+    }
+    for (size_t column = 0; column < nVariables; ++column) {
+        bool empty = count[column] == 0;
+        switch (op) {
+            case Aggregate::Sum:
+                out[column] = sum[column];
+                break;
+            case Aggregate::Mean:
+                out[column] = empty ? nan : sum[column] / count[column];
+                break;
+            case Aggregate::Min:
+                out[column] = empty ? nan : min[column];
+                break;
+            case Aggregate::Max:
+                out[column] = empty ? nan : max[column];
+                break;
+            case Aggregate::Std:
+                out[column] = empty ? nan : std::sqrt(max[column] / count[column]);
+                break;
+            case Aggregate::Count:
+                out[column] = count[column];
+                break;
+        }
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::resample(long start, long step, size_t count,
+                                              ResampleMethod method, double *out) {
+    if (step <= 0) {
+        throw std::invalid_argument("Resampling step must be positive");
+    }
+    mergeStagedRows();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    std::fill(out, out + count * nVariables, nan);
+    if (count == 0 || numRows == 0) {
+        return;
+    }
+    auto gridTime = [start, step](size_t point) { return start + static_cast<long>(point) * step; };
+    auto value = [this](size_t row, size_t column, double &x) {
+        if (!isMarked(rowMask(row), column)) {
+            return false;
+        }
+        T v = cell(row, column);
+        x = static_cast<double>(v);
+        return isValue(v);
+    };
+    size_t firstRow = lowerBoundRow(start);
+    long end = gridTime(count);
+
+    if (method == ResampleMethod::BucketMean || method == ResampleMethod::BucketLast) {
+        // Sums of the buckets are kept in out, their counts aside
+        aggregateScratch.assign(method == ResampleMethod::BucketMean ? count * nVariables : 0, 0.0);
+        for (size_t row = firstRow; row < numRows && rowTimestamp(row) < end; ++row) {
+            size_t bucket = static_cast<size_t>((rowTimestamp(row) - start) / step);
+            double *bucketValues = out + bucket * nVariables;
+            for (size_t column = 0; column < nVariables; ++column) {
+                double x;
+                if (!value(row, column, x)) {
+                    continue;
+                }
+                if (method == ResampleMethod::BucketLast) {
+                    bucketValues[column] = x;
+                } else {
+                    double &n = aggregateScratch[bucket * nVariables + column];
+                    bucketValues[column] = (n == 0) ? x : bucketValues[column] + x;
+                    n += 1;
+                }
+            }
+        }
+        if (method == ResampleMethod::BucketMean) {
+            for (size_t i = 0; i < count * nVariables; ++i) {
+                if (aggregateScratch[i] > 0) {
+                    out[i] /= aggregateScratch[i];
+                }
+            }
+        }
+        return;
+    }
+
+    // Last value of each variable (its row and value) at or before the current
+    // row, and for the interpolation the first grid point waiting for the
+    // next value. Kept in the scratch buffer as rows, values, pending points,
+    // rows and points being exact in a double.
+    aggregateScratch.assign(3 * nVariables, nan);
+    double *previousRow = aggregateScratch.data();
+    double *previousValue = previousRow + nVariables;
+    double *pending = previousValue + nVariables;
+    std::fill(pending, pending + nVariables, 0.0);
+    auto previousTimestamp = [&](size_t column) {
+        return rowTimestamp(static_cast<size_t>(previousRow[column]));
+    };
+    // Seeded with the last value of each variable before the grid
+    size_t seeded = 0;
+    for (size_t row = firstRow; row > 0 && seeded < nVariables; --row) {
+        for (size_t column = 0; column < nVariables; ++column) {
+            double x;
+            if (std::isnan(previousRow[column]) && value(row - 1, column, x)) {
+                previousRow[column] = static_cast<double>(row - 1);
+                previousValue[column] = x;
+                ++seeded;
+            }
+        }
+    }
+
+    size_t point = 0;
+    size_t resolved = 0; // Variables without any grid point waiting
+    for (size_t row = firstRow; row < numRows; ++row) {
+        long timestamp = rowTimestamp(row);
+        // The grid points before this row are final for the previous values
+        for (; point < count && gridTime(point) < timestamp; ++point) {
+            if (method == ResampleMethod::Previous) {
+                std::copy(previousValue, previousValue + nVariables, out + point * nVariables);
+            }
+        }
+        if (point == count && (method == ResampleMethod::Previous || resolved == nVariables)) {
+            break;
+        }
+        for (size_t column = 0; column < nVariables; ++column) {
+            double x;
+            if (!value(row, column, x)) {
+                continue;
+            }
+            if (method == ResampleMethod::Linear) {
+                size_t first = static_cast<size_t>(pending[column]);
+                if (!std::isnan(previousRow[column])) {
+                    long from = previousTimestamp(column);
+                    double span = static_cast<double>(timestamp - from);
+                    for (size_t waiting = first; waiting < point; ++waiting) {
+                        double fraction = static_cast<double>(gridTime(waiting) - from) / span;
+                        out[waiting * nVariables + column] =
+                                previousValue[column] + fraction * (x - previousValue[column]);
+                    }
+                }
+                pending[column] = static_cast<double>(point);
+                if (point == count && first < count) {
+                    ++resolved;
+                }
+            }
+            previousRow[column] = static_cast<double>(row);
+            previousValue[column] = x;
+        }
+    }
+
+    for (size_t column = 0; column < nVariables; ++column) {
+        size_t first = method == ResampleMethod::Previous ? point : static_cast<size_t>(pending[column]);
+        for (size_t waiting = first; waiting < count; ++waiting) {
+            if (method == ResampleMethod::Previous) {
+                out[waiting * nVariables + column] = previousValue[column];
+            } else if (!std::isnan(previousRow[column]) &&
+                       gridTime(waiting) == previousTimestamp(column)) {
+                // No later value, only a grid point on the last value has one
+                out[waiting * nVariables + column] = previousValue[column];
+            }
+        }
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::enableRollingStatistics() {
+    WriteSection section(*this);
+    rollingStatistics = true;
+    statistics.assign(nVariables, ColumnStatistics());
+    for (size_t row = 0; row < numRows; ++row) {
+        trackRowInsertion(row);
+    }
+    for (size_t staged = 0; staged < stagedTimestamps.size(); ++staged) {
+        for (size_t column = 0; column < nVariables; ++column) {
+            if (isMarked(&stagedValidity[staged * maskWords], column)) {
+                updateStatistics(column, stagedTimestamps[staged], nullptr,
+                                 stagedData[staged * nVariables + column]);
+            }
+        }
+    }
+}
+
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::isRollingStatisticsEnabled() const { return rollingStatistics; }
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::getRollingStatistics(Aggregate op, double *out) {
+    if (!rollingStatistics) {
+        throw std::logic_error("Rolling statistics are not enabled");
+    }
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (size_t column = 0; column < nVariables; ++column) {
+        ColumnStatistics &stats = statistics[column];
+        if ((op == Aggregate::Min || op == Aggregate::Max) && stats.extremaStale) {
+            rebuildExtrema(stats, column);
+        }
+        bool empty = stats.count == 0;
+        switch (op) {
+            case Aggregate::Sum:
+                out[column] = stats.sum;
+                break;
+            case Aggregate::Mean:
+                out[column] = empty ? nan : stats.mean;
+                break;
+            case Aggregate::Min:
+                out[column] = empty ? nan : stats.minimums.front().second;
+                break;
+            case Aggregate::Max:
+                out[column] = empty ? nan : stats.maximums.front().second;
+                break;
+            case Aggregate::Std:
+                out[column] = empty ? nan : std::sqrt(stats.m2 / stats.count);
+                break;
+            case Aggregate::Count:
+                out[column] = stats.count;
+                break;
+        }
+    }
+}
 
-nVariables (nVariables), windowSize(windowSize),
-bufferLength(DEFAULT_BUFFER_LENGTH_FACTOR * windowSize * nVariables),
-data(bufferLength, std::nan("")),
-counters((DEFAULT_BUFFER_LENGTH_FACTOR * windowSize), 0) {
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::updateStatistics(size_t column, long timestamp,
+                                                      const T *previous, T value) {
+    ColumnStatistics &stats = statistics[column];
+    if (previous != nullptr && isValue(*previous)) {
+        stats.remove(static_cast<double>(*previous));
+    }
+    bool present = isValue(value);
+    if (present) {
+        stats.add(static_cast<double>(value));
+    }
+    if (!stats.extremaStale) {
+        double x = static_cast<double>(value);
+        stats.extremaStale =
+                !writeCandidate(stats.minimums, timestamp, present, x, std::less<double>()) ||
+                !writeCandidate(stats.maximums, timestamp, present, x, std::greater<double>());
+    }
 }
 
-bool DynamicBuffer::deleteRecord(long timestamp) {
-    // Find the index for the given timestamp
-    auto it = indexes.find(timestamp);
-    if (it == indexes.end()) {
-        // Timestamp not found
-        return false;
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::trackRowInsertion(size_t row) {
+    if (!rollingStatistics) {
+        return;
     }
+    const uint64_t *mask = rowMask(row);
+    for (size_t column = 0; column < nVariables; ++column) {
+        if (isMarked(mask, column)) {
+            updateStatistics(column, rowTimestamp(row), nullptr, cell(row, column));
+        }
+    }
+}
 
-    size_t startIndex = it->second;
-    size_t endIndex = startIndex + nVariables;
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::trackRowRemoval(size_t row, bool oldest) {
+    if (!rollingStatistics) {
+        return;
+    }
+    const uint64_t *mask = rowMask(row);
+    long timestamp = rowTimestamp(row);
+    for (size_t column = 0; column < nVariables; ++column) {
+        ColumnStatistics &stats = statistics[column];
+        T value = cell(row, column);
+        if (!isMarked(mask, column) || !isValue(value)) {
+            continue;
+        }
+        stats.remove(static_cast<double>(value));
+        if (!stats.extremaStale) {
+            stats.extremaStale = !removeCandidate(stats.minimums, timestamp, oldest) ||
+                                 !removeCandidate(stats.maximums, timestamp, oldest);
+        }
+    }
+}
 
-    // Erase the nVariables from data starting from startIndex
-    data.erase(data.begin() + startIndex, data.begin() + endIndex);
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::rebuildExtrema(ColumnStatistics &stats, size_t columnIndex) {
+    stats.minimums.clear();
+    stats.maximums.clear();
+    auto insert = [&stats](long timestamp, T value) {
+        if (isValue(value)) {
+            double x = static_cast<double>(value);
+            insertCandidate(stats.minimums, timestamp, x, std::less<double>());
+            insertCandidate(stats.maximums, timestamp, x, std::greater<double>());
+        }
+    };
+    for (size_t row = 0; row < numRows; ++row) {
+        if (isMarked(rowMask(row), columnIndex)) {
+            insert(rowTimestamp(row), cell(row, columnIndex));
+        }
+    }
+    // The staged rows are inserted out of order, which the deques support
+    for (size_t staged = 0; staged < stagedTimestamps.size(); ++staged) {
+        if (isMarked(&stagedValidity[staged * maskWords], columnIndex)) {
+            insert(stagedTimestamps[staged], stagedData[staged * nVariables + columnIndex]);
+        }
+    }
+    stats.extremaStale = false;
+}
 
-    // Remove the timestamp entry from indexes
-    indexes.erase(it);
+template <typename T, typename Missing>
+BasicSliceView<T> BasicDynamicBuffer<T, Missing>::sliceRows(size_t startRow, size_t targetRow) {
+    if (dataLayout == DataLayout::ColumnMajor) {
+        size_t count = targetRow + 1 - startRow;
+        gatheredRows.resize(count * nVariables);
+        gatheredTimestamps.resize(count);
+        copyRows(startRow, targetRow, gatheredRows.data(), gatheredTimestamps.data());
+        BasicSliceView<T> view;
+        view.first = gatheredRows.data();
+        view.firstSize = gatheredRows.size();
+        view.firstTimestamps = gatheredTimestamps.data();
+        return view;
+    }
+    return rowsView(startRow, targetRow);
+}
 
-    // Adjust subsequent indexes in the map
-    for (auto &entry: indexes) {
-        if (entry.second > startIndex) {
-            entry.second -= nVariables;
-        }
+template <typename T, typename Missing>
+const T *BasicDynamicBuffer<T, Missing>::getSliceWithTimestamps(long timestamp, size_t N,
+                                                                size_t &outSize,
+                                                                const long *&outTimestamps) {
+    BasicSliceView<T> view = getSliceView(timestamp, N);
+    if (view.first != nullptr && view.second == nullptr) {
+        outSize = view.firstSize;
+        outTimestamps = view.firstTimestamps;
+        return view.first;
     }
+    outSize = 0;
+    outTimestamps = nullptr;
+    return nullptr;
+}
 
-    return true;
+template <typename T, typename Missing>
+std::vector<long> BasicDynamicBuffer<T, Missing>::getSliceTimestamps(long timestamp,
+                                                                     size_t N) {
+    // Only the (at most two) segments of the slice are copied
+    BasicSliceView<T> view = getSliceView(timestamp, N);
+    std::vector<long> timestamps;
+    if (view.first != nullptr) {
+        size_t firstRows = view.firstSize / nVariables;
+        size_t secondRows = view.secondSize / nVariables;
+        timestamps.reserve(firstRows + secondRows);
+        timestamps.insert(timestamps.end(), view.firstTimestamps,
+                          view.firstTimestamps + firstRows);
+        timestamps.insert(timestamps.end(), view.secondTimestamps,
+                          view.secondTimestamps + secondRows);
+    }
+    return timestamps;
 }
 
-bool DynamicBuffer::addOrUpdateRecord(long timestamp, size_t columnIndex,
-                                      double value) {
-    bool newEntry = true;
+template <typename T, typename Missing>
+BasicSliceView<T> BasicDynamicBuffer<T, Missing>::getColumnSliceView(size_t columnIndex,
+                                                                     long timestamp, size_t N) {
     if (columnIndex >= nVariables) {
         throw std::invalid_argument("Column index out of range");
     }
+    mergeStagedRows();
+    size_t targetRow = findRow(timestamp);
+    if (dataLayout != DataLayout::ColumnMajor || targetRow == npos || N == 0) {
+        return BasicSliceView<T>();
+    }
+    size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+    size_t start = physicalRow(startRow);
+    size_t count = targetRow + 1 - startRow;
+    size_t firstCount = std::min(count, bufferRows - start);
+    const T *column = &data[columnIndex * columnStride];
+
+    BasicSliceView<T> view;
+    view.first = column + start;
+    view.firstSize = firstCount;
+    view.firstTimestamps = &rowTimestamps[start];
+    if (firstCount < count) {
+        view.second = column;
+        view.secondSize = count - firstCount;
+        view.secondTimestamps = &rowTimestamps[0];
+    }
+    return view;
+}
 
-    size_t dataIndex;
-    auto it = indexes.find(timestamp);
+template <typename T, typename Missing>
+const T *BasicDynamicBuffer<T, Missing>::getColumnSlice(size_t columnIndex, long timestamp, size_t N,
+                                                        size_t &outSize) {
+    BasicSliceView<T> view = getColumnSliceView(columnIndex, timestamp, N);
+    if (view.first != nullptr && view.second == nullptr) {
+        outSize = view.firstSize;
+        return view.first;
+    }
+    outSize = 0;
+    return nullptr;
+}
 
-    if (it != indexes.end()) {
-        newEntry = false;
-        // Timestamp exists: update the value directly.
-        dataIndex = it->second + columnIndex;
-        if (dataIndex < bufferLength) {
-            bool isNan = std::isnan(data[dataIndex]);
-            data[dataIndex] = value;
-            size_t rowIndex = dataIndex / nVariables;
-            // size_t latestIndex = indexes.rbegin()->second / nVariables;
-            // only increment counter if the row is within the window range
-            if (rowIndex > (indexes.rbegin()->second / nVariables - windowSize)) {
-                // Only increment counter if the value was NaN before, else it would mean it is an update
-                if (isNan) {
-                    counters[rowIndex]++;
-                }
-            }
-            variableUpdates[timestamp]++;
-        } else {
-            throw std::out_of_range("Attempting to write beyond the buffer length");
+namespace {
+// Arrow format string of the value type
+template <typename T>
+const char *arrowFormat();
+template <>
+const char *arrowFormat<float>() { return "f"; }
+template <>
+const char *arrowFormat<double>() { return "g"; }
+template <>
+const char *arrowFormat<int32_t>() { return "i"; }
+template <>
+const char *arrowFormat<int64_t>() { return "l"; }
+
+// Releases the lease of an exported batch, then hands over to the hook of
+// the caller
+template <typename Buffer>
+struct ArrowLease {
+    Buffer *buffer;
+    size_t generation;
+    void (*onRelease)(void *);
+    void *context;
+
+    static void release(void *lease) {
+        ArrowLease *self = static_cast<ArrowLease *>(lease);
+        self->buffer->releaseStorageLease(self->generation, true);
+        if (self->onRelease != nullptr) {
+            self->onRelease(self->context);
         }
+        delete self;
+    }
+};
+} // namespace
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::exportArrowSlice(long timestamp, size_t N, ArrowSchema *schema,
+                                                      ArrowArray *array, void (*onRelease)(void *),
+                                                      void *context) {
+    mergeStagedRows();
+    size_t targetRow = findRow(timestamp);
+    if (targetRow == npos) {
+        throw std::invalid_argument("Timestamp not found");
+    }
+    size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+    size_t count = targetRow + 1 - startRow;
+    size_t start = count > 0 ? physicalRow(startRow) : 0;
+    // Served in place only when all the columns can be: otherwise the lease
+    // would make the next write copy the whole storage for the timestamps alone
+    bool inPlace = count > 0 && start + count <= bufferRows && dataLayout == DataLayout::ColumnMajor &&
+                   sizeof(long) == sizeof(int64_t);
+    auto storage = std::make_shared<ArrowBatchStorage>();
+    std::vector<ArrowExportColumn> columns(nVariables + 1);
+
+    columns[0].format = "l";
+    columns[0].name = "timestamp";
+    columns[0].validity = nullptr;
+    columns[0].nullCount = 0;
+    if (inPlace) {
+        columns[0].values = &rowTimestamps[start];
     } else {
-        // Check if there is enough room for a new record
-        if (!hasEnoughRoomForNewRecord()) {
-            // Remove all rows with zero counters
-            removeZeroCount();
-            if (!hasEnoughRoomForNewRecord()) {
-                throw std::out_of_range("Buffer is full and can't be emptied further.");
-            }
+        int64_t *copy = storage->allocate<int64_t>(count);
+        for (size_t row = 0; row < count; ++row) {
+            copy[row] = rowTimestamp(startRow + row);
         }
+        columns[0].values = copy;
+    }
 
-        if (indexes.empty() || timestamp > indexes.rbegin()->first) {
-            dataIndex =
-                    (!indexes.empty()) ? (indexes.rbegin()->second + nVariables) : 0;
+    // Otherwise, the columns are copied in one pass over the rows
+    std::vector<T *> copies(nVariables, nullptr);
+    for (size_t column = 0; column < nVariables; ++column) {
+        if (inPlace) {
+            columns[column + 1].values = &data[column * columnStride + start];
         } else {
-            auto nextTimestampIt = indexes.upper_bound(timestamp);
-            dataIndex =
-                    (nextTimestampIt != indexes.end()) ? nextTimestampIt->second : 0;
-
-            // Shift existing data to make room for the new record
-            std::move_backward(data.begin() + dataIndex, data.end() - nVariables,
-                               data.end());
-
-            // Update indexes for all timestamps after the new one
-            for (auto iter = nextTimestampIt; iter != indexes.end(); ++iter) {
-                iter->second += nVariables;
+            copies[column] = storage->allocate<T>(count);
+            columns[column + 1].values = copies[column];
+        }
+    }
+    if (!inPlace) {
+        for (size_t row = 0; row < count; ++row) {
+            for (size_t column = 0; column < nVariables; ++column) {
+                copies[column][row] = cell(startRow + row, column);
             }
         }
-        // Insert the new value
-        std::fill_n(data.begin() + dataIndex, nVariables,
-                    std::nan("")); // Prepare space for new data
-        data[dataIndex + columnIndex] =
-                value; // Insert new value at the correct column
-
-        // Update the index for the new timestamp
-        indexes[timestamp] = dataIndex;
+    }
 
-        // Update the counters appropriately
-        size_t rowIndex = dataIndex / nVariables;
-        counters.resize(std::max(counters.size(), rowIndex + 1),
-                        0); // Ensure counters vector is large enough
-        // only increment counter if the row is within the window range
-        if (rowIndex > (indexes.rbegin()->second / nVariables - windowSize)) {
-            counters[rowIndex] = 1;
+    for (size_t column = 0; column < nVariables; ++column) {
+        ArrowExportColumn &exported = columns[column + 1];
+        exported.format = arrowFormat<T>();
+        exported.name = std::to_string(column);
+        const T *values = static_cast<const T *>(exported.values);
+        int64_t nulls = 0;
+        for (size_t row = 0; row < count; ++row) {
+            nulls += Missing::isMissing(values[row]) ? 1 : 0;
+        }
+        exported.nullCount = nulls;
+        exported.validity = nullptr;
+        if (nulls > 0) {
+            uint8_t *validity = storage->allocate<uint8_t>((count + 7) / 8);
+            for (size_t row = 0; row < count; ++row) {
+                if (!Missing::isMissing(values[row])) {
+                    validity[row / 8] |= static_cast<uint8_t>(1u << (row % 8));
+                }
+            }
+            exported.validity = validity;
         }
-
-        variableUpdates[timestamp] = 1;
     }
 
-    return newEntry;
+    if (inPlace) {
+        storage->onRelease = ArrowLease<BasicDynamicBuffer>::release;
+        storage->context = new ArrowLease<BasicDynamicBuffer>{this, acquireStorageLease(true), onRelease, context};
+    } else {
+        storage->onRelease = onRelease;
+        storage->context = context;
+    }
+    exportArrowBatch(columns, static_cast<int64_t>(count), storage, schema, array);
 }
 
-void DynamicBuffer::print() const {
-    // Debug method to print the contents of the buffer
-    for (const auto &pair: indexes) {
-        long timestamp = pair.first;
-        size_t startIndex = pair.second;
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getNVariables() const { return nVariables; }
 
-        std::cout << timestamp << ": ";
+template <typename T, typename Missing>
+StorageMode BasicDynamicBuffer<T, Missing>::getStorageMode() const { return storageMode; }
 
-        for (size_t i = 0; i < nVariables; ++i) {
-            if (startIndex + i < data.size()) {
-                std::cout << data[startIndex + i] << ", ";
-            }
+template <typename T, typename Missing>
+DataLayout BasicDynamicBuffer<T, Missing>::getDataLayout() const { return dataLayout; }
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::removeFront(size_t removeCount) {
+    if (logsOperations()) {
+        logOperation(WriteAheadOp::RemoveFront, 0, 0, removeCount);
+    }
+    WriteSection section(*this);
+    waitForUnpinnedRows();
+    flushStagedRows();
+    detachLeasedStorage();
+    removeCount = std::min(removeCount, numRows);
+    size_t remainingRows = numRows - removeCount;
+    if (rollingStatistics) {
+        for (size_t row = 0; row < removeCount; ++row) {
+            trackRowRemoval(row, true);
         }
+    }
 
-        std::cout << std::endl;
+    if (storageMode == StorageMode::Circular) {
+        // Clear the evicted rows and advance the head past them
+        for (size_t row = 0; row < removeCount; ++row) {
+            clearRow(row);
+            counters[physicalRow(row)] = 0;
+        }
+        headRow = (remainingRows == 0) ? 0 : physicalRow(removeCount);
+    } else {
+        // Move the remaining rows to the beginning and fill the freed rows with missing values
+        shiftRows(removeCount, numRows, -static_cast<std::ptrdiff_t>(removeCount));
+        for (size_t row = remainingRows; row < numRows; ++row) {
+            clearRow(row);
+        }
+        std::fill(counters.begin() + remainingRows, counters.begin() + numRows, 0);
     }
+
+    numRows = remainingRows;
+    zeroPrefix = (removeCount <= zeroPrefix) ? zeroPrefix - removeCount : 0;
+    extendZeroPrefix();
 }
 
-std::vector<double> DynamicBuffer::getRecordByTimestamp(long timestamp) const {
-    auto it = indexes.find(timestamp);
-    if (it == indexes.end()) {
-        throw std::invalid_argument("Timestamp not found");
+template <typename T, typename Missing>
+long BasicDynamicBuffer<T, Missing>::minKey() const {
+    if (numRows == 0) {
+        std::cerr << "Error: No data available." << std::endl;
+        return -1;
     }
-    auto index = it->second;
-    return std::vector<double>(data.begin() + index,
-                               data.begin() + index + nVariables);
+    // Staged late arrivals may be older than the oldest row
+    if (!stagedTimestamps.empty()) {
+        return std::min(stagedTimestamps.front(), rowTimestamp(0));
+    }
+    return rowTimestamp(0);
 }
 
-std::vector<double> DynamicBuffer::getRecordByIndex(size_t
-index) const {
-if (index >= indexes.
-
-size()
-
-) {
-throw std::out_of_range("Index out of range");
+template <typename T, typename Missing>
+long BasicDynamicBuffer<T, Missing>::maxKey() const {
+    if (numRows == 0) {
+        std::cerr << "Error: No data available." << std::endl;
+        return -1;
+    }
+    return rowTimestamp(numRows - 1);
 }
-return
-std::vector<double>(data
-.
 
-begin()
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getNumRows() const { return numRows + stagedTimestamps.size(); }
 
-+ index,
-data.
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getCapacity() const { return bufferRows; }
 
-begin()
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getMaxRows() const { return maxRows; }
 
-+ index + nVariables);
-}
+template <typename T, typename Missing>
+long BasicDynamicBuffer<T, Missing>::getRetentionSpan() const { return policy.retentionSpan; }
 
-const double *DynamicBuffer::getRecordByTimestampPtr(long timestamp,
-                                                     size_t &outSize) const {
-    auto it = indexes.find(timestamp);
-    if (it != indexes.end()) {
-        size_t startIndex = it->second;
-        // Ensure it doesn't exceed the data vector size
-        if (startIndex + nVariables <= data.size()) {
-            outSize = nVariables;
-            return &data[startIndex];
-        }
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::shrinkToFit() {
+    if (concurrentAccess) {
+        // Readers may be copying from the storage
+        return;
     }
-    outSize = 0;
-    return nullptr;
+    WriteSection section(*this);
+    flushStagedRows();
+    if (numRows < bufferRows) {
+        reallocateStorage(numRows);
+    }
+    // The scratch buffers are reallocated on demand
+    std::vector<T>().swap(gatheredRows);
+    std::vector<long>().swap(gatheredTimestamps);
+    std::vector<long>().swap(stagedTimestamps);
+    std::vector<T>().swap(stagedData);
+    std::vector<uint64_t>().swap(stagedValidity);
+    std::vector<size_t>().swap(stagedUpdateCounts);
+}
+
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::hasEnoughRoomForNewRecord() {
+    if (numRows + stagedTimestamps.size() < maxRows)
+        return true;
+
+    return false;
 }
 
-const double *DynamicBuffer::getRecordByIndexPtr(size_t
-index) const {
-size_t startIndex = index * nVariables;
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::removeZeroCount() {
+    if (logsOperations()) {
+        logOperation(WriteAheadOp::RemoveZeroCount, 0, 0, 0);
+    }
+    WriteSection section(*this);
+    flushStagedRows();
+    size_t nZeros = std::max(countSubsequentZerosCounters(), expiredRows());
+    // Keep at least minRetainedRows rows
+    nZeros = std::min(nZeros, numRows > policy.minRetainedRows ? numRows - policy.minRetainedRows : 0);
 
-if (index < (
-windowSize *DEFAULT_BUFFER_LENGTH_FACTOR
-) &&
-startIndex + nVariables <= data.
+    if (nZeros > 0) {
+        removeFront(nZeros);
+    }
+}
 
-size()
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::countSubsequentZerosCounters() { return zeroPrefix; }
 
-) {
-return &data[startIndex];
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::expiredRows() const {
+    if (policy.retentionSpan == 0 || numRows == 0) {
+        return 0;
+    }
+    // The rows up to maxKey() - retentionSpan, whatever their counter
+    return lowerBoundRow(rowTimestamp(numRows - 1) - policy.retentionSpan + 1);
 }
 
-return
-nullptr;
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::setRowCounter(size_t row, int value) {
+    counters[physicalRow(row)] = value;
+    if (value > 0 && row < zeroPrefix) {
+        zeroPrefix = row;
+    } else if (value == 0 && row == zeroPrefix) {
+        extendZeroPrefix();
+    }
 }
 
-const double *DynamicBuffer::getSlice(long timestamp, size_t N,
-                                      size_t &outSize) const {
-    auto it = indexes.find(timestamp);
-    if (it != indexes.end()) {
-        size_t targetIndex = it->second;
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::incrementRowCounter(size_t row) {
+    if (counters[physicalRow(row)]++ == 0 && row < zeroPrefix) {
+        zeroPrefix = row;
+    }
+}
 
-        size_t startIndex = (N > (targetIndex / nVariables + 1))
-                            ? 0
-                            : targetIndex - (N - 1) * nVariables;
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::decrementRowCounter(size_t row) {
+    int &counter = counters[physicalRow(row)];
+    if (counter > 0 && --counter == 0 && row == zeroPrefix) {
+        extendZeroPrefix();
+    }
+}
 
-        // Calculate the size of the slice in terms of number of doubles
-        outSize = std::min(data.size() - startIndex, N * nVariables);
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::extendZeroPrefix() {
+    while (zeroPrefix < numRows && counters[physicalRow(zeroPrefix)] == 0) {
+        ++zeroPrefix;
+    }
+}
 
-        // Check if the calculated slice exceeds the bounds of the data vector
-        if (startIndex + outSize <= data.size()) {
-            return &data[startIndex];
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::decrementCounters(const std::vector<long> &timestamps) {
+    if (std::is_sorted(timestamps.begin(), timestamps.end())) {
+        decrementCounters(timestamps.data(), timestamps.size());
+        return;
+    }
+    if (logsOperations()) {
+        logDecrementCounters(timestamps.data(), timestamps.size());
+    }
+    WriteSection section(*this);
+    flushStagedRows();
+    for (long timestamp: timestamps) {
+        size_t counterIndex = findRow(timestamp);
+        if (counterIndex != npos) {
+            decrementRowCounter(counterIndex);
         }
     }
-    outSize = 0;
-    return nullptr; // Return nullptr if the request cannot be fulfilled
 }
 
-std::vector<long> DynamicBuffer::getSliceTimestamps(long timestamp,
-                                                    size_t N) const {
-    std::vector<long> timestamps;
-    auto it = indexes.find(timestamp);
-    if (it != indexes.end()) {
-        size_t targetIndex = it->second;
-        size_t startIndex = (N > (targetIndex / nVariables + 1))
-                            ? 0
-                            : targetIndex - (N - 1) * nVariables;
-        size_t endIndex = std::min(startIndex + N * nVariables, data.size());
-
-        for (auto &pair: indexes) {
-            if (pair.second >= startIndex && pair.second < endIndex) {
-                timestamps.push_back(pair.first);
-            }
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::decrementCounters(const long *timestamps, size_t n) {
+    if (!std::is_sorted(timestamps, timestamps + n)) {
+        throw std::invalid_argument("Timestamps must be sorted");
+    }
+    if (logsOperations()) {
+        logDecrementCounters(timestamps, n);
+    }
+    WriteSection section(*this);
+    flushStagedRows();
+    size_t row = 0;
+    for (size_t i = 0; i < n; ++i) {
+        // Acknowledged rows are mostly neighbours: walk a few rows forward
+        // before falling back to a binary search
+        for (size_t step = 0; step < 8 && row < numRows && rowTimestamp(row) < timestamps[i]; ++step) {
+            ++row;
+        }
+        if (row < numRows && rowTimestamp(row) < timestamps[i]) {
+            row = lowerBoundRow(timestamps[i]);
+        }
+        if (row == numRows) {
+            break;
+        }
+        if (rowTimestamp(row) == timestamps[i]) {
+            decrementRowCounter(row);
         }
     }
-    return timestamps;
 }
 
-size_t DynamicBuffer::getNVariables() const { return nVariables; }
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::setEvictionHighWaterMark(size_t rows) {
+    if (rows == 0 || rows > maxRows) {
+        throw std::invalid_argument("High-water mark out of range");
+    }
+    evictionHighWaterMark = rows;
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getEvictionHighWaterMark() const { return evictionHighWaterMark; }
 
-void DynamicBuffer::removeFront(size_t
-removeCount) {
-size_t originalSize = data.size();
-size_t elementsToRemove = removeCount * nVariables;
-if (removeCount >= originalSize) {
-// Clear the vector if removing more or equal elements than contained
-data.
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::printCounters() {
+    std::cout << "Counters: ";
+    for (auto value: getCounters()) {
+        std::cout << value << " ";
+    }
+    std::cout << std::endl;
+}
 
-clear();
+template <typename T, typename Missing>
+std::vector<int> BasicDynamicBuffer<T, Missing>::getCounters() {
+    mergeStagedRows();
+    // Counters ordered from the oldest row, whatever the storage mode
+    std::vector<int> orderedCounters(counters.size());
+    for (size_t row = 0; row < bufferRows; ++row) {
+        orderedCounters[row] = counters[physicalRow(row)];
+    }
+    return orderedCounters;
+}
 
-counters.
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::printIndexes() const {
+    std::cout << "Indexes: ";
+    for (size_t row = 0; row < numRows; ++row) {
+        std::cout << rowTimestamp(row) << " : " << physicalRow(row) * nVariables << " | ";
+    }
+    std::cout << std::endl;
+}
 
-clear();
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::printData() const {
+    std::cout << "Data: [";
+    for (auto value: data) {
+        std::cout << value << " ";
+    }
+    std::cout << "]" << std::endl;
+}
 
-// Fill the entire vector with NaN, maintaining original size
-data.
-resize(originalSize, std::nan("")
-);
-counters.
-resize((DEFAULT_BUFFER_LENGTH_FACTOR
-* windowSize), 0);
-// Clear indexes map as all elements are removed
-indexes.
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getVariableUpdateCount(long timestamp) {
+    mergeStagedRows();
+    size_t rowIndex = findRow(timestamp);
+    return (rowIndex != npos) ? rowUpdateCount(rowIndex) : 0;
+}
 
-clear();
+template <typename T, typename Missing>
+const uint64_t *BasicDynamicBuffer<T, Missing>::getRowFillMask(long timestamp, size_t &outWords) {
+    mergeStagedRows();
+    size_t rowIndex = findRow(timestamp);
+    if (rowIndex == npos) {
+        outWords = 0;
+        return nullptr;
+    }
+    outWords = maskWords;
+    return rowMask(rowIndex);
+}
 
-variableUpdates.
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getRowFillCount(long timestamp) {
+    size_t words = 0;
+    const uint64_t *mask = getRowFillMask(timestamp, words);
+    return (mask != nullptr) ? fillCount(mask) : 0;
+}
 
-clear();
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getFullRowFlags(long timestamp, size_t N, uint8_t *outFlags) {
+    mergeStagedRows();
+    size_t targetRow = findRow(timestamp);
+    if (targetRow == npos || N == 0) {
+        return 0;
+    }
+    size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+    scanFullRows(startRow, targetRow, outFlags);
+    return targetRow + 1 - startRow;
+}
 
-} else {
-// Move the remaining elements to the beginning
-std::move(data
-.
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::countFullRows(long timestamp, size_t N) {
+    mergeStagedRows();
+    size_t targetRow = findRow(timestamp);
+    if (targetRow == npos || N == 0) {
+        return 0;
+    }
+    size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+    return scanFullRows(startRow, targetRow, nullptr);
+}
 
-begin()
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::enableConcurrentAccess() {
+    // The storage must not move under the readers
+    reserveRows(maxRows);
+    concurrentAccess = true;
+}
 
-+ elementsToRemove, data.
+template <typename T, typename Missing>
+bool BasicDynamicBuffer<T, Missing>::isConcurrentAccessEnabled() const { return concurrentAccess; }
 
-end(), data
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::copySlice(long timestamp, size_t N, T *out,
+                                                 long *outTimestamps) const {
+    return copySliceRows(timestamp, true, N, out, outTimestamps);
+}
 
-.
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::copySliceUpTo(long timestamp, size_t N, T *out,
+                                                     long *outTimestamps) const {
+    return copySliceRows(timestamp, false, N, out, outTimestamps);
+}
 
-begin()
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::copySliceRows(long timestamp, bool exact, size_t N, T *out,
+                                                     long *outTimestamps) const {
+    while (true) {
+        uint64_t before = sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            // The writer is modifying the buffer
+            std::this_thread::yield();
+            continue;
+        }
 
-);
-// Resize the vector down, then back up to original size, filling with NaNs
-data.
-resize(originalSize
-- elementsToRemove);
-std::fill_n(std::back_inserter(data), elementsToRemove, std::nan("")
-);
+        size_t copiedRows = 0;
+        size_t targetRow = npos;
+        if (exact) {
+            targetRow = findRow(timestamp);
+        } else {
+            size_t row = lowerBoundRow(timestamp);
+            if (row < numRows && rowTimestamp(row) == timestamp) {
+                targetRow = row;
+            } else if (row > 0) {
+                targetRow = row - 1;
+            }
+        }
+        if (targetRow != npos && N > 0) {
+            size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+            copiedRows = targetRow + 1 - startRow;
+            copyRows(startRow, targetRow, out, outTimestamps);
+        }
 
-std::move(counters
-.
+        // The copy is only consistent if no write section started meanwhile
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == before) {
+            return copiedRows;
+        }
+    }
+}
 
-begin()
+template <typename T, typename Missing>
+BasicSliceView<T> BasicDynamicBuffer<T, Missing>::pinSlice(long timestamp, size_t N) const {
+    if (dataLayout != DataLayout::RowMajor) {
+        throw std::invalid_argument("Pinned slices need a row-major layout");
+    }
+    while (true) {
+        // Pin first: a writer entering a section afterwards sees the pin,
+        // one that entered it before is seen through the sequence
+        activePins.fetch_add(1);
+        uint64_t before = sequence.load();
+        if ((before & 1) == 0) {
+            BasicSliceView<T> view;
+            size_t targetRow = findRow(timestamp);
+            if (targetRow != npos && N > 0) {
+                size_t startRow = (N > targetRow + 1) ? 0 : targetRow + 1 - N;
+                view = rowsView(startRow, targetRow);
+            }
+            if (sequence.load() == before) {
+                if (view.first == nullptr) {
+                    activePins.fetch_sub(1);
+                }
+                return view;
+            }
+        }
+        activePins.fetch_sub(1);
+        std::this_thread::yield();
+    }
+}
 
-+ removeCount, counters.
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::unpinSlice() const { activePins.fetch_sub(1, std::memory_order_release); }
 
-end(), counters
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::detachLeasedStorage() {
+    if (storageLeases.load() == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(leaseMutex);
+    if (storageLeases == 0) {
+        return; // Released meanwhile
+    }
+    // The leased views keep pointing into the moved blocks
+    StorageVector<T> copy(data);
+    StorageVector<long> timestampsCopy(rowTimestamps);
+    retireStorage();
+    data = std::move(copy);
+    rowTimestamps = std::move(timestampsCopy);
+}
 
-.
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::detachFrozenStorage() {
+    if (frozenLeases.load() > 0) {
+        detachLeasedStorage();
+    }
+}
 
-begin()
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::reallocateStorage(size_t rows) {
+    waitForUnpinnedRows();
+    StorageVector<T> newData(rows * nVariables, Missing::value(), policy.arena);
+    StorageVector<long> newTimestamps(rows, 0, policy.arena);
+    StorageVector<int> newCounters(rows, 0, policy.arena);
+    StorageVector<size_t> newUpdateCounts(rows, 0, policy.arena);
+    StorageVector<uint64_t> newValidity(rows * maskStride, 0, policy.arena);
+    size_t newColumnStride = (dataLayout == DataLayout::RowMajor) ? 1 : rows;
+
+    if (numRows > 0) {
+        // The rows are a ring of at most two contiguous segments
+        size_t firstCount = std::min(numRows, bufferRows - headRow);
+        size_t secondCount = numRows - firstCount;
+        auto copyRing = [this, firstCount, secondCount](const auto &from, auto &to, size_t width) {
+            std::copy_n(from.begin() + headRow * width, firstCount * width, to.begin());
+            std::copy_n(from.begin(), secondCount * width, to.begin() + firstCount * width);
+        };
+        copyRing(rowTimestamps, newTimestamps, 1);
+        copyRing(counters, newCounters, 1);
+        copyRing(updateCounts, newUpdateCounts, 1);
+        copyRing(validity, newValidity, maskStride);
+        if (dataLayout == DataLayout::RowMajor) {
+            copyRing(data, newData, nVariables);
+        } else {
+            for (size_t column = 0; column < nVariables; ++column) {
+                auto from = data.begin() + column * columnStride;
+                auto to = newData.begin() + column * newColumnStride;
+                std::copy_n(from + headRow, firstCount, to);
+                std::copy_n(from, secondCount, to + firstCount);
+            }
+        }
+    }
 
-);
-counters.
-resize((DEFAULT_BUFFER_LENGTH_FACTOR
-* windowSize), 0);
-// Adjust the indexes map:
-// Create a new map to store updated indexes
-std::map<long, size_t> updatedIndexes;
-for (
-const auto &pair
-: indexes) {
-if (pair.second >= elementsToRemove) {
-updatedIndexes[pair.first] = pair.second -
-elementsToRemove;
+    retireLeasedStorage();
+    data = std::move(newData);
+    rowTimestamps = std::move(newTimestamps);
+    counters = std::move(newCounters);
+    updateCounts = std::move(newUpdateCounts);
+    validity = std::move(newValidity);
+    headRow = 0;
+    bufferRows = rows;
+    bufferLength = rows * nVariables;
+    columnStride = newColumnStride;
+    snapshotMapping.reset();
 }
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::retireLeasedStorage() {
+    if (storageLeases.load() == 0) {
+        return;
+    }
+    // The leased views keep pointing into the previous blocks
+    std::lock_guard<std::mutex> lock(leaseMutex);
+    if (storageLeases > 0) {
+        retireStorage();
+    }
 }
-// Swap the updated map with the old one
-indexes.
-swap(updatedIndexes);
 
-// Adjust the variableUpdates map:
-auto varUpdatesIt = variableUpdates.begin();
-// advance iterator
-for (
-size_t i = 0;
-i<removeCount && varUpdatesIt != variableUpdates.
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::retireStorage() {
+    RetiredStorage &retired = retiredStorage[storageGeneration];
+    retired.data = std::move(data);
+    retired.timestamps = std::move(rowTimestamps);
+    retired.leases = storageLeases;
+    retired.mapping = snapshotMapping;
+    ++storageGeneration;
+    storageLeases = 0;
+    frozenLeases = 0;
+}
 
-end();
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::reserveRows(size_t rows) {
+    if (rows <= bufferRows) {
+        return;
+    }
+    size_t grownRows = static_cast<size_t>(std::ceil(bufferRows * policy.growthFactor));
+    reallocateStorage(std::min(maxRows, std::max({rows, grownRows, MIN_GROWTH_ROWS})));
+}
 
-++i) {
-++
-varUpdatesIt;
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::acquireStorageLease(bool frozen) {
+    std::lock_guard<std::mutex> lock(leaseMutex);
+    ++storageLeases;
+    if (frozen) {
+        ++frozenLeases;
+    }
+    return storageGeneration;
 }
-// Erase updates map entries
-variableUpdates.
-erase(variableUpdates
-.
 
-begin(), varUpdatesIt
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::releaseStorageLease(size_t generation, bool frozen) {
+    std::lock_guard<std::mutex> lock(leaseMutex);
+    if (generation == storageGeneration) {
+        if (storageLeases > 0) {
+            --storageLeases;
+        }
+        if (frozen && frozenLeases > 0) {
+            --frozenLeases;
+        }
+        return;
+    }
+    auto it = retiredStorage.find(generation);
+    if (it != retiredStorage.end() && --it->second.leases == 0) {
+        retiredStorage.erase(it);
+    }
+}
 
-);
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::getRetiredStorageCount() const {
+    std::lock_guard<std::mutex> lock(leaseMutex);
+    return retiredStorage.size();
 }
+
+namespace {
+template <typename T>
+constexpr uint64_t isFloatingType() {
+    return std::is_floating_point<T>::value ? 1 : 0;
 }
 
-long DynamicBuffer::minKey() const {
-    if (indexes.empty()) {
-        std::cerr << "Error: No data available." << std::endl;
-        return -1;
-    }
-    return indexes.begin()->first;
+uint64_t pageAligned(uint64_t bytes) {
+    return (bytes + SNAPSHOT_PAGE_BYTES - 1) / SNAPSHOT_PAGE_BYTES * SNAPSHOT_PAGE_BYTES;
 }
 
-long DynamicBuffer::maxKey() const {
-    if (indexes.empty()) {
-        std::cerr << "Error: No data available." << std::endl;
-        return -1;
+// Storage of count elements read from the section at offset: adopting the
+// section of the mapping if any, copying it otherwise
+template <typename U>
+std::vector<U, ArenaAllocator<U>> loadSection(const char *bytes, uint64_t offset, size_t count,
+                                              SlabArena *arena, MappedFile *mapping) {
+    ArenaAllocator<U> allocator(arena);
+    if (mapping != nullptr && count > 0) {
+        allocator.adopt(reinterpret_cast<U *>(mapping->data() + offset), mapping->data(),
+                        mapping->data() + mapping->size());
+        return std::vector<U, ArenaAllocator<U>>(count, allocator);
     }
-    return indexes.rbegin()->first;
+    std::vector<U, ArenaAllocator<U>> section(count, U(), allocator);
+    if (count > 0) {
+        std::memcpy(section.data(), bytes + offset, count * sizeof(U));
+    }
+    return section;
 }
+} // namespace
 
-size_t DynamicBuffer::getNumRows() const { return indexes.size(); }
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::saveSnapshot(const std::string &path) {
+    writeSnapshot(path, SnapshotKind::DynamicBuffer, std::vector<char>());
+}
 
-bool DynamicBuffer::hasEnoughRoomForNewRecord() {
-    if (indexes.size() < (DEFAULT_BUFFER_LENGTH_FACTOR * windowSize))
-        return true;
+template <typename T, typename Missing>
+std::vector<char> BasicDynamicBuffer<T, Missing>::getSnapshotBytes() {
+    return writeSnapshot(SnapshotKind::DynamicBuffer, std::vector<char>());
+}
 
-    return false;
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::loadSnapshot(const std::string &path, bool mapped) {
+    readSnapshot(path, mapped, SnapshotKind::DynamicBuffer, 0);
 }
 
-void DynamicBuffer::removeZeroCount() {
-    int nZeros = countSubsequentZerosCounters();
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::loadSnapshotBytes(const char *bytes, size_t size) {
+    readSnapshot(bytes, size, SnapshotKind::DynamicBuffer, 0, nullptr);
+}
 
-    if (nZeros > 0) {
-        removeFront(nZeros);
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::writeSnapshot(const std::string &path, SnapshotKind kind,
+                                                   const std::vector<char> &extra) {
+    if (snapshotMapping && snapshotMapping->isFile(path) && !concurrentAccess) {
+        // Moved out of the mapping before the file is replaced (a renamed
+        // over file stays whole as long as it is mapped, but not if it is
+        // rewritten in place later on). Not under the readers in concurrent mode.
+        WriteSection section(*this);
+        reallocateStorage(bufferRows);
+    }
+    // Written next to path then renamed over it: a failed save leaves the
+    // previous snapshot untouched
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + temporary);
+        }
+        writeSnapshot(out, kind, extra);
+        out.close();
+        if (!out) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Cannot write " + temporary);
+        }
+    }
+    try {
+        replaceFile(temporary, path);
+    } catch (...) {
+        std::remove(temporary.c_str());
+        throw;
     }
 }
 
-size_t DynamicBuffer::countSubsequentZerosCounters() {
-    size_t count = 0;
-    for (auto value: counters) {
-        if (value == 0) {
-            ++count;
-        } else {
-            break;
+template <typename T, typename Missing>
+std::vector<char> BasicDynamicBuffer<T, Missing>::writeSnapshot(SnapshotKind kind,
+                                                                const std::vector<char> &extra) {
+    std::ostringstream out(std::ios::binary);
+    writeSnapshot(out, kind, extra);
+    std::string bytes = out.str();
+    return std::vector<char>(bytes.begin(), bytes.end());
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::writeSnapshot(std::ostream &out, SnapshotKind kind,
+                                                   const std::vector<char> &extra) {
+    static_assert(sizeof(long) == sizeof(int64_t) && sizeof(size_t) == sizeof(uint64_t),
+                  "Snapshots store the timestamps and update counts as they are in memory");
+    if (!isLittleEndianHost()) {
+        throw std::logic_error("Snapshots need a little-endian host");
+    }
+    WriteSection section(*this);
+    flushStagedRows();
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.kind = static_cast<uint64_t>(kind);
+    header.valueBytes = sizeof(T);
+    header.valueFloating = isFloatingType<T>();
+    header.storageMode = static_cast<uint64_t>(storageMode);
+    header.dataLayout = static_cast<uint64_t>(dataLayout);
+    header.nVariables = nVariables;
+    header.windowSize = windowSize;
+    header.policyMaxRows = policy.maxRows;
+    header.lazyAllocation = policy.lazyAllocation;
+    header.growthFactor = policy.growthFactor;
+    header.evictionRatio = policy.evictionRatio;
+    header.minRetainedRows = policy.minRetainedRows;
+    header.retentionSpan = policy.retentionSpan;
+    header.maxRows = maxRows;
+    header.bufferRows = bufferRows;
+    header.headRow = headRow;
+    header.numRows = numRows;
+    header.zeroPrefix = zeroPrefix;
+    header.evictionHighWaterMark = evictionHighWaterMark;
+    header.maskStride = maskStride;
+    header.maxStagedRows = maxStagedRows;
+    header.rollingStatistics = rollingStatistics;
+
+    const char *sections[SNAPSHOT_SECTION_COUNT] = {
+            reinterpret_cast<const char *>(data.data()),
+            reinterpret_cast<const char *>(rowTimestamps.data()),
+            reinterpret_cast<const char *>(counters.data()),
+            reinterpret_cast<const char *>(updateCounts.data()),
+            reinterpret_cast<const char *>(validity.data()),
+            extra.data()};
+    header.sectionBytes[SNAPSHOT_DATA] = data.size() * sizeof(T);
+    header.sectionBytes[SNAPSHOT_TIMESTAMPS] = rowTimestamps.size() * sizeof(long);
+    header.sectionBytes[SNAPSHOT_COUNTERS] = counters.size() * sizeof(int);
+    header.sectionBytes[SNAPSHOT_UPDATE_COUNTS] = updateCounts.size() * sizeof(size_t);
+    header.sectionBytes[SNAPSHOT_VALIDITY] = validity.size() * sizeof(uint64_t);
+    header.sectionBytes[SNAPSHOT_EXTRA] = extra.size();
+    uint64_t offset = SNAPSHOT_PAGE_BYTES;
+    for (size_t index = 0; index < SNAPSHOT_SECTION_COUNT; ++index) {
+        header.sectionOffsets[index] = offset;
+        offset = pageAligned(offset + header.sectionBytes[index]);
+    }
+
+    // Each section is padded up to the next page
+    std::vector<char> padding(SNAPSHOT_PAGE_BYTES, 0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(padding.data(), SNAPSHOT_PAGE_BYTES - sizeof(header));
+    for (size_t index = 0; index < SNAPSHOT_SECTION_COUNT; ++index) {
+        uint64_t bytes = header.sectionBytes[index];
+        if (bytes > 0) {
+            out.write(sections[index], bytes);
         }
+        out.write(padding.data(), pageAligned(bytes) - bytes);
     }
-    return count;
 }
 
-void DynamicBuffer::decrementCounters(const std::vector<long> &timestamps) {
-    for (long timestamp: timestamps) {
-        auto it = indexes.find(timestamp);
-        if (it != indexes.end()) {
-            size_t index = it->second;
-            size_t counterIndex = index / nVariables;
-            if (counterIndex < counters.size() && counters[counterIndex] > 0) {
-                counters[counterIndex]--;
-            }
+template <typename T, typename Missing>
+std::vector<char> BasicDynamicBuffer<T, Missing>::readSnapshot(const std::string &path, bool mapped,
+                                                               SnapshotKind kind, size_t extraBytes) {
+    // Read through a mapping either way, only kept when the storage adopts it
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+    return readSnapshot(file->data(), file->size(), kind, extraBytes, mapped ? file : nullptr);
+}
+
+template <typename T, typename Missing>
+std::vector<char> BasicDynamicBuffer<T, Missing>::readSnapshot(const char *bytes, size_t size,
+                                                               SnapshotKind kind, size_t extraBytes,
+                                                               const std::shared_ptr<MappedFile> &mapping) {
+    if (!isLittleEndianHost()) {
+        throw std::logic_error("Snapshots need a little-endian host");
+    }
+    if (concurrentAccess) {
+        throw std::logic_error("Cannot load a snapshot once concurrent access is enabled");
+    }
+    SnapshotHeader header;
+    if (size < SNAPSHOT_PAGE_BYTES) {
+        throw std::invalid_argument("Not a buffer snapshot");
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::invalid_argument("Not a buffer snapshot");
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw std::invalid_argument("Unsupported snapshot version");
+    }
+    if (header.kind != static_cast<uint64_t>(kind)) {
+        throw std::invalid_argument("Snapshot of another buffer class");
+    }
+    if (header.valueBytes != sizeof(T) || header.valueFloating != isFloatingType<T>()) {
+        throw std::invalid_argument("Snapshot of another value type");
+    }
+
+    // The sizes are checked against the shape before anything is read
+    size_t loadedMaskWords = (header.nVariables + 63) / 64;
+    bool inherited = header.maskStride == 2 * loadedMaskWords;
+    if (header.storageMode > static_cast<uint64_t>(StorageMode::Circular) ||
+        header.dataLayout > static_cast<uint64_t>(DataLayout::ColumnMajor) ||
+        (header.maskStride != loadedMaskWords && !inherited) ||
+        (kind == SnapshotKind::LastKnownValuesBuffer && !inherited) ||
+        header.bufferRows > header.maxRows || header.numRows > header.bufferRows ||
+        (header.bufferRows > 0 && header.headRow >= header.bufferRows) ||
+        (header.bufferRows == 0 && header.headRow != 0) || header.zeroPrefix > header.numRows ||
+        header.bufferRows > size || (header.bufferRows > 0 && header.nVariables > size / header.bufferRows)) {
+        throw std::invalid_argument("Corrupted snapshot");
+    }
+    uint64_t expectedBytes[SNAPSHOT_SECTION_COUNT] = {
+            header.bufferRows * header.nVariables * sizeof(T), header.bufferRows * sizeof(long),
+            header.bufferRows * sizeof(int), header.bufferRows * sizeof(size_t),
+            header.bufferRows * header.maskStride * sizeof(uint64_t), header.nVariables * extraBytes};
+    for (size_t index = 0; index < SNAPSHOT_SECTION_COUNT; ++index) {
+        uint64_t offset = header.sectionOffsets[index];
+        uint64_t sectionBytes = header.sectionBytes[index];
+        if (sectionBytes != expectedBytes[index] ||
+            offset % SNAPSHOT_PAGE_BYTES != 0 || offset > size || sectionBytes > size - offset) {
+            throw std::invalid_argument("Corrupted snapshot");
+        }
+    }
+    StorageMode loadedMode = static_cast<StorageMode>(header.storageMode);
+    DataLayout loadedLayout = static_cast<DataLayout>(header.dataLayout);
+    BufferPolicy loadedPolicy = policy; // Keeping the arena
+    loadedPolicy.maxRows = header.policyMaxRows;
+    loadedPolicy.lazyAllocation = header.lazyAllocation != 0;
+    loadedPolicy.growthFactor = header.growthFactor;
+    loadedPolicy.evictionRatio = header.evictionRatio;
+    loadedPolicy.minRetainedRows = header.minRetainedRows;
+    loadedPolicy.retentionSpan = header.retentionSpan;
+    {
+        // Checks the policy, without allocating any row
+        BufferPolicy lazyPolicy = loadedPolicy;
+        lazyPolicy.lazyAllocation = true;
+        BasicDynamicBuffer validated(header.nVariables, header.windowSize, loadedMode, loadedLayout,
+                                     lazyPolicy);
+        if (validated.maxRows != header.maxRows) {
+            throw std::invalid_argument("Corrupted snapshot");
         }
     }
-}
 
-void DynamicBuffer::printCounters() const {
-    std::cout << "Counters: ";
-    for (auto value: counters) {
-        std::cout << value << " ";
+    MappedFile *adopted = mapping.get();
+    const uint64_t *offsets = header.sectionOffsets;
+    size_t rows = header.bufferRows;
+    StorageVector<T> newData = loadSection<T>(bytes, offsets[SNAPSHOT_DATA], rows * header.nVariables,
+                                              policy.arena, adopted);
+    StorageVector<long> newTimestamps = loadSection<long>(bytes, offsets[SNAPSHOT_TIMESTAMPS], rows,
+                                                          policy.arena, adopted);
+    StorageVector<int> newCounters = loadSection<int>(bytes, offsets[SNAPSHOT_COUNTERS], rows,
+                                                      policy.arena, adopted);
+    StorageVector<size_t> newUpdateCounts = loadSection<size_t>(bytes, offsets[SNAPSHOT_UPDATE_COUNTS], rows,
+                                                                policy.arena, adopted);
+    StorageVector<uint64_t> newValidity = loadSection<uint64_t>(bytes, offsets[SNAPSHOT_VALIDITY],
+                                                                rows * header.maskStride, policy.arena,
+                                                                adopted);
+    std::vector<char> extra(bytes + offsets[SNAPSHOT_EXTRA],
+                            bytes + offsets[SNAPSHOT_EXTRA] + header.sectionBytes[SNAPSHOT_EXTRA]);
+
+    WriteSection section(*this);
+    retireLeasedStorage();
+    data = std::move(newData);
+    rowTimestamps = std::move(newTimestamps);
+    counters = std::move(newCounters);
+    updateCounts = std::move(newUpdateCounts);
+    validity = std::move(newValidity);
+    snapshotMapping = mapping;
+
+    storageMode = loadedMode;
+    dataLayout = loadedLayout;
+    nVariables = header.nVariables;
+    windowSize = header.windowSize;
+    policy = loadedPolicy;
+    maxRows = header.maxRows;
+    bufferRows = rows;
+    bufferLength = rows * nVariables;
+    headRow = header.headRow;
+    numRows = header.numRows;
+    rowStride = (dataLayout == DataLayout::RowMajor) ? nVariables : 1;
+    columnStride = (dataLayout == DataLayout::RowMajor) ? 1 : rows;
+    zeroPrefix = header.zeroPrefix;
+    evictionHighWaterMark = header.evictionHighWaterMark;
+    maskWords = loadedMaskWords;
+    maskStride = header.maskStride;
+    maxStagedRows = header.maxStagedRows;
+    stagedTimestamps.clear();
+    stagedData.clear();
+    stagedValidity.clear();
+    stagedUpdateCounts.clear();
+    rollingStatistics = false;
+    statistics.clear();
+    if (header.rollingStatistics != 0) {
+        enableRollingStatistics();
     }
-    std::cout << std::endl;
+    return extra;
 }
 
-std::vector<int> DynamicBuffer::getCounters() const { return counters; }
+template <typename T, typename Missing>
+uint64_t BasicDynamicBuffer<T, Missing>::encodeLoggedValue(T value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits;
+}
 
-void DynamicBuffer::printIndexes() const {
-    std::cout << "Indexes: ";
-    for (auto pair: indexes) {
-        std::cout << pair.first << " : " << pair.second << " | ";
+template <typename T, typename Missing>
+T BasicDynamicBuffer<T, Missing>::decodeLoggedValue(uint64_t bits) {
+    T value;
+    std::memcpy(&value, &bits, sizeof(T));
+    return value;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::logOperation(WriteAheadOp op, size_t column, long timestamp,
+                                                  uint64_t value) {
+    writeAheadLog->append({static_cast<uint32_t>(op), static_cast<uint32_t>(column), timestamp, value});
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::logDecrementCounters(const long *timestamps, size_t n) {
+    WriteAheadRecord *records = writeAheadLog->beginRecords(n + 1);
+    records[0] = {static_cast<uint32_t>(WriteAheadOp::DecrementCounters), 0, 0, n};
+    for (size_t i = 0; i < n; ++i) {
+        records[i + 1] = {static_cast<uint32_t>(WriteAheadOp::BatchSample), 0, timestamps[i], 0};
     }
-    std::cout << std::endl;
+    writeAheadLog->commitRecords();
 }
 
-void DynamicBuffer::printData() const {
-    std::cout << "Data: [";
-    for (auto value: data) {
-        std::cout << value << " ";
+template <typename T, typename Missing>
+void BasicDynamicBuffer<T, Missing>::setWriteAheadLog(WriteAheadLog *log) {
+    if (log != nullptr) {
+        log->bindValueType(sizeof(T), std::is_floating_point<T>::value);
     }
-    std::cout << "]" << std::endl;
+    writeAheadLog = log;
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::replayWriteAheadLog(const std::string &path) {
+    return replayOperations(path, [](const WriteAheadRecord &) { return false; });
 }
 
-size_t DynamicBuffer::getVariableUpdateCount(long timestamp) {
-    return variableUpdates[timestamp];
+template <typename T, typename Missing>
+size_t BasicDynamicBuffer<T, Missing>::replayOperations(
+        const std::string &path, const std::function<bool(const WriteAheadRecord &)> &replayOther) {
+    std::vector<WriteAheadRecord> records =
+            WriteAheadLog::readRecords(path, sizeof(T), std::is_floating_point<T>::value);
+
+    // The replayed operations aren't logged again
+    WriteAheadLog *log = writeAheadLog;
+    writeAheadLog = nullptr;
+    std::vector<long> timestamps;
+    std::vector<size_t> columns;
+    std::vector<T> values;
+    size_t next = 0;
+    try {
+        while (next < records.size()) {
+            const WriteAheadRecord &record = records[next++];
+            bool known = true;
+            try {
+                switch (static_cast<WriteAheadOp>(record.op)) {
+                    case WriteAheadOp::AddOrUpdate:
+                        addOrUpdateRecord(record.timestamp, record.column, decodeLoggedValue(record.value));
+                        break;
+                    case WriteAheadOp::AddOrUpdateBatch: {
+                        size_t n = std::min<size_t>(record.value, records.size() - next);
+                        timestamps.resize(n);
+                        columns.resize(n);
+                        values.resize(n);
+                        for (size_t i = 0; i < n; ++i) {
+                            const WriteAheadRecord &sample = records[next++];
+                            timestamps[i] = sample.timestamp;
+                            columns[i] = sample.column;
+                            values[i] = decodeLoggedValue(sample.value);
+                        }
+                        addOrUpdateRecords(timestamps.data(), columns.data(), values.data(), n);
+                        break;
+                    }
+                    case WriteAheadOp::Delete:
+                        deleteRecord(record.timestamp);
+                        break;
+                    case WriteAheadOp::DecrementCounters: {
+                        size_t n = std::min<size_t>(record.value, records.size() - next);
+                        timestamps.resize(n);
+                        for (size_t i = 0; i < n; ++i) {
+                            timestamps[i] = records[next++].timestamp;
+                        }
+                        decrementCounters(timestamps);
+                        break;
+                    }
+                    case WriteAheadOp::RemoveFront:
+                        removeFront(record.value);
+                        break;
+                    case WriteAheadOp::RemoveZeroCount:
+                        removeZeroCount();
+                        break;
+                    default:
+                        known = replayOther(record);
+                }
+            } catch (const std::out_of_range &) {
+                // Failed the same way when it was logged
+            }
+            if (!known) {
+                throw std::invalid_argument("Unknown operation in the write-ahead log");
+            }
+        }
+    } catch (...) {
+        writeAheadLog = log;
+        throw;
+    }
+    writeAheadLog = log;
+    return next;
 }
 
+template class BasicDynamicBuffer<float>;
+template class BasicDynamicBuffer<double>;
+template class BasicDynamicBuffer<int32_t>;
+template class BasicDynamicBuffer<int64_t>;
@@ -1,52 +1,557 @@
 #ifndef DYNAMIC_BUFFER_H
 #define DYNAMIC_BUFFER_H
 
+#include "ArrowExport.h"
+#include "SlabArena.h"
+#include "Snapshot.h"
+#include "WriteAheadLog.h"
 #include "constants.h"
 #include <algorithm> // For std::find_if
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <vector>
 
-class DynamicBuffer {
+// How the rows are laid out in the preallocated storage
+enum class StorageMode {
+  // Rows always start at the beginning of the storage, evicting rows shifts
+  // the remaining ones back to the front
+  Contiguous,
+  // Rows are stored in a ring starting at a head row, evicting rows only
+  // advances the head. A window can then wrap around the end of the storage.
+  Circular
+};
+
+// How the values of the rows are laid out in the storage
+enum class DataLayout {
+  // Each row (all its variables) is contiguous, slices are zero-copy
+  RowMajor,
+  // Each variable is a contiguous ring over the rows, column slices are
+  // zero-copy while row slices are gathered
+  ColumnMajor
+};
+
+// Per-column reductions computed by BasicDynamicBuffer::aggregate. Std is the
+// population standard deviation (like numpy.nanstd).
+enum class Aggregate { Sum, Mean, Min, Max, Std, Count };
+
+// Value of each variable at a grid point t of BasicDynamicBuffer::resample:
+// the last value written at or before t, the linear interpolation between
+// the values around t, or the mean / last value written in [t, t + step)
+enum class ResampleMethod { Previous, Linear, BucketMean, BucketLast };
+
+// Storage growth and eviction settings of a buffer. The default policy
+// preallocates DEFAULT_BUFFER_LENGTH_FACTOR * windowSize rows and only evicts
+// rows once they are all used.
+struct BufferPolicy {
+  // Number of rows the buffer can hold, 0 for DEFAULT_BUFFER_LENGTH_FACTOR * windowSize
+  size_t maxRows = 0;
+  // Allocate nothing until the first insertion, then grow the storage by
+  // growthFactor (at least MIN_GROWTH_ROWS rows) up to maxRows as rows arrive
+  bool lazyAllocation = false;
+  double growthFactor = 2.0;
+  // Fraction of maxRows from which the zero-counter rows are evicted before
+  // inserting a new row (see setEvictionHighWaterMark)
+  double evictionRatio = 1.0;
+  // Eviction of the zero-counter rows never leaves fewer rows than this
+  size_t minRetainedRows = 0;
+  // Time span to keep, 0 to disable: the evictions also drop the rows whose
+  // timestamp is at least retentionSpan older than the latest one
+  long retentionSpan = 0;
+  // Arena the rows are allocated from (the heap if null), which must
+  // outlive the buffer
+  SlabArena *arena = nullptr;
+};
+
+// Marker of the empty cells: NaN for floating point values, the lowest
+// representable value for integers. Another policy providing value() and
+// isMissing() can be passed to BasicDynamicBuffer to use another sentinel.
+template <typename T, bool = std::is_floating_point<T>::value>
+struct MissingValue {
+  static T value() { return std::numeric_limits<T>::quiet_NaN(); }
+  static bool isMissing(T value) { return std::isnan(value); }
+};
+
+template <typename T>
+struct MissingValue<T, false> {
+  static T value() { return std::numeric_limits<T>::min(); }
+  static bool isMissing(T value) { return value == std::numeric_limits<T>::min(); }
+};
+
+// Window of rows split in at most two contiguous segments (the second one is
+// only used when the window wraps around the end of a circular buffer)
+template <typename T>
+struct BasicSliceView {
+  const T *first = nullptr;
+  size_t firstSize = 0; // Number of values in the first segment
+  const T *second = nullptr;
+  size_t secondSize = 0; // Number of values in the second segment
+  // Timestamps of the rows of each segment (firstSize / nVariables and
+  // secondSize / nVariables of them)
+  const long *firstTimestamps = nullptr;
+  const long *secondTimestamps = nullptr;
+};
+
+// Buffer of rows of nVariables values of type T, instantiated for float,
+// double, int32_t and int64_t
+template <typename T, typename Missing = MissingValue<T>>
+class BasicDynamicBuffer {
 protected:
-  // map storing the indexes (adresses) of the rows
-  std::map<long, size_t> indexes;
+  // Row storage, allocated from policy.arena
+  template <typename U>
+  using StorageVector = std::vector<U, ArenaAllocator<U>>;
+
+  // Sorted timestamps of the rows, parallel to the rows stored in data:
+  // rowTimestamps[i] is the timestamp of the row starting at i * nVariables
+  StorageVector<long> rowTimestamps;
+  StorageMode storageMode;
+  DataLayout dataLayout;
+  size_t headRow;    // Storage row holding the oldest row (always 0 when contiguous)
+  size_t numRows;    // Number of rows currently stored
   size_t nVariables; // Number of columns (variables), fixed
   size_t windowSize; // Number of rows (time steps) to keep in memory
+  BufferPolicy policy;
+  size_t maxRows;    // Number of rows the buffer can hold
+  size_t bufferRows; // Number of rows currently allocated (up to maxRows)
   size_t bufferLength;
-  std::vector<double> data; // Array containing the values
-  std::vector<int> counters;
-  std::map<long, size_t> variableUpdates;
+  // Distance between two consecutive rows / columns in data
+  size_t rowStride;
+  size_t columnStride;
+  StorageVector<T> data; // Array containing the values
+  StorageVector<int> counters;
+  // Number of leading rows (from the oldest one) whose counter is zero, kept
+  // up to date by the counter updates instead of rescanning the counters
+  size_t zeroPrefix;
+  // Number of rows (staged ones included) from which inserting a row first
+  // evicts the zero-counter prefix (maxRows: only once the buffer is full)
+  size_t evictionHighWaterMark;
+  // Number of samples written to each storage row, parallel to counters
+  StorageVector<size_t> updateCounts;
+
+  // Populated cells of each storage row, parallel to rowTimestamps: maskWords
+  // words per row, bit c % 64 of word c / 64 being set once column c has been
+  // written (whatever the value, the missing marker included). With
+  // trackInheritedCells, each row has a second mask of the populated cells
+  // that were filled in rather than written, maskStride words per row overall
+  size_t maskWords;
+  size_t maskStride;
+  StorageVector<uint64_t> validity;
+
+  // Late arrivals staged until the next read (see setLateArrivalStaging):
+  // sorted timestamps and the matching rows
+  size_t maxStagedRows;
+  std::vector<long> stagedTimestamps;
+  std::vector<T> stagedData;
+  std::vector<uint64_t> stagedValidity;
+  std::vector<size_t> stagedUpdateCounts;
+
+  // Rows gathered by the row reads of a column-major buffer
+  std::vector<T> gatheredRows;
+  std::vector<long> gatheredTimestamps;
+
+  // Per-column accumulators of the aggregates (counts, sums, minimums and
+  // maximums, nVariables each) and of the resampling
+  std::vector<double> aggregateScratch;
+
+  // Rolling statistics of a variable over the stored rows (see
+  // enableRollingStatistics): Welford moments, which values can be retracted
+  // from, and monotonic deques of the (timestamp, value) candidates to the
+  // minimum and maximum. A write that makes a candidate less extreme marks
+  // the extrema stale, they are then rebuilt on the next read.
+  struct ColumnStatistics {
+    double count = 0;
+    double sum = 0;
+    double mean = 0;
+    double m2 = 0;
+    std::deque<std::pair<long, double>> minimums;
+    std::deque<std::pair<long, double>> maximums;
+    bool extremaStale = false;
+
+    void add(double value) {
+      count += 1;
+      sum += value;
+      double delta = value - mean;
+      mean += delta / count;
+      m2 += delta * (value - mean);
+    }
+
+    void remove(double value) {
+      if (count <= 1) {
+        count = sum = mean = m2 = 0;
+        return;
+      }
+      count -= 1;
+      sum -= value;
+      double delta = value - mean;
+      mean -= delta / count;
+      m2 = std::max(0.0, m2 - delta * (value - mean));
+    }
+  };
+  bool rollingStatistics;
+  std::vector<ColumnStatistics> statistics;
+
+  // Concurrent access (see enableConcurrentAccess): the writer makes the
+  // sequence odd while it modifies the buffer, readers pin the rows they
+  // hold so that the writer doesn't move them
+  bool concurrentAccess;
+  size_t writeDepth; // Nesting of the writer's write sections
+  std::atomic<uint64_t> sequence;
+  mutable std::atomic<size_t> activePins;
+
+  // Storage leases (see acquireStorageLease): data and timestamp blocks
+  // retired while leases were still pointing into them, by generation. The
+  // leases may be released from any thread, hence the mutex.
+  struct RetiredStorage {
+    StorageVector<T> data;
+    StorageVector<long> timestamps;
+    size_t leases;
+    std::shared_ptr<MappedFile> mapping; // The blocks may lie in it
+  };
+  size_t storageGeneration;
+  std::atomic<size_t> storageLeases; // Leases on the current blocks
+  std::atomic<size_t> frozenLeases; // Those of them the blocks must not change under
+  std::map<size_t, RetiredStorage> retiredStorage;
+  mutable std::mutex leaseMutex;
+
+  // File mapped by loadSnapshot that the storage was loaded in place from,
+  // kept until the storage moves out of it
+  std::shared_ptr<MappedFile> snapshotMapping;
+
+  // Log the mutations are recorded to (see setWriteAheadLog), not owned
+  WriteAheadLog *writeAheadLog;
+
+  // Whether an operation gets logged: not when done by another one
+  bool logsOperations() const { return writeAheadLog != nullptr && writeDepth == 0; }
+  static uint64_t encodeLoggedValue(T value);
+  static T decodeLoggedValue(uint64_t bits);
+  void logOperation(WriteAheadOp op, size_t column, long timestamp, uint64_t value);
+  void logDecrementCounters(const long *timestamps, size_t n);
+
+  // Replays the log at path, handing the operations of a derived class to
+  // replayOther (false if it doesn't know them either)
+  size_t replayOperations(const std::string &path,
+                          const std::function<bool(const WriteAheadRecord &)> &replayOther);
+
+  // Before rows get moved or cleared: if the current blocks are leased,
+  // hands them over to their leases and continues on copies of them
+  void detachLeasedStorage();
+
+  // Before a write: same as detachLeasedStorage if the blocks are frozen by
+  // a lease
+  void detachFrozenStorage();
+
+  // Hands the current data and timestamp blocks over to their leases, if any
+  void retireLeasedStorage();
+
+  // Hands the blocks over to their leases, the lease mutex held
+  void retireStorage();
+
+  // Moves the rows to a new storage of rows rows (at least numRows), the
+  // oldest row first. Leased blocks are handed over to their leases.
+  void reallocateStorage(size_t rows);
+
+  // Grows the storage following the policy so that it holds at least rows rows
+  void reserveRows(size_t rows);
+
+  // Marks a modification of the buffer for concurrent readers
+  class WriteSection {
+  public:
+    explicit WriteSection(BasicDynamicBuffer &buffer);
+    ~WriteSection();
+
+  private:
+    BasicDynamicBuffer &buffer;
+  };
+
+  bool rowsPinned() const;
+
+  // Blocks the writer until the readers released their pinned slices
+  void waitForUnpinnedRows() const;
+
+  // Merges the staged rows, waiting for pinned slices if needed
+  void flushStagedRows();
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  // Storage row of the row-th oldest row
+  size_t physicalRow(size_t row) const {
+    size_t storageRow = headRow + row;
+    return storageRow >= bufferRows ? storageRow - bufferRows : storageRow;
+  }
+
+  T &cell(size_t row, size_t column) {
+    return data[physicalRow(row) * rowStride + column * columnStride];
+  }
+
+  T cell(size_t row, size_t column) const {
+    return data[physicalRow(row) * rowStride + column * columnStride];
+  }
+
+  // Row-major only: the values of a row are contiguous
+  T *rowData(size_t row) { return &data[physicalRow(row) * nVariables]; }
+
+  const T *rowData(size_t row) const { return &data[physicalRow(row) * nVariables]; }
+
+  uint64_t *rowMask(size_t row) { return &validity[physicalRow(row) * maskStride]; }
+
+  const uint64_t *rowMask(size_t row) const { return &validity[physicalRow(row) * maskStride]; }
+
+  // Inherited cells of a row, only with trackInheritedCells
+  uint64_t *inheritedMask(size_t row) { return rowMask(row) + maskWords; }
+
+  const uint64_t *inheritedMask(size_t row) const { return rowMask(row) + maskWords; }
+
+  // Gives each row a mask of inherited cells, cleared by the writes
+  void trackInheritedCells();
+
+  static bool isMarked(const uint64_t *mask, size_t column) {
+    return (mask[column / 64] >> (column % 64)) & 1;
+  }
+
+  static void markCell(uint64_t *mask, size_t column) {
+    mask[column / 64] |= uint64_t(1) << (column % 64);
+  }
+
+  static void unmarkCell(uint64_t *mask, size_t column) {
+    mask[column / 64] &= ~(uint64_t(1) << (column % 64));
+  }
+
+  size_t fillCount(const uint64_t *mask) const {
+    size_t count = 0;
+    for (size_t word = 0; word < maskWords; ++word) {
+      count += std::bitset<64>(mask[word]).count();
+    }
+    return count;
+  }
+
+  // Empties a row: missing values, no populated cell and no update
+  void clearRow(size_t row);
+
+  void writeRow(size_t row, const T *values, const uint64_t *mask);
+
+  // Copies the values and populated cells of a row
+  void copyRow(size_t fromRow, size_t toRow);
+
+  // Writes value in column for the rows [firstRow, lastRow), marking the
+  // cells populated and, with trackInheritedCells, inherited
+  void fillColumn(size_t column, size_t firstRow, size_t lastRow, T value);
+
+  // Number of rows of [firstRow, lastRow] with all their cells populated,
+  // flagged in outFlags if not null
+  size_t scanFullRows(size_t firstRow, size_t lastRow, uint8_t *outFlags) const;
+
+  // Copies the rows [firstRow, lastRow] (and their timestamps if not null)
+  // row by row into out, whatever the layout
+  void copyRows(size_t firstRow, size_t lastRow, T *out, long *outTimestamps) const;
+
+  long rowTimestamp(size_t row) const { return rowTimestamps[physicalRow(row)]; }
+
+  int rowCounter(size_t row) const { return counters[physicalRow(row)]; }
+
+  // Counter updates of the stored rows, maintaining zeroPrefix
+  void setRowCounter(size_t row, int value);
+
+  void incrementRowCounter(size_t row);
+
+  void decrementRowCounter(size_t row);
+
+  // Extends zeroPrefix past the zero counters following it
+  void extendZeroPrefix();
+
+  size_t &rowUpdateCount(size_t row) { return updateCounts[physicalRow(row)]; }
+
+  // Moves the rows in [first, last) by shift rows towards the back (shift > 0)
+  // or the front (shift < 0) of the buffer
+  void shiftRows(size_t first, size_t last, std::ptrdiff_t shift);
+
+  // Row-major rows [firstRow, lastRow] as at most two contiguous segments
+  BasicSliceView<T> rowsView(size_t firstRow, size_t lastRow) const;
+
+  // Index of the first row whose timestamp is >= timestamp (numRows if none)
+  size_t lowerBoundRow(long timestamp) const;
+
+  // Rows [startRow, targetRow] as a view, gathered with a column-major layout
+  BasicSliceView<T> sliceRows(size_t startRow, size_t targetRow);
+
+  // Number of leading rows that fell out of the retention span
+  size_t expiredRows() const;
+
+  // copySlice (exact) or copySliceUpTo
+  size_t copySliceRows(long timestamp, bool exact, size_t N, T *out, long *outTimestamps) const;
+
+  // Aggregate of the rows [startRow, targetRow] per column into out
+  void aggregateRows(size_t startRow, size_t targetRow, Aggregate op, double *out);
+
+  // Index of the row holding timestamp, npos if it is not stored
+  size_t findRow(long timestamp) const;
+
+  // Whether the row lies in the counted window ending at the latest row
+  bool isInWindow(size_t rowIndex) const;
+
+  // Makes room for a new (empty) row holding timestamp, evicting rows
+  // with zero counters if needed, and returns its row index
+  size_t insertRow(long timestamp);
+
+  // Writes value in an existing row, counting it if the cell was empty
+  void updateCell(size_t rowIndex, size_t columnIndex, T value);
+
+  // Whether a value counts in the rolling statistics (neither missing nor NaN)
+  static bool isValue(T value) { return !Missing::isMissing(value) && value == value; }
+
+  // Rolling statistics hooks, called before the cell at timestamp goes from
+  // previous (nullptr if empty) to value, after a new row got its values and
+  // before a row is removed (oldest: no stored row precedes it)
+  void trackCellWrite(size_t column, long timestamp, const T *previous, T value) {
+    if (rollingStatistics) {
+      updateStatistics(column, timestamp, previous, value);
+    }
+  }
+  void trackRowInsertion(size_t row);
+  void trackRowRemoval(size_t row, bool oldest);
+  void updateStatistics(size_t column, long timestamp, const T *previous, T value);
+  void rebuildExtrema(ColumnStatistics &column, size_t columnIndex);
+
+  // Writes value in the staged row of timestamp (creating it if needed),
+  // returns whether the row is new
+  bool stageRecord(long timestamp, size_t columnIndex, T value);
+
+  // Snapshot of the buffer, of class kind, along with the extra section of
+  // a derived class, written to path / returned
+  void writeSnapshot(const std::string &path, SnapshotKind kind, const std::vector<char> &extra);
+  std::vector<char> writeSnapshot(SnapshotKind kind, const std::vector<char> &extra);
+  void writeSnapshot(std::ostream &out, SnapshotKind kind, const std::vector<char> &extra);
+
+  // Restores a snapshot of class kind and returns its extra section, of
+  // extraBytes bytes per variable. With a mapping (holding bytes), the
+  // storage adopts the sections in place.
+  std::vector<char> readSnapshot(const std::string &path, bool mapped, SnapshotKind kind,
+                                 size_t extraBytes);
+  std::vector<char> readSnapshot(const char *bytes, size_t size, SnapshotKind kind, size_t extraBytes,
+                                 const std::shared_ptr<MappedFile> &mapping);
 
 public:
-  DynamicBuffer(size_t nVariables, size_t windowSize);
+  BasicDynamicBuffer(size_t nVariables, size_t windowSize,
+                     StorageMode storageMode = StorageMode::Contiguous,
+                     DataLayout dataLayout = DataLayout::RowMajor,
+                     const BufferPolicy &policy = BufferPolicy());
 
   bool deleteRecord(long timestamp);
 
-  bool addOrUpdateRecord(long timestamp, size_t columnIndex, double value);
+  bool addOrUpdateRecord(long timestamp, size_t columnIndex, T value);
+
+  // Bulk version of addOrUpdateRecord over n samples given as parallel
+  // arrays. The samples are grouped by timestamp once and each row is looked
+  // up a single time; late rows are merged in one pass after the batch.
+  // Returns the number of new rows.
+  size_t addOrUpdateRecords(const long *timestamps, const size_t *columnIndexes,
+                            const T *values, size_t n);
+
+  // Reads below first merge the staged late arrivals into the rows. With a
+  // column-major layout, the row pointers and views they return point to
+  // rows gathered into a scratch buffer, valid until the next row read.
+  void print();
+
+  std::vector<T> getRecordByTimestamp(long timestamp);
+
+  std::vector<T> getRecordByIndex(size_t index);
+
+  const T *getRecordByTimestampPtr(long timestamp, size_t &outSize);
+
+  const T *getRecordByIndexPtr(size_t index);
+
+  // Returns nullptr if the slice wraps around the end of a circular buffer,
+  // use getSliceView in that case
+  const T *getSlice(long timestamp, size_t N, size_t &outSize);
+
+  BasicSliceView<T> getSliceView(long timestamp, size_t N);
+
+  // getSlice along with the timestamps of its rows (outSize / nVariables of
+  // them), both pointing into the storage, in a single lookup
+  const T *getSliceWithTimestamps(long timestamp, size_t N, size_t &outSize,
+                                       const long *&outTimestamps);
+
+  std::vector<long> getSliceTimestamps(long timestamp, size_t N);
+
+  // Rows whose timestamp lies in (timestamp - span, timestamp]. The timestamp
+  // doesn't have to be stored: the slice ends at the last row up to it.
+  BasicSliceView<T> getSliceViewSince(long timestamp, long span);
+
+  // Returns nullptr if the slice is empty or wraps around the end of a
+  // circular buffer, use getSliceViewSince in that case
+  const T *getSliceSince(long timestamp, long span, size_t &outSize);
+
+  // Writes the aggregate of each variable over the slice ending at timestamp
+  // (at most N rows) to out (nVariables values), reading the rows in place.
+  // The missing cells and NaN are skipped. Returns the number of rows of the
+  // slice, 0 if it doesn't exist (out is then left untouched).
+  size_t aggregate(long timestamp, size_t N, Aggregate op, double *out);
 
-  void print() const;
+  // Same over the rows in (timestamp - span, timestamp]. Without any row, the
+  // sums and counts are 0 and the other aggregates NaN.
+  size_t aggregateSince(long timestamp, long span, Aggregate op, double *out);
 
-  std::vector<double> getRecordByTimestamp(long timestamp) const;
+  // Values of each variable on the grid start + i * step (i < count), written
+  // row by row to out (count * nVariables values) in a single pass over the
+  // rows. Grid points without a value (before the first value, after the
+  // last one when interpolating, empty buckets) get NaN.
+  void resample(long start, long step, size_t count, ResampleMethod method, double *out);
 
-  std::vector<double> getRecordByIndex(size_t index) const;
+  // Maintains per-variable statistics over the stored rows as values are
+  // written, corrected by late arrivals and updates and retracted as rows
+  // are deleted or evicted (starting from the rows already stored)
+  void enableRollingStatistics();
 
-  const double *getRecordByTimestampPtr(long timestamp, size_t &outSize) const;
+  bool isRollingStatisticsEnabled() const;
 
-  const double *getRecordByIndexPtr(size_t index) const;
+  // Current rolling statistic of each variable (nVariables values written to
+  // out), in O(1) unless a deletion or update invalidated the extrema.
+  // Throws std::logic_error if the rolling statistics aren't enabled.
+  void getRollingStatistics(Aggregate op, double *out);
 
-  const double *getSlice(long timestamp, size_t N, size_t &outSize) const;
+  // Column-major only: values of one variable over the slice ending at
+  // timestamp (at most N rows), as at most two contiguous segments. The view
+  // is empty with a row-major layout.
+  BasicSliceView<T> getColumnSliceView(size_t columnIndex, long timestamp, size_t N);
 
-  std::vector<long> getSliceTimestamps(long timestamp, size_t N) const;
+  // Returns nullptr if the column slice wraps around the end of a circular
+  // buffer (use getColumnSliceView in that case) or if the layout is row-major
+  const T *getColumnSlice(size_t columnIndex, long timestamp, size_t N, size_t &outSize);
 
-  std::vector<double> getSliceByTimestamp(long start, long end) const;
+  // Exports the slice ending at timestamp (at most N rows) as an Arrow record
+  // batch through the C data interface (see ArrowExport.h): an int64
+  // "timestamp" column, then one column of the value type per variable,
+  // named by its index and null where the value is missing. Column-major,
+  // the columns of a slice that doesn't wrap around the ring are served in
+  // place under a frozen lease, so that the batch stays immutable (the next
+  // write continues on a copy of the storage); otherwise they are all copied. Throws std::invalid_argument if the timestamp is not stored.
+  // The arrays must be released before the buffer is destroyed, from any
+  // thread: onRelease(context) is called once they all are.
+  void exportArrowSlice(long timestamp, size_t N, ArrowSchema *schema, ArrowArray *array,
+                        void (*onRelease)(void *) = nullptr, void *context = nullptr);
 
-  std::vector<double> getSliceByIndex(size_t start, size_t end) const;
+  std::vector<T> getSliceByTimestamp(long start, long end) const;
+
+  std::vector<T> getSliceByIndex(size_t start, size_t end) const;
 
   size_t getNVariables() const;
 
+  StorageMode getStorageMode() const;
+
+  DataLayout getDataLayout() const;
+
   void removeFront(size_t removeCount);
 
   long minKey() const;
@@ -55,23 +560,160 @@ public:
 
   size_t getNumRows() const;
 
+  // Number of rows currently allocated
+  size_t getCapacity() const;
+
+  // Number of rows the buffer can grow to
+  size_t getMaxRows() const;
+
+  // Time span kept by the evictions, 0 if they only follow the counters
+  long getRetentionSpan() const;
+
+  // Releases the memory not used by the current rows (all of it for an empty
+  // buffer): the storage is reallocated to the stored rows and grows again
+  // following the policy. Does nothing once concurrent access is enabled.
+  void shrinkToFit();
+
   bool hasEnoughRoomForNewRecord();
 
+  // Number of leading rows with a zero counter (maintained incrementally)
   size_t countSubsequentZerosCounters();
 
+  // Removes the zero-counter prefix, or the rows out of the retention span
+  // if there are more of them
   void removeZeroCount();
 
   void decrementCounters(const std::vector<long> &timestamps);
 
-  void printCounters() const;
+  // Batched version of decrementCounters over n timestamps sorted in
+  // ascending order, matched against the rows in a single forward walk
+  void decrementCounters(const long *timestamps, size_t n);
+
+  // Evicts the zero-counter prefix as soon as the buffer holds rows rows
+  // before inserting a new one, instead of waiting for it to be full
+  // (default: evictionRatio of the policy times maxRows). In contiguous storage mode, each
+  // eviction shifts the remaining rows.
+  void setEvictionHighWaterMark(size_t rows);
 
-  std::vector<int> getCounters() const;
+  size_t getEvictionHighWaterMark() const;
+
+  void printCounters();
+
+  std::vector<int> getCounters();
 
   void printIndexes() const;
 
   void printData() const;
 
+  // Number of samples written to the row of timestamp (0 if not stored)
   size_t getVariableUpdateCount(long timestamp);
+
+  // Populated cells of the row of timestamp as maskWords 64-bit words (bit
+  // c % 64 of word c / 64 for column c), pointing into the buffer. Returns
+  // nullptr if the timestamp is not stored.
+  const uint64_t *getRowFillMask(long timestamp, size_t &outWords);
+
+  // Number of populated cells of the row of timestamp (0 if not stored)
+  size_t getRowFillCount(long timestamp);
+
+  // Flags (1 or 0) whether each row of the slice ending at timestamp (at most
+  // N rows) has all its variables populated, in a single pass over the masks.
+  // Returns the number of rows flagged.
+  size_t getFullRowFlags(long timestamp, size_t N, uint8_t *outFlags);
+
+  // Number of rows of the slice ending at timestamp with all their variables populated
+  size_t countFullRows(long timestamp, size_t N);
+
+  // Late arrivals (timestamps older than the latest row) are staged in a
+  // small sorted side buffer of up to maxStagedRows rows instead of being
+  // shifted into the rows one by one. They are merged in a single pass before
+  // the next read, or when the side buffer is full. 0 disables the staging.
+  void setLateArrivalStaging(size_t maxStagedRows);
+
+  size_t getStagedRowCount() const;
+
+  void mergeStagedRows();
+
+  // Opt-in single writer / multiple readers mode. Once enabled, one thread
+  // may keep calling any method while other threads only call the reader
+  // methods below (copySlice, pinSlice, unpinSlice). The whole storage is
+  // allocated when enabling it, so that it never moves afterwards. Late arrivals are then
+  // staged and merged once no slice is pinned, and the other changes moving
+  // rows (eviction, deletion) wait until the pinned slices are released.
+  void enableConcurrentAccess();
+
+  bool isConcurrentAccessEnabled() const;
+
+  // Reader: copies the rows of the slice ending at timestamp (at most N rows)
+  // into out (and their timestamps into outTimestamps if not null), retrying
+  // while the writer modifies the buffer. Returns the number of rows copied.
+  size_t copySlice(long timestamp, size_t N, T *out, long *outTimestamps) const;
+
+  // Reader: same as copySlice for the slice ending at the latest row whose
+  // timestamp is <= timestamp, which need not be stored
+  size_t copySliceUpTo(long timestamp, size_t N, T *out, long *outTimestamps) const;
+
+  // Reader: returns the slice ending at timestamp and pins its rows so that
+  // they stay in place until unpinSlice is called. Nothing is pinned if the
+  // timestamp is not found (empty view). Needs a row-major layout.
+  BasicSliceView<T> pinSlice(long timestamp, size_t N) const;
+
+  void unpinSlice() const;
+
+  // Single threaded zero-copy views: a lease keeps the current data and
+  // timestamp blocks alive. Views reflect in-place updates, but once rows have to be moved
+  // (late insertion, merge, eviction, deletion) the buffer continues on a
+  // copy and the leased block stays untouched until all its leases are
+  // released. A frozen lease also keeps the blocks from being written in
+  // place: the next write continues on copies. Returns the lease generation
+  // to pass to releaseStorageLease, which may be called from any thread.
+  size_t acquireStorageLease(bool frozen = false);
+
+  void releaseStorageLease(size_t generation, bool frozen = false);
+
+  // Number of retired blocks still kept alive by leases only
+  size_t getRetiredStorageCount() const;
+
+  // Snapshot of the state of the buffer (rows, timestamps, counters, update
+  // counts and populated cells along with the shape, the policy and the
+  // eviction and staging settings), written to a file or returned as bytes
+  // (see Snapshot.h for the format). The staged rows are merged first. The
+  // arena, the concurrent access mode and the leases are not saved. The file
+  // is written to path + ".tmp" then renamed over path, which may be the file
+  // the buffer was loaded from: the mapped storage is copied out of it first.
+  void saveSnapshot(const std::string &path);
+  std::vector<char> getSnapshotBytes();
+
+  // Replaces the state of the buffer with a snapshot taken from a buffer of
+  // the same class and value type, rebuilding the rolling statistics if they
+  // were enabled. Mapped, the rows are served from a copy-on-write mapping of
+  // the file instead of being read: the pages are only copied once written
+  // to. Throws std::invalid_argument if the snapshot doesn't match,
+  // std::runtime_error if the file can't be read and std::logic_error once
+  // concurrent access is enabled.
+  void loadSnapshot(const std::string &path, bool mapped = false);
+  void loadSnapshotBytes(const char *bytes, size_t size);
+
+  // Records the mutations (addOrUpdateRecord(s), deleteRecord,
+  // decrementCounters, removeFront, removeZeroCount) to log, nullptr to
+  // stop. The log must outlive the buffer or be detached first; the records
+  // are buffered by the log (see WriteAheadLogPolicy). The settings are not
+  // logged. Throws std::invalid_argument if the log holds another value type.
+  void setWriteAheadLog(WriteAheadLog *log);
+
+  // Replays the log at path into the buffer, constructed and configured as
+  // the logged one was when the log was started, and returns the number of
+  // records replayed. A torn tail left by a crash is ignored (and truncated
+  // once the log is reopened).
+  size_t replayWriteAheadLog(const std::string &path);
 };
 
+extern template class BasicDynamicBuffer<float>;
+extern template class BasicDynamicBuffer<double>;
+extern template class BasicDynamicBuffer<int32_t>;
+extern template class BasicDynamicBuffer<int64_t>;
+
+using DynamicBuffer = BasicDynamicBuffer<double>;
+using SliceView = BasicSliceView<double>;
+
 #endif // DYNAMIC_BUFFER_H
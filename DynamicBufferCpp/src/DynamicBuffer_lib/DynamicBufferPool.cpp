@@ -0,0 +1,255 @@
+#include "DynamicBufferPool.h"
+
+#include <atomic>
+#include <thread>
+
+template <typename T, typename Missing>
+BasicDynamicBufferPool<T, Missing>::BasicDynamicBufferPool(size_t nVariables, size_t windowSize,
+                                                           StorageMode storageMode,
+                                                           DataLayout dataLayout,
+                                                           const BufferPolicy &policy,
+                                                           size_t slabBytes)
+    : nVariables(nVariables), windowSize(windowSize), storageMode(storageMode),
+      dataLayout(dataLayout), policy(policy), arena(slabBytes) {
+    static_assert(alignof(Buffer) <= SLAB_BLOCK_ALIGNMENT, "Buffers must fit the arena blocks");
+    this->policy.arena = &arena;
+    // Checks the policy up front, without allocating any row
+    BufferPolicy lazyPolicy = this->policy;
+    lazyPolicy.lazyAllocation = true;
+    Buffer validated(nVariables, windowSize, storageMode, dataLayout, lazyPolicy);
+}
+
+template <typename T, typename Missing>
+BasicDynamicBufferPool<T, Missing>::~BasicDynamicBufferPool() {
+    for (Buffer *buffer : series) {
+        buffer->~Buffer();
+        arena.deallocate(buffer, sizeof(Buffer));
+    }
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBufferPool<T, Missing>::addSeries(size_t count) {
+    size_t firstId = series.size();
+    series.reserve(firstId + count);
+    for (size_t i = 0; i < count; ++i) {
+        void *block = arena.allocate(sizeof(Buffer));
+        try {
+            series.push_back(new (block) Buffer(nVariables, windowSize, storageMode, dataLayout, policy));
+        } catch (...) {
+            arena.deallocate(block, sizeof(Buffer));
+            throw;
+        }
+    }
+    return firstId;
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBufferPool<T, Missing>::getSeriesCount() const {
+    return series.size();
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBufferPool<T, Missing>::getNVariables() const {
+    return nVariables;
+}
+
+template <typename T, typename Missing>
+typename BasicDynamicBufferPool<T, Missing>::Buffer &BasicDynamicBufferPool<T, Missing>::getSeries(size_t id) {
+    if (id >= series.size()) {
+        throw std::out_of_range("Series ID out of range");
+    }
+    return *series[id];
+}
+
+template <typename T, typename Missing>
+const typename BasicDynamicBufferPool<T, Missing>::Buffer &
+BasicDynamicBufferPool<T, Missing>::getSeries(size_t id) const {
+    if (id >= series.size()) {
+        throw std::out_of_range("Series ID out of range");
+    }
+    return *series[id];
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBufferPool<T, Missing>::ingest(const size_t *seriesIds, const long *timestamps,
+                                                  const size_t *columnIndexes, const T *values,
+                                                  size_t n) {
+    // Nothing is written if any sample is invalid
+    for (size_t i = 0; i < n; ++i) {
+        if (seriesIds[i] >= series.size()) {
+            throw std::out_of_range("Series ID out of range");
+        }
+        if (columnIndexes[i] >= nVariables) {
+            throw std::invalid_argument("Column index out of range");
+        }
+    }
+    if (std::is_sorted(seriesIds, seriesIds + n)) {
+        return ingestGrouped(seriesIds, timestamps, columnIndexes, values, n);
+    }
+
+    // Group the samples by series, keeping their order within a series so
+    // that the last value written to a cell wins
+    order.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [seriesIds](size_t a, size_t b) {
+        return seriesIds[a] < seriesIds[b];
+    });
+    groupedIds.resize(n);
+    groupedTimestamps.resize(n);
+    groupedColumns.resize(n);
+    groupedValues.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        groupedIds[i] = seriesIds[order[i]];
+        groupedTimestamps[i] = timestamps[order[i]];
+        groupedColumns[i] = columnIndexes[order[i]];
+        groupedValues[i] = values[order[i]];
+    }
+    return ingestGrouped(groupedIds.data(), groupedTimestamps.data(), groupedColumns.data(),
+                         groupedValues.data(), n);
+}
+
+template <typename T, typename Missing>
+size_t BasicDynamicBufferPool<T, Missing>::ingestGrouped(const size_t *seriesIds, const long *timestamps,
+                                                         const size_t *columnIndexes, const T *values,
+                                                         size_t n) {
+    size_t newRows = 0;
+    size_t first = 0;
+    while (first < n) {
+        size_t last = first + 1;
+        while (last < n && seriesIds[last] == seriesIds[first]) {
+            ++last;
+        }
+        newRows += series[seriesIds[first]]->addOrUpdateRecords(timestamps + first, columnIndexes + first,
+                                                                values + first, last - first);
+        first = last;
+    }
+    return newRows;
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBufferPool<T, Missing>::getSlices(const size_t *seriesIds, size_t nSeries, size_t N,
+                                                   T *out, long *outTimestamps, size_t *outCounts) {
+    for (size_t i = 0; i < nSeries; ++i) {
+        if (seriesIds[i] >= series.size()) {
+            throw std::out_of_range("Series ID out of range");
+        }
+    }
+    for (size_t i = 0; i < nSeries; ++i) {
+        Buffer &buffer = *series[seriesIds[i]];
+        T *block = out + i * N * nVariables;
+        long *blockTimestamps = (outTimestamps != nullptr) ? outTimestamps + i * N : nullptr;
+        size_t rows = 0;
+        buffer.mergeStagedRows();
+        if (buffer.getNumRows() > 0) {
+            rows = buffer.copySlice(buffer.maxKey(), N, block, blockTimestamps);
+        }
+        std::fill(block + rows * nVariables, block + N * nVariables, Missing::value());
+        if (blockTimestamps != nullptr) {
+            std::fill(blockTimestamps + rows, blockTimestamps + N, 0);
+        }
+        if (outCounts != nullptr) {
+            outCounts[i] = rows;
+        }
+    }
+}
+
+template <typename T, typename Missing>
+void BasicDynamicBufferPool<T, Missing>::gatherSlices(const size_t *seriesIds, size_t nSeries, long timestamp,
+                                                      size_t N, T *out, long *outTimestamps,
+                                                      size_t *outCounts, size_t nThreads) {
+    for (size_t i = 0; i < nSeries; ++i) {
+        if (seriesIds[i] >= series.size()) {
+            throw std::out_of_range("Series ID out of range");
+        }
+    }
+    std::vector<const Buffer *> buffers(nSeries);
+    for (size_t i = 0; i < nSeries; ++i) {
+        series[seriesIds[i]]->mergeStagedRows();
+        buffers[i] = series[seriesIds[i]];
+    }
+    ::gatherSlices(buffers.data(), nSeries, timestamp, N, out, outTimestamps, outCounts, nThreads);
+}
+
+template <typename T, typename Missing>
+void gatherSlices(const BasicDynamicBuffer<T, Missing> *const *buffers, size_t nSeries, long timestamp,
+                  size_t N, T *out, long *outTimestamps, size_t *outCounts, size_t nThreads) {
+    if (nSeries == 0) {
+        return;
+    }
+    size_t nVariables = buffers[0]->getNVariables();
+    for (size_t i = 1; i < nSeries; ++i) {
+        if (buffers[i]->getNVariables() != nVariables) {
+            throw std::invalid_argument("Buffers must have the same number of variables");
+        }
+    }
+
+    auto gatherOne = [&](size_t i) {
+        T *block = out + i * N * nVariables;
+        long *blockTimestamps = (outTimestamps != nullptr) ? outTimestamps + i * N : nullptr;
+        // Copied to the front of the block, then moved behind the padding
+        size_t rows = buffers[i]->copySliceUpTo(timestamp, N, block, blockTimestamps);
+        size_t padding = N - rows;
+        if (padding > 0) {
+            std::copy_backward(block, block + rows * nVariables, block + N * nVariables);
+            std::fill(block, block + padding * nVariables, Missing::value());
+            if (blockTimestamps != nullptr) {
+                std::copy_backward(blockTimestamps, blockTimestamps + rows, blockTimestamps + N);
+                std::fill(blockTimestamps, blockTimestamps + padding, 0);
+            }
+        }
+        if (outCounts != nullptr) {
+            outCounts[i] = rows;
+        }
+    };
+
+    if (nThreads == 0) {
+        nThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    nThreads = std::min(nThreads, (nSeries + GATHER_SERIES_PER_THREAD - 1) / GATHER_SERIES_PER_THREAD);
+    if (nThreads <= 1) {
+        for (size_t i = 0; i < nSeries; ++i) {
+            gatherOne(i);
+        }
+        return;
+    }
+
+    // The threads take chunks of series until none is left
+    std::atomic<size_t> nextSeries(0);
+    auto worker = [&]() {
+        while (true) {
+            size_t first = nextSeries.fetch_add(GATHER_SERIES_PER_THREAD, std::memory_order_relaxed);
+            if (first >= nSeries) {
+                return;
+            }
+            size_t last = std::min(first + GATHER_SERIES_PER_THREAD, nSeries);
+            for (size_t i = first; i < last; ++i) {
+                gatherOne(i);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    for (size_t t = 1; t < nThreads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+template class BasicDynamicBufferPool<float>;
+template class BasicDynamicBufferPool<double>;
+template class BasicDynamicBufferPool<int32_t>;
+template class BasicDynamicBufferPool<int64_t>;
+
+template void gatherSlices<float>(const BasicDynamicBuffer<float> *const *, size_t, long, size_t, float *,
+                                  long *, size_t *, size_t);
+template void gatherSlices<double>(const BasicDynamicBuffer<double> *const *, size_t, long, size_t, double *,
+                                   long *, size_t *, size_t);
+template void gatherSlices<int32_t>(const BasicDynamicBuffer<int32_t> *const *, size_t, long, size_t,
+                                    int32_t *, long *, size_t *, size_t);
+template void gatherSlices<int64_t>(const BasicDynamicBuffer<int64_t> *const *, size_t, long, size_t,
+                                    int64_t *, long *, size_t *, size_t);
@@ -0,0 +1,98 @@
+#ifndef DYNAMIC_BUFFER_POOL_H
+#define DYNAMIC_BUFFER_POOL_H
+
+#include "DynamicBuffer.h"
+#include "SlabArena.h"
+
+// Many series of the same shape (variables, window, storage mode, layout and
+// policy), addressed by integer IDs. The buffers and their rows are all
+// allocated from a SlabArena owned by the pool, and the batched calls reach
+// any number of series at once.
+template <typename T, typename Missing = MissingValue<T>>
+class BasicDynamicBufferPool {
+public:
+  using Buffer = BasicDynamicBuffer<T, Missing>;
+
+  BasicDynamicBufferPool(size_t nVariables, size_t windowSize,
+                         StorageMode storageMode = StorageMode::Contiguous,
+                         DataLayout dataLayout = DataLayout::RowMajor,
+                         const BufferPolicy &policy = BufferPolicy(),
+                         size_t slabBytes = DEFAULT_SLAB_BYTES);
+  ~BasicDynamicBufferPool();
+  BasicDynamicBufferPool(const BasicDynamicBufferPool &) = delete;
+  BasicDynamicBufferPool &operator=(const BasicDynamicBufferPool &) = delete;
+
+  // Adds count empty series and returns the ID of the first one, the IDs
+  // being consecutive from 0
+  size_t addSeries(size_t count = 1);
+
+  size_t getSeriesCount() const;
+
+  size_t getNVariables() const;
+
+  // Series of ID id, throws std::out_of_range if there is none
+  Buffer &getSeries(size_t id);
+  const Buffer &getSeries(size_t id) const;
+
+  // Bulk version of addOrUpdateRecords over the series: n samples given as
+  // parallel arrays. The samples are grouped by series, keeping their order,
+  // and each series is written in a single addOrUpdateRecords call. Returns
+  // the number of new rows.
+  size_t ingest(const size_t *seriesIds, const long *timestamps, const size_t *columnIndexes,
+                const T *values, size_t n);
+
+  // Copies the last N rows of each of the nSeries series into out, as
+  // nSeries blocks of N row-major rows starting from the oldest one. The rows
+  // past the end of a shorter series hold the missing marker (and timestamp
+  // 0 in outTimestamps). outTimestamps and outCounts (number of rows of each
+  // series) are optional.
+  void getSlices(const size_t *seriesIds, size_t nSeries, size_t N, T *out,
+                 long *outTimestamps, size_t *outCounts);
+
+  // gatherSlices over the series of the pool, after validating the IDs and
+  // merging their staged rows
+  void gatherSlices(const size_t *seriesIds, size_t nSeries, long timestamp, size_t N, T *out,
+                    long *outTimestamps, size_t *outCounts, size_t nThreads = 0);
+
+  const SlabArena &getArena() const { return arena; }
+
+private:
+  size_t nVariables;
+  size_t windowSize;
+  StorageMode storageMode;
+  DataLayout dataLayout;
+  BufferPolicy policy; // Allocating from arena
+  SlabArena arena;
+  std::vector<Buffer *> series; // Constructed in the arena
+
+  // Samples of ingest grouped by series, kept between the calls
+  std::vector<size_t> order;
+  std::vector<size_t> groupedIds;
+  std::vector<long> groupedTimestamps;
+  std::vector<size_t> groupedColumns;
+  std::vector<T> groupedValues;
+
+  // ingest of samples already grouped by series
+  size_t ingestGrouped(const size_t *seriesIds, const long *timestamps,
+                       const size_t *columnIndexes, const T *values, size_t n);
+};
+
+// Copies into out, for each of the nSeries buffers, the last N rows whose
+// timestamp is <= timestamp, as nSeries blocks of N row-major rows aligned on
+// their last row: a block starts with the missing marker (and timestamp 0 in
+// outTimestamps) when the buffer has fewer rows. The buffers must share their
+// number of variables. The series are split over nThreads threads (0 for one
+// per core), each copy going through copySliceUpTo. outTimestamps and
+// outCounts (number of rows of each series) are optional.
+template <typename T, typename Missing>
+void gatherSlices(const BasicDynamicBuffer<T, Missing> *const *buffers, size_t nSeries, long timestamp,
+                  size_t N, T *out, long *outTimestamps, size_t *outCounts, size_t nThreads = 0);
+
+extern template class BasicDynamicBufferPool<float>;
+extern template class BasicDynamicBufferPool<double>;
+extern template class BasicDynamicBufferPool<int32_t>;
+extern template class BasicDynamicBufferPool<int64_t>;
+
+using DynamicBufferPool = BasicDynamicBufferPool<double>;
+
+#endif // DYNAMIC_BUFFER_POOL_H
@@ -4,74 +4,344 @@
 
 #include "LastKnownValuesBuffer.h"
 #include "DynamicBuffer.h"
+#include <cstring>
 
-LastKnownValuesBuffer::LastKnownValuesBuffer(size_t nVariables, size_t windowSize) : DynamicBuffer(
-  nVariables, windowSize) {
+namespace {
+
+// Fill values are computed in double, integers are rounded to the nearest
+template <typename T>
+T fromDouble(double value) {
+  return std::is_integral<T>::value ? static_cast<T>(std::llround(value)) : static_cast<T>(value);
+}
+
+// Fill strategy of a column in the snapshots: the method, the constant and
+// the decay rate, 8 bytes each
+constexpr size_t FILL_STRATEGY_BYTES = 24;
+
+} // namespace
+
+template <typename T, typename Missing>
+BasicLastKnownValuesBuffer<T, Missing>::BasicLastKnownValuesBuffer(size_t nVariables, size_t windowSize,
+                                                                   StorageMode storageMode,
+                                                                   DataLayout dataLayout,
+                                                                   const BufferPolicy &policy) : Base(
+  nVariables, windowSize, storageMode, dataLayout, policy), fillStrategies(nVariables), forwardFillOnly(true) {
+  this->trackInheritedCells();
 }
 
-bool LastKnownValuesBuffer::updateLastKnownValue(long timestamp, size_t columnIndex, double value) {
+template <typename T, typename Missing>
+bool BasicLastKnownValuesBuffer<T, Missing>::updateLastKnownValue(long timestamp, size_t columnIndex, T value) {
   bool newEntry = true;
-  if (columnIndex >= nVariables) {
+  if (columnIndex >= this->nVariables) {
     throw std::invalid_argument("Column index out of range");
   }
+  if (this->logsOperations()) {
+    this->logOperation(WriteAheadOp::UpdateLastKnownValue, columnIndex, timestamp, Base::encodeLoggedValue(value));
+  }
 
-  size_t dataIndex;
-  auto it = indexes.find(timestamp);
+  typename Base::WriteSection section(*this);
+  // Filling needs the neighbouring rows, so late arrivals aren't staged here
+  this->flushStagedRows();
+  size_t rowIndex = this->findRow(timestamp);
 
-  if (it != indexes.end()) {
+  bool unchanged = false;
+  if (rowIndex != Base::npos) {
     newEntry = false;
+    // Nothing depends on a value written again as it was (or, forward
+    // filled, on a value written as it was inherited)
+    unchanged = (fillStrategies[columnIndex].method == FillMethod::ForwardFill
+                   ? this->isMarked(this->rowMask(rowIndex), columnIndex)
+                   : isWritten(rowIndex, columnIndex)) &&
+                this->cell(rowIndex, columnIndex) == value;
     // Timestamp exists: update the value directly.
-    dataIndex = it->second + columnIndex;
-    if (dataIndex < bufferLength) {
-      data[dataIndex] = value;
-      size_t rowIndex = dataIndex / nVariables;
-      counters[rowIndex]++;
-    } else {
-      throw std::out_of_range("Attempting to write beyond the buffer length");
-    }
+    this->trackCellWrite(columnIndex, timestamp,
+                         this->isMarked(this->rowMask(rowIndex), columnIndex) ? &this->cell(rowIndex, columnIndex)
+                                                                             : nullptr,
+                         value);
+    this->cell(rowIndex, columnIndex) = value;
+    this->markCell(this->rowMask(rowIndex), columnIndex);
+    this->unmarkCell(this->inheritedMask(rowIndex), columnIndex);
+    this->incrementRowCounter(rowIndex);
   } else {
-    // Check if there is enough room for a new record
-    if (!hasEnoughRoomForNewRecord()) {
-      // Remove all rows with zero counters
-      removeZeroCount();
-      if (!hasEnoughRoomForNewRecord()) {
-        throw std::out_of_range("Buffer is full and can't be emptied further.");
-      }
+    rowIndex = this->insertRow(timestamp);
+
+    // Fill the new row from its neighbours (the last known values of the
+    // previous row by default), then insert the new value
+    fillNewRow(rowIndex);
+    this->trackCellWrite(columnIndex, timestamp,
+                         this->isMarked(this->rowMask(rowIndex), columnIndex) ? &this->cell(rowIndex, columnIndex)
+                                                                             : nullptr,
+                         value);
+    this->cell(rowIndex, columnIndex) = value; // Insert new value at the correct column
+    this->markCell(this->rowMask(rowIndex), columnIndex);
+    this->unmarkCell(this->inheritedMask(rowIndex), columnIndex);
+
+    // Update the counters appropriately
+    this->setRowCounter(rowIndex, 1);
+  }
+  // The rows filled from the previous value of the cell follow the new one
+  if (!unchanged) {
+    propagateWrite(rowIndex, columnIndex);
+  }
+
+  return newEntry;
+}
+
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::setFillStrategy(const FillStrategy &strategy) {
+  for (size_t column = 0; column < this->nVariables; ++column) {
+    setFillStrategy(column, strategy);
+  }
+}
+
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::setFillStrategy(size_t columnIndex, const FillStrategy &strategy) {
+  if (columnIndex >= this->nVariables) {
+    throw std::invalid_argument("Column index out of range");
+  }
+  if (strategy.decayRate < 0) {
+    throw std::invalid_argument("Decay rate must not be negative");
+  }
+  typename Base::WriteSection section(*this);
+  this->flushStagedRows();
+  fillStrategies[columnIndex] = strategy;
+  forwardFillOnly = std::all_of(fillStrategies.begin(), fillStrategies.end(), [](const FillStrategy &fill) {
+    return fill.method == FillMethod::ForwardFill;
+  });
+
+  // Refill the runs between the written values of the column
+  size_t previous = Base::npos;
+  for (size_t row = 0; row < this->numRows; ++row) {
+    if (isWritten(row, columnIndex)) {
+      refillRun(columnIndex, previous, row);
+      previous = row;
     }
+  }
+  refillRun(columnIndex, previous, this->numRows);
+}
+
+template <typename T, typename Missing>
+FillStrategy BasicLastKnownValuesBuffer<T, Missing>::getFillStrategy(size_t columnIndex) const {
+  if (columnIndex >= this->nVariables) {
+    throw std::invalid_argument("Column index out of range");
+  }
+  return fillStrategies[columnIndex];
+}
 
-    if (indexes.empty() || timestamp > indexes.rbegin()->first) {
-      dataIndex =
-          (!indexes.empty()) ? (indexes.rbegin()->second + nVariables) : 0;
-    } else {
-      auto nextTimestampIt = indexes.upper_bound(timestamp);
-      dataIndex =
-          (nextTimestampIt != indexes.end()) ? nextTimestampIt->second : 0;
-
-      // Shift existing data to make room for the new record
-      std::move_backward(data.begin() + dataIndex, data.end() - nVariables,
-                         data.end());
-
-      // Update indexes for all timestamps after the new one
-      for (auto iter = nextTimestampIt; iter != indexes.end(); ++iter) {
-        iter->second += nVariables;
+template <typename T, typename Missing>
+size_t BasicLastKnownValuesBuffer<T, Missing>::previousWrittenRow(size_t row, size_t column) const {
+  while (row-- > 0) {
+    if (isWritten(row, column)) {
+      return row;
+    }
+  }
+  return Base::npos;
+}
+
+template <typename T, typename Missing>
+size_t BasicLastKnownValuesBuffer<T, Missing>::nextWrittenRow(size_t row, size_t column) const {
+  // Scans the masks of the run directly, a ring of at most two segments
+  size_t word = column / 64;
+  uint64_t bit = uint64_t(1) << (column % 64);
+  for (++row; row < this->numRows;) {
+    size_t start = this->physicalRow(row);
+    size_t count = std::min(this->numRows - row, this->bufferRows - start);
+    const uint64_t *masks = &this->validity[start * this->maskStride + word];
+    for (size_t i = 0; i < count; ++i) {
+      const uint64_t *mask = masks + i * this->maskStride;
+      if ((mask[0] & ~mask[this->maskWords]) & bit) {
+        return row + i;
       }
     }
-    // Insert the new value
-    size_t previousRowIndex = dataIndex == 0 ? 0 : (dataIndex - nVariables);
-    for (size_t i = 0; i < nVariables; ++i) {
-      data[dataIndex + i] = data[previousRowIndex + i];
+    row += count;
+  }
+  return this->numRows;
+}
+
+template <typename T, typename Missing>
+bool BasicLastKnownValuesBuffer<T, Missing>::fillValue(size_t row, size_t column, size_t previous, size_t next,
+                                                       T &value) const {
+  const FillStrategy &strategy = fillStrategies[column];
+  if (strategy.method == FillMethod::Zero || strategy.method == FillMethod::Constant) {
+    value = fromDouble<T>(strategy.method == FillMethod::Zero ? 0.0 : strategy.constant);
+    return true;
+  }
+  if (previous == Base::npos) {
+    return false;
+  }
+  value = this->cell(previous, column);
+  if (!Base::isValue(value)) {
+    // Missing markers and NaN are carried over as they are
+    return true;
+  }
+  double start = static_cast<double>(value);
+  double elapsed = static_cast<double>(this->rowTimestamp(row) - this->rowTimestamp(previous));
+  if (strategy.method == FillMethod::Decay) {
+    value = fromDouble<T>(start * std::exp(-strategy.decayRate * elapsed));
+  } else if (strategy.method == FillMethod::Linear && next < this->numRows &&
+             Base::isValue(this->cell(next, column))) {
+    double end = static_cast<double>(this->cell(next, column));
+    double span = static_cast<double>(this->rowTimestamp(next) - this->rowTimestamp(previous));
+    value = fromDouble<T>(start + (end - start) * elapsed / span);
+  }
+  return true;
+}
+
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::setFilledCell(size_t row, size_t column, bool filled, T value) {
+  uint64_t *mask = this->rowMask(row);
+  bool populated = this->isMarked(mask, column);
+  if (!populated && !filled) {
+    return;
+  }
+  T &target = this->cell(row, column);
+  this->trackCellWrite(column, this->rowTimestamp(row), populated ? &target : nullptr,
+                       filled ? value : Missing::value());
+  if (filled) {
+    target = value;
+    this->markCell(mask, column);
+    this->markCell(this->inheritedMask(row), column);
+  } else {
+    target = Missing::value();
+    this->unmarkCell(mask, column);
+    this->unmarkCell(this->inheritedMask(row), column);
+  }
+}
+
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::refillRun(size_t column, size_t previous, size_t next) {
+  for (size_t row = (previous == Base::npos) ? 0 : previous + 1; row < next; ++row) {
+    T value = Missing::value();
+    bool filled = fillValue(row, column, previous, next, value);
+    setFilledCell(row, column, filled, value);
+  }
+}
+
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::fillNewRow(size_t row) {
+  if (forwardFillOnly) {
+    // Carry over the last known values of the previous row, all inherited
+    if (row > 0) {
+      this->copyRow(row - 1, row);
+      std::copy_n(this->rowMask(row), this->maskWords, this->inheritedMask(row));
+    }
+  } else {
+    for (size_t column = 0; column < this->nVariables; ++column) {
+      FillMethod method = fillStrategies[column].method;
+      size_t previous = Base::npos;
+      size_t next = this->numRows;
+      if (method == FillMethod::ForwardFill) {
+        // The previous row already holds the last known value
+        if (row > 0 && this->isMarked(this->rowMask(row - 1), column)) {
+          previous = row - 1;
+        }
+      } else if (method == FillMethod::Linear || method == FillMethod::Decay) {
+        previous = previousWrittenRow(row, column);
+        if (method == FillMethod::Linear) {
+          next = nextWrittenRow(row, column);
+        }
+      }
+      T value;
+      if (fillValue(row, column, previous, next, value)) {
+        this->cell(row, column) = value;
+        this->markCell(this->rowMask(row), column);
+        this->markCell(this->inheritedMask(row), column);
+      }
     }
-    data[dataIndex + columnIndex] = value; // Insert new value at the correct column
+  }
+  this->trackRowInsertion(row);
+}
 
-    // Update the index for the new timestamp
-    indexes[timestamp] = dataIndex;
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::propagateWrite(size_t row, size_t column) {
+  FillMethod method = fillStrategies[column].method;
+  if (method == FillMethod::Zero || method == FillMethod::Constant) {
+    // Filled cells don't depend on the written values
+    return;
+  }
+  size_t next = nextWrittenRow(row, column);
+  if (method == FillMethod::ForwardFill && !this->rollingStatistics) {
+    // Untracked forward fill: a single value over the run
+    this->fillColumn(column, row + 1, next, this->cell(row, column));
+    return;
+  }
+  refillRun(column, row, next);
+  if (method == FillMethod::Linear) {
+    // The interpolation towards the new value
+    refillRun(column, previousWrittenRow(row, column), row);
+  }
+}
 
-    // Update the counters appropriately
-    size_t rowIndex = dataIndex / nVariables;
-    counters.resize(std::max(counters.size(), rowIndex + 1),
-                    0); // Ensure counters vector is large enough
-    counters[rowIndex] = 1;
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::saveSnapshot(const std::string &path) {
+  this->writeSnapshot(path, SnapshotKind::LastKnownValuesBuffer, encodeFillStrategies());
+}
+
+template <typename T, typename Missing>
+std::vector<char> BasicLastKnownValuesBuffer<T, Missing>::getSnapshotBytes() {
+  return this->writeSnapshot(SnapshotKind::LastKnownValuesBuffer, encodeFillStrategies());
+}
+
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::loadSnapshot(const std::string &path, bool mapped) {
+  decodeFillStrategies(this->readSnapshot(path, mapped, SnapshotKind::LastKnownValuesBuffer, FILL_STRATEGY_BYTES));
+}
+
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::loadSnapshotBytes(const char *bytes, size_t size) {
+  decodeFillStrategies(this->readSnapshot(bytes, size, SnapshotKind::LastKnownValuesBuffer, FILL_STRATEGY_BYTES,
+                                            nullptr));
+}
+
+template <typename T, typename Missing>
+size_t BasicLastKnownValuesBuffer<T, Missing>::replayWriteAheadLog(const std::string &path) {
+  return this->replayOperations(path, [this](const WriteAheadRecord &record) {
+    if (record.op != static_cast<uint32_t>(WriteAheadOp::UpdateLastKnownValue)) {
+      return false;
+    }
+    updateLastKnownValue(record.timestamp, record.column, Base::decodeLoggedValue(record.value));
+    return true;
+  });
+}
+
+template <typename T, typename Missing>
+std::vector<char> BasicLastKnownValuesBuffer<T, Missing>::encodeFillStrategies() const {
+  std::vector<char> bytes(fillStrategies.size() * FILL_STRATEGY_BYTES);
+  char *out = bytes.data();
+  for (const FillStrategy &strategy : fillStrategies) {
+    uint64_t method = static_cast<uint64_t>(strategy.method);
+    std::memcpy(out, &method, 8);
+    std::memcpy(out + 8, &strategy.constant, 8);
+    std::memcpy(out + 16, &strategy.decayRate, 8);
+    out += FILL_STRATEGY_BYTES;
   }
+  return bytes;
+}
 
-  return newEntry;
+template <typename T, typename Missing>
+void BasicLastKnownValuesBuffer<T, Missing>::decodeFillStrategies(const std::vector<char> &bytes) {
+  // The rows are already loaded: an unknown method resets the strategies
+  std::vector<FillStrategy> strategies(this->nVariables);
+  bool valid = true;
+  for (size_t column = 0; valid && column < strategies.size(); ++column) {
+    const char *in = bytes.data() + column * FILL_STRATEGY_BYTES;
+    uint64_t method;
+    std::memcpy(&method, in, 8);
+    std::memcpy(&strategies[column].constant, in + 8, 8);
+    std::memcpy(&strategies[column].decayRate, in + 16, 8);
+    valid = method <= static_cast<uint64_t>(FillMethod::Decay);
+    strategies[column].method = static_cast<FillMethod>(method);
+  }
+  fillStrategies = valid ? strategies : std::vector<FillStrategy>(this->nVariables);
+  forwardFillOnly = std::all_of(fillStrategies.begin(), fillStrategies.end(), [](const FillStrategy &strategy) {
+    return strategy.method == FillMethod::ForwardFill;
+  });
+  if (!valid) {
+    throw std::invalid_argument("Corrupted snapshot");
+  }
 }
+
+template class BasicLastKnownValuesBuffer<float>;
+template class BasicLastKnownValuesBuffer<double>;
+template class BasicLastKnownValuesBuffer<int32_t>;
+template class BasicLastKnownValuesBuffer<int64_t>;
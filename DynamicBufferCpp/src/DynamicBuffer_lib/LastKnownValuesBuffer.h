@@ -6,12 +6,92 @@
 #define LASTKNOWNVALUESBUFFER_H
 #include "DynamicBuffer.h"
 
-class LastKnownValuesBuffer : public DynamicBuffer {
+// How the cells a row did not get written are filled in
+enum class FillMethod {
+  ForwardFill, // Last written value of the column
+  Zero,
+  Constant,    // FillStrategy::constant
+  Linear,      // Interpolated between the surrounding written values
+  Decay        // Last written value scaled by exp(-decayRate * elapsed time)
+};
+
+struct FillStrategy {
+  FillMethod method = FillMethod::ForwardFill;
+  double constant = 0;
+  double decayRate = 0;
+};
+
+template <typename T, typename Missing = MissingValue<T>>
+class BasicLastKnownValuesBuffer : public BasicDynamicBuffer<T, Missing> {
+    using Base = BasicDynamicBuffer<T, Missing>;
+
 public:
-    LastKnownValuesBuffer(size_t nVariables, size_t windowSize);
+    BasicLastKnownValuesBuffer(size_t nVariables, size_t windowSize,
+                               StorageMode storageMode = StorageMode::Contiguous,
+                               DataLayout dataLayout = DataLayout::RowMajor,
+                               const BufferPolicy &policy = BufferPolicy());
 
     // Method added as it should have some specific behavior
-    bool updateLastKnownValue(long timestamp, size_t columnIndex, double value);
+    bool updateLastKnownValue(long timestamp, size_t columnIndex, T value);
+
+    // Fill strategy of all the columns / of one column, forward fill by
+    // default. The cells are filled when written: changing the strategy
+    // refills the stored rows of the column. Linear fills the rows after the
+    // last written value forward, ForwardFill, Linear and Decay leave the rows
+    // before the first one empty.
+    void setFillStrategy(const FillStrategy &strategy);
+    void setFillStrategy(size_t columnIndex, const FillStrategy &strategy);
+    FillStrategy getFillStrategy(size_t columnIndex) const;
+
+    // Snapshots of the buffer along with its fill strategies, only loaded
+    // by a LastKnownValuesBuffer (see BasicDynamicBuffer::saveSnapshot)
+    void saveSnapshot(const std::string &path);
+    std::vector<char> getSnapshotBytes();
+    void loadSnapshot(const std::string &path, bool mapped = false);
+    void loadSnapshotBytes(const char *bytes, size_t size);
+
+    // Also replays updateLastKnownValue, logged as well
+    size_t replayWriteAheadLog(const std::string &path);
+
+private:
+    std::vector<FillStrategy> fillStrategies;
+    bool forwardFillOnly; // Whether all the columns are forward filled
+
+    bool isWritten(size_t row, size_t column) const {
+        return this->isMarked(this->rowMask(row), column) &&
+               !this->isMarked(this->inheritedMask(row), column);
+    }
+
+    // Closest row before / after row with a written value in column, npos /
+    // numRows if none
+    size_t previousWrittenRow(size_t row, size_t column) const;
+    size_t nextWrittenRow(size_t row, size_t column) const;
+
+    // Fill value of column at row from the row previous (the written one, or
+    // the previous row for forward fill) and the next written row, false if
+    // the cell stays empty
+    bool fillValue(size_t row, size_t column, size_t previous, size_t next, T &value) const;
+
+    void setFilledCell(size_t row, size_t column, bool filled, T value);
+
+    // Fills the cells of column between the written rows previous and next
+    void refillRun(size_t column, size_t previous, size_t next);
+
+    void fillNewRow(size_t row);
+
+    // Fill strategies as the extra section of the snapshots, and back
+    std::vector<char> encodeFillStrategies() const;
+    void decodeFillStrategies(const std::vector<char> &bytes);
+
+    // Refills the runs depending on the value just written at row
+    void propagateWrite(size_t row, size_t column);
 };
 
+extern template class BasicLastKnownValuesBuffer<float>;
+extern template class BasicLastKnownValuesBuffer<double>;
+extern template class BasicLastKnownValuesBuffer<int32_t>;
+extern template class BasicLastKnownValuesBuffer<int64_t>;
+
+using LastKnownValuesBuffer = BasicLastKnownValuesBuffer<double>;
+
 #endif //LASTKNOWNVALUESBUFFER_H
@@ -0,0 +1,65 @@
+#include "SlabArena.h"
+
+SlabArena::SlabArena(size_t slabBytes)
+    : slabBytes(blockSize(slabBytes)), cursor(nullptr), remaining(0), reservedBytes(0),
+      usedBytes(0) {}
+
+size_t SlabArena::blockSize(size_t bytes) {
+    // Whole alignment units, so that consecutive blocks stay aligned
+    size_t units = (bytes + SLAB_BLOCK_ALIGNMENT - 1) / SLAB_BLOCK_ALIGNMENT;
+    return (units == 0 ? 1 : units) * SLAB_BLOCK_ALIGNMENT;
+}
+
+char *SlabArena::addSlab(size_t bytes) {
+    slabs.emplace_back(new char[bytes + SLAB_BLOCK_ALIGNMENT]);
+    reservedBytes += bytes;
+    char *start = slabs.back().get();
+    size_t offset = reinterpret_cast<uintptr_t>(start) % SLAB_BLOCK_ALIGNMENT;
+    return offset == 0 ? start : start + (SLAB_BLOCK_ALIGNMENT - offset);
+}
+
+void *SlabArena::allocate(size_t bytes) {
+    size_t size = blockSize(bytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    usedBytes += size;
+    auto freeList = freeBlocks.find(size);
+    if (freeList != freeBlocks.end() && !freeList->second.empty()) {
+        void *block = freeList->second.back();
+        freeList->second.pop_back();
+        return block;
+    }
+    if (size > slabBytes) {
+        return addSlab(size);
+    }
+    if (size > remaining) {
+        // The end of the previous slab is left unused
+        cursor = addSlab(slabBytes);
+        remaining = slabBytes;
+    }
+    char *block = cursor;
+    cursor += size;
+    remaining -= size;
+    return block;
+}
+
+void SlabArena::deallocate(void *block, size_t bytes) {
+    size_t size = blockSize(bytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    usedBytes -= size;
+    freeBlocks[size].push_back(block);
+}
+
+size_t SlabArena::getSlabCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return slabs.size();
+}
+
+size_t SlabArena::getReservedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return reservedBytes;
+}
+
+size_t SlabArena::getUsedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return usedBytes;
+}
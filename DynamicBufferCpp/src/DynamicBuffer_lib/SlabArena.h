@@ -0,0 +1,135 @@
+#ifndef SLAB_ARENA_H
+#define SLAB_ARENA_H
+
+#include "constants.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Allocator of fixed-size blocks carved from large slabs. A freed block is
+// kept on the free list of its size and handed out again, so that buffers
+// of the same shape (see DynamicBufferPool), which request the same few
+// block sizes, reuse each other's memory instead of each going through
+// malloc. The slabs are only released with the arena.
+class SlabArena {
+public:
+  explicit SlabArena(size_t slabBytes = DEFAULT_SLAB_BYTES);
+  SlabArena(const SlabArena &) = delete;
+  SlabArena &operator=(const SlabArena &) = delete;
+
+  // Block of at least bytes bytes, aligned on SLAB_BLOCK_ALIGNMENT. Blocks
+  // larger than a slab get a slab of their own.
+  void *allocate(size_t bytes);
+
+  // Returns a block of allocate(bytes) to the arena
+  void deallocate(void *block, size_t bytes);
+
+  size_t getSlabCount() const;
+
+  // Bytes of the slabs / of the blocks currently handed out
+  size_t getReservedBytes() const;
+  size_t getUsedBytes() const;
+
+private:
+  size_t slabBytes;
+  std::vector<std::unique_ptr<char[]>> slabs;
+  char *cursor;     // Free space at the end of the last slab
+  size_t remaining;
+  std::unordered_map<size_t, std::vector<void *>> freeBlocks; // By block size
+  size_t reservedBytes;
+  size_t usedBytes;
+  mutable std::mutex mutex;
+
+  static size_t blockSize(size_t bytes);
+
+  // Aligned space of bytes bytes at the start of a new slab
+  char *addSlab(size_t bytes);
+};
+
+// Standard allocator drawing from a SlabArena, or from the heap without one.
+// It can also adopt a block of a mapped region (see adopt) instead of
+// allocating it: the elements constructed without a value in the region are
+// left as they are, and the blocks of the region are never freed.
+template <typename U>
+struct ArenaAllocator {
+  using value_type = U;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  SlabArena *arena;
+  U *adopted = nullptr; // Block returned by the next allocate call
+  const char *regionBegin = nullptr;
+  const char *regionEnd = nullptr;
+
+  ArenaAllocator(SlabArena *arena = nullptr) noexcept : arena(arena) {}
+
+  template <typename V>
+  ArenaAllocator(const ArenaAllocator<V> &other) noexcept
+      : arena(other.arena), regionBegin(other.regionBegin), regionEnd(other.regionEnd) {}
+
+  // Hands out block, lying in [begin, end), on the next allocate call
+  void adopt(U *block, const char *begin, const char *end) {
+    adopted = block;
+    regionBegin = begin;
+    regionEnd = end;
+  }
+
+  bool inRegion(const void *block) const {
+    const char *bytes = static_cast<const char *>(block);
+    return bytes >= regionBegin && bytes < regionEnd;
+  }
+
+  U *allocate(size_t n) {
+    if (adopted != nullptr) {
+      U *block = adopted;
+      adopted = nullptr;
+      return block;
+    }
+    if (arena == nullptr) {
+      return static_cast<U *>(::operator new(n * sizeof(U)));
+    }
+    return static_cast<U *>(arena->allocate(n * sizeof(U)));
+  }
+
+  void deallocate(U *block, size_t n) noexcept {
+    if (inRegion(block)) {
+      return;
+    }
+    if (arena == nullptr) {
+      ::operator delete(block);
+    } else {
+      arena->deallocate(block, n * sizeof(U));
+    }
+  }
+
+  template <typename V>
+  void construct(V *element) {
+    if (!inRegion(element)) {
+      ::new (static_cast<void *>(element)) V();
+    }
+  }
+
+  template <typename V, typename First, typename... Rest>
+  void construct(V *element, First &&first, Rest &&...rest) {
+    ::new (static_cast<void *>(element)) V(std::forward<First>(first), std::forward<Rest>(rest)...);
+  }
+};
+
+template <typename U, typename V>
+bool operator==(const ArenaAllocator<U> &a, const ArenaAllocator<V> &b) {
+  return a.arena == b.arena && a.regionBegin == b.regionBegin;
+}
+
+template <typename U, typename V>
+bool operator!=(const ArenaAllocator<U> &a, const ArenaAllocator<V> &b) {
+  return !(a == b);
+}
+
+#endif // SLAB_ARENA_H
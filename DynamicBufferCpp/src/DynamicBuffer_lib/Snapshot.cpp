@@ -0,0 +1,72 @@
+#include "Snapshot.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool isLittleEndianHost() {
+    const uint16_t probe = 1;
+    unsigned char firstByte;
+    std::memcpy(&firstByte, &probe, 1);
+    return firstByte == 1;
+}
+
+void replaceFile(const std::string &from, const std::string &path) {
+    int fd = ::open(from.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + from);
+    }
+    int synced = ::fsync(fd);
+    ::close(fd);
+    if (synced != 0 || ::rename(from.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace " + path);
+    }
+    // The rename itself is durable once the directory is synced
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+MappedFile::MappedFile(const std::string &path) : bytes(nullptr), length(0), device(0), inode(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot read the size of " + path);
+    }
+    length = static_cast<size_t>(status.st_size);
+    device = status.st_dev;
+    inode = status.st_ino;
+    if (length > 0) {
+        // Private and writable: the writes copy the pages instead of reaching the file
+        void *mapping = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map " + path);
+        }
+        bytes = static_cast<char *>(mapping);
+    }
+    // The mapping stays valid once the descriptor is closed
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (bytes != nullptr) {
+        ::munmap(bytes, length);
+    }
+}
+
+bool MappedFile::isFile(const std::string &path) const {
+    struct stat status;
+    return ::stat(path.c_str(), &status) == 0 && status.st_dev == device && status.st_ino == inode;
+}
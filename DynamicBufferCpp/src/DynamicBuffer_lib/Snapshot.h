@@ -0,0 +1,97 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "constants.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+// Snapshot files of the buffers (see BasicDynamicBuffer::saveSnapshot): a
+// header page followed by the sections below, each starting on a page so
+// that it can be served from a mapping of the file. All the values are
+// little-endian, as they are laid out in memory.
+constexpr char SNAPSHOT_MAGIC[8] = {'D', 'Y', 'N', 'B', 'U', 'F', 'S', 'N'};
+constexpr uint64_t SNAPSHOT_VERSION = 1;
+
+// Class of the buffer a snapshot was taken from, only loaded by the same class
+enum class SnapshotKind : uint64_t { DynamicBuffer = 0, LastKnownValuesBuffer = 1 };
+
+// Row storage as in memory (ring of bufferRows rows starting at headRow),
+// then the state of the derived class
+enum SnapshotSection {
+  SNAPSHOT_DATA,
+  SNAPSHOT_TIMESTAMPS,
+  SNAPSHOT_COUNTERS,
+  SNAPSHOT_UPDATE_COUNTS,
+  SNAPSHOT_VALIDITY,
+  SNAPSHOT_EXTRA,
+  SNAPSHOT_SECTION_COUNT
+};
+
+struct SnapshotHeader {
+  char magic[8];
+  uint64_t version;
+  uint64_t kind;
+  // Value type: size in bytes and whether it is a floating point type
+  uint64_t valueBytes;
+  uint64_t valueFloating;
+  uint64_t storageMode;
+  uint64_t dataLayout;
+  uint64_t nVariables;
+  uint64_t windowSize;
+  // BufferPolicy, but the arena
+  uint64_t policyMaxRows;
+  uint64_t lazyAllocation;
+  double growthFactor;
+  double evictionRatio;
+  uint64_t minRetainedRows;
+  int64_t retentionSpan;
+  uint64_t maxRows;
+  uint64_t bufferRows;
+  uint64_t headRow;
+  uint64_t numRows;
+  uint64_t zeroPrefix;
+  uint64_t evictionHighWaterMark;
+  uint64_t maskStride;
+  uint64_t maxStagedRows;
+  uint64_t rollingStatistics;
+  // In bytes from the start of the file
+  uint64_t sectionOffsets[SNAPSHOT_SECTION_COUNT];
+  uint64_t sectionBytes[SNAPSHOT_SECTION_COUNT];
+};
+
+static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_PAGE_BYTES, "The header must fit its page");
+
+// Whether the host stores the values little-endian, as the snapshots do
+bool isLittleEndianHost();
+
+// Syncs the file written at from and renames it to path, so that path holds
+// either its previous content or the whole new one. Throws
+// std::runtime_error if it can't be synced or renamed.
+void replaceFile(const std::string &from, const std::string &path);
+
+// File mapped copy-on-write: the pages written to become private copies, the
+// file itself is never modified. The mapping lives as long as the object.
+class MappedFile {
+public:
+  // Throws std::runtime_error if the file can't be opened or mapped
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+  // Whether path names the mapped file
+  bool isFile(const std::string &path) const;
+
+private:
+  char *bytes;
+  size_t length;
+  dev_t device;
+  ino_t inode;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,285 @@
+#include "WriteAheadLog.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+uint64_t checksum(const WriteAheadRecord *records, size_t count) {
+    const char *bytes = reinterpret_cast<const char *>(records);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < count * sizeof(WriteAheadRecord); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Reads size bytes at the current offset of fd, false at the end of the file
+bool readAll(int fd, char *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t read = ::read(fd, bytes, size);
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            return false;
+        }
+        bytes += read;
+        size -= static_cast<size_t>(read);
+    }
+    return true;
+}
+
+// Reads the groups following the header at the current offset of fd, out of
+// remaining bytes, up to the first torn or corrupted one, appending their
+// records to records if not null. Returns the number of bytes of the groups read.
+size_t readGroups(int fd, size_t remaining, std::vector<WriteAheadRecord> *records) {
+    std::vector<WriteAheadRecord> scratch;
+    std::vector<WriteAheadRecord> &read = records != nullptr ? *records : scratch;
+    size_t valid = 0;
+    WriteAheadGroupHeader group;
+    // The groups are read straight into the records, the group header
+    // ahead of them
+    while (remaining >= sizeof(group) && readAll(fd, reinterpret_cast<char *>(&group), sizeof(group))) {
+        remaining -= sizeof(group);
+        size_t groupBytes = static_cast<size_t>(group.count) * sizeof(WriteAheadRecord);
+        if (group.marker != WRITE_AHEAD_GROUP_MARKER || groupBytes > remaining) {
+            break; // Torn by a crash during the write
+        }
+        size_t first = records != nullptr ? read.size() : 0;
+        read.resize(first + group.count);
+        if (!readAll(fd, reinterpret_cast<char *>(read.data() + first), groupBytes) ||
+            checksum(read.data() + first, group.count) != group.checksum) {
+            read.resize(first);
+            break;
+        }
+        remaining -= groupBytes;
+        valid += sizeof(group) + groupBytes;
+    }
+    return valid;
+}
+
+// Opens the log at path for reading past its header, checked against the
+// value type, along with the number of bytes following it
+int openLog(const std::string &path, size_t valueBytes, bool valueFloating, size_t &remaining) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot read the size of " + path);
+    }
+    remaining = static_cast<size_t>(status.st_size);
+    WriteAheadLogHeader header;
+    if (remaining < sizeof(header) || !readAll(fd, reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, WRITE_AHEAD_LOG_MAGIC, sizeof(header.magic)) != 0) {
+        ::close(fd);
+        throw std::invalid_argument("Not a write-ahead log");
+    }
+    if (header.version != WRITE_AHEAD_LOG_VERSION) {
+        ::close(fd);
+        throw std::invalid_argument("Unsupported write-ahead log version");
+    }
+    if (header.valueBytes != valueBytes || header.valueFloating != (valueFloating ? 1u : 0u)) {
+        ::close(fd);
+        throw std::invalid_argument("Write-ahead log of another value type");
+    }
+    remaining -= sizeof(header);
+    return fd;
+}
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string &path, const WriteAheadLogPolicy &policy)
+    : path(path), policy(policy), fd(-1), lastSync(Clock::now()), flushCount(0),
+      lastClockCheck(lastSync), clockStride(1), nextClockCheck(0) {
+    if (!isLittleEndianHost()) {
+        throw std::logic_error("Write-ahead logs need a little-endian host");
+    }
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    try {
+        truncateTornTail();
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+void WriteAheadLog::truncateTornTail() {
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        throw std::runtime_error("Cannot read the size of " + path);
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    WriteAheadLogHeader header;
+    size_t headerBytes = std::min(size, sizeof(header));
+    if (!readAll(fd, reinterpret_cast<char *>(&header), headerBytes) ||
+        std::memcmp(header.magic, WRITE_AHEAD_LOG_MAGIC, std::min(headerBytes, sizeof(header.magic))) != 0) {
+        return; // Empty, or not a log: left to bindValueType
+    }
+    // The groups appended from now on must follow the last whole one, or
+    // the replay would stop at the torn one before them
+    size_t valid = 0;
+    if (headerBytes == sizeof(header)) {
+        valid = sizeof(header) + readGroups(fd, size - sizeof(header), nullptr);
+    }
+    if (valid < size && ::ftruncate(fd, static_cast<off_t>(valid)) != 0) {
+        throw std::runtime_error("Cannot truncate " + path);
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    try {
+        flush();
+    } catch (const std::exception &) {
+        // Nothing to report the error to
+    }
+    ::close(fd);
+}
+
+void WriteAheadLog::bindValueType(size_t valueBytes, bool valueFloating) {
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        throw std::runtime_error("Cannot read the size of " + path);
+    }
+    if (status.st_size == 0) {
+        WriteAheadLogHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, WRITE_AHEAD_LOG_MAGIC, sizeof(header.magic));
+        header.version = WRITE_AHEAD_LOG_VERSION;
+        header.valueBytes = valueBytes;
+        header.valueFloating = valueFloating;
+        writeAll(reinterpret_cast<const char *>(&header), sizeof(header));
+        return;
+    }
+    size_t remaining;
+    ::close(openLog(path, valueBytes, valueFloating, remaining));
+}
+
+WriteAheadRecord *WriteAheadLog::beginRecords(size_t count) {
+    if (pending.empty() && policy.flushIntervalMillis > 0) {
+        oldestPending = Clock::now();
+        lastClockCheck = oldestPending;
+        nextClockCheck = clockStride;
+    }
+    pending.resize(pending.size() + count);
+    return pending.data() + pending.size() - count;
+}
+
+void WriteAheadLog::commitRecords() {
+    if (pending.size() * sizeof(WriteAheadRecord) >= policy.flushBytes) {
+        flush();
+        return;
+    }
+    if (policy.flushIntervalMillis == 0 || pending.size() < nextClockCheck) {
+        return;
+    }
+    std::chrono::milliseconds interval(policy.flushIntervalMillis);
+    Clock::time_point now = Clock::now();
+    if (now - oldestPending >= interval) {
+        flush();
+        return;
+    }
+    // Twice as many records before the next read while they come in a
+    // small fraction of the interval, every record otherwise
+    clockStride = now - lastClockCheck < interval / 16 ? std::min(2 * clockStride, WAL_MAX_CLOCK_STRIDE) : 1;
+    lastClockCheck = now;
+    nextClockCheck = pending.size() + clockStride;
+}
+
+void WriteAheadLog::flush() {
+    if (pending.empty()) {
+        return;
+    }
+    // A group is a single write: the header and its records
+    WriteAheadGroupHeader header;
+    header.marker = WRITE_AHEAD_GROUP_MARKER;
+    header.count = static_cast<uint32_t>(pending.size());
+    header.checksum = checksum(pending.data(), pending.size());
+    const char *records = reinterpret_cast<const char *>(pending.data());
+    size_t recordBytes = pending.size() * sizeof(WriteAheadRecord);
+    struct iovec parts[2] = {{&header, sizeof(header)}, {const_cast<char *>(records), recordBytes}};
+    ssize_t written = ::writev(fd, parts, 2);
+    if (written < 0 && errno != EINTR) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+    // What a short write left
+    size_t done = written < 0 ? 0 : static_cast<size_t>(written);
+    if (done < sizeof(header)) {
+        writeAll(reinterpret_cast<const char *>(&header) + done, sizeof(header) - done);
+        done = sizeof(header);
+    }
+    writeAll(records + (done - sizeof(header)), recordBytes - (done - sizeof(header)));
+    pending.clear();
+    ++flushCount;
+
+    if (policy.fsync == FsyncPolicy::EveryFlush ||
+        (policy.fsync == FsyncPolicy::Periodic &&
+         Clock::now() - lastSync >= std::chrono::milliseconds(policy.fsyncIntervalMillis))) {
+        syncFile();
+    }
+}
+
+void WriteAheadLog::sync() {
+    flush();
+    syncFile();
+}
+
+void WriteAheadLog::syncFile() {
+    if (::fsync(fd) != 0) {
+        throw std::runtime_error("Cannot sync " + path);
+    }
+    lastSync = Clock::now();
+}
+
+void WriteAheadLog::reset() {
+    pending.clear();
+    struct stat status;
+    if (::fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) > sizeof(WriteAheadLogHeader)) {
+        if (::ftruncate(fd, sizeof(WriteAheadLogHeader)) != 0) {
+            throw std::runtime_error("Cannot truncate " + path);
+        }
+    }
+}
+
+size_t WriteAheadLog::getBufferedRecordCount() const { return pending.size(); }
+
+size_t WriteAheadLog::getFlushCount() const { return flushCount; }
+
+const std::string &WriteAheadLog::getPath() const { return path; }
+
+void WriteAheadLog::writeAll(const char *bytes, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Cannot write " + path);
+        }
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+std::vector<WriteAheadRecord> WriteAheadLog::readRecords(const std::string &path, size_t valueBytes,
+                                                         bool valueFloating) {
+    size_t remaining;
+    int fd = openLog(path, valueBytes, valueFloating, remaining);
+    std::vector<WriteAheadRecord> records;
+    readGroups(fd, remaining, &records);
+    ::close(fd);
+    return records;
+}
@@ -0,0 +1,147 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include "constants.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Write-ahead log files (see BasicDynamicBuffer::setWriteAheadLog): a header
+// giving the value type, then groups of fixed-width records, each group
+// being one write of the log and carrying its own checksum. All the values
+// are little-endian.
+constexpr char WRITE_AHEAD_LOG_MAGIC[8] = {'D', 'Y', 'N', 'B', 'U', 'F', 'W', 'L'};
+constexpr uint64_t WRITE_AHEAD_LOG_VERSION = 1;
+constexpr uint32_t WRITE_AHEAD_GROUP_MARKER = 0x47504c57; // "WLPG"
+
+// Mutations of a buffer as logged
+enum class WriteAheadOp : uint32_t {
+  AddOrUpdate = 1,
+  // Calls of addOrUpdateRecords / decrementCounters over value samples or
+  // timestamps, followed by as many BatchSample records
+  AddOrUpdateBatch = 2,
+  BatchSample = 3,
+  Delete = 4,
+  DecrementCounters = 5,
+  RemoveFront = 6, // Of value rows
+  RemoveZeroCount = 7,
+  UpdateLastKnownValue = 8
+};
+
+// 24 bytes: the value holds the bits of the buffer's value type (zero
+// extended to 64 bits), or a count
+struct WriteAheadRecord {
+  uint32_t op;
+  uint32_t column;
+  int64_t timestamp;
+  uint64_t value;
+};
+
+static_assert(sizeof(WriteAheadRecord) == 24, "The records must be packed");
+
+struct WriteAheadGroupHeader {
+  uint32_t marker;
+  uint32_t count;    // Number of records of the group
+  uint64_t checksum; // FNV-1a over the 64-bit words of the records
+};
+
+struct WriteAheadLogHeader {
+  char magic[8];
+  uint64_t version;
+  uint64_t valueBytes;
+  uint64_t valueFloating;
+};
+
+// When the written groups are forced to the disk
+enum class FsyncPolicy {
+  Never,      // Left to the operating system
+  EveryFlush, // Each group is durable once flush returns
+  Periodic    // At most every fsyncIntervalMillis, on a flush
+};
+
+struct WriteAheadLogPolicy {
+  // The records are buffered and written as one group once they reach
+  // flushBytes bytes or once the oldest one is flushIntervalMillis old (0
+  // for the size only). The age is checked as records are appended, every
+  // few records while they come fast: call flush when the buffer goes idle.
+  size_t flushBytes = DEFAULT_WAL_FLUSH_BYTES;
+  long flushIntervalMillis = 100;
+  FsyncPolicy fsync = FsyncPolicy::Never;
+  long fsyncIntervalMillis = 1000;
+};
+
+// Append-only log of the mutations of a buffer, replayed into a buffer in
+// the state it was in when the log was started (empty, or loaded from the
+// snapshot after which reset was called). Used by a single writer.
+class WriteAheadLog {
+public:
+  // Opens or creates the log at path, appending to its records once the torn
+  // group a crash may have left at its end is truncated. Throws
+  // std::runtime_error if the file can't be opened.
+  explicit WriteAheadLog(const std::string &path,
+                         const WriteAheadLogPolicy &policy = WriteAheadLogPolicy());
+  // Flushes the buffered records
+  ~WriteAheadLog();
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // Writes the header of an empty log, or checks that the log holds values
+  // of this type (std::invalid_argument otherwise)
+  void bindValueType(size_t valueBytes, bool valueFloating);
+
+  void append(const WriteAheadRecord &record) {
+    *beginRecords(1) = record;
+    commitRecords();
+  }
+
+  // Space for the count records of one operation, then the end of it: the
+  // records of an operation always go to the same group
+  WriteAheadRecord *beginRecords(size_t count);
+  void commitRecords();
+
+  // Writes the buffered records as one group, syncing it following the
+  // policy. Throws std::runtime_error if the write or the sync fails.
+  void flush();
+
+  // Flushes and forces the log to the disk
+  void sync();
+
+  // Drops all the records, buffered or written, once a snapshot holds them
+  void reset();
+
+  size_t getBufferedRecordCount() const;
+
+  // Number of groups written
+  size_t getFlushCount() const;
+
+  const std::string &getPath() const;
+
+  // Records of the log at path, up to the first torn or corrupted group.
+  // Throws std::invalid_argument if the file isn't a log of this value type.
+  static std::vector<WriteAheadRecord> readRecords(const std::string &path, size_t valueBytes,
+                                                   bool valueFloating);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  std::string path;
+  WriteAheadLogPolicy policy;
+  int fd;
+  std::vector<WriteAheadRecord> pending;
+  Clock::time_point oldestPending;
+  Clock::time_point lastSync;
+  size_t flushCount;
+  // Reading the clock costs more than appending a record: it is read once
+  // every clockStride records, more often as they slow down
+  Clock::time_point lastClockCheck;
+  size_t clockStride;
+  size_t nextClockCheck; // Number of buffered records
+
+  void writeAll(const char *bytes, size_t size);
+  void truncateTornTail();
+  void syncFile();
+};
+
+#endif // WRITE_AHEAD_LOG_H
@@ -6,4 +6,17 @@
 #define CONSTANTS_H
 #include <cstddef>
 constexpr size_t DEFAULT_BUFFER_LENGTH_FACTOR = 3;
+// Smallest growth step of a lazily allocated buffer, in rows
+constexpr size_t MIN_GROWTH_ROWS = 8;
+// Slabs of a SlabArena and alignment of the blocks carved from them, in bytes
+constexpr size_t DEFAULT_SLAB_BYTES = size_t(1) << 20;
+constexpr size_t SLAB_BLOCK_ALIGNMENT = 64;
+// Alignment of the sections of the snapshot files, in bytes
+constexpr size_t SNAPSHOT_PAGE_BYTES = 4096;
+// Size from which the records buffered by a WriteAheadLog are written, in bytes
+constexpr size_t DEFAULT_WAL_FLUSH_BYTES = size_t(64) << 10;
+// Most records a WriteAheadLog appends between two reads of the clock
+constexpr size_t WAL_MAX_CLOCK_STRIDE = 64;
+// Fewest series gathered by each thread of gatherSlices
+constexpr size_t GATHER_SERIES_PER_THREAD = 64;
 #endif // CONSTANTS_H